@@ -0,0 +1,374 @@
+#pragma once
+
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <condition_variable>
+
+#include "ffmpeg.h"
+#include "averror.h"
+#include "packet.h"
+#include "frame.h"
+#include "codeccontext.h"
+#include "spscqueue.h"
+
+namespace av {
+
+/**
+ * @brief The AsyncDecoder class - decodes packets on the worker thread
+ *
+ * Packets are passed to the worker via bounded packet queue, decoded frames are returned via
+ * bounded frame queue. Queues provide backpressure: sendPacket() blocks while packet queue is full
+ * and worker blocks while caller does not take frames. So demuxing and decoding overlap in time
+ * with bounded memory usage.
+ *
+ * Packets are sent from one thread and frames are received from one thread. Blocking
+ * sendPacket() and sendEof() wait for the worker, that waits for the receiver when frame queue is
+ * full, so they must not be called from the receiving thread. Single thread use is non-blocking
+ * only: trySendPacket()/trySendEof() and tryReceiveFrame() until end of stream is sent,
+ * receiveFrame() after it. flush() is called from the receiving thread, concurrently with
+ * sending.
+ *
+ * Decoding errors are reported by receiveFrame() in order with frames, decoding continues after
+ * them.
+ */
+template<typename Decoder>
+class AsyncDecoder : public noncopyable
+{
+public:
+    using FrameType = typename DecoderFrameType<Decoder>::type;
+
+    static constexpr size_t DefaultQueueSize = 16;
+
+    /**
+     * @param decoder          opened decoder, owned by the worker until destruction
+     * @param packetQueueSize  max packets waiting for the decoding
+     * @param frameQueueSize   max decoded frames waiting for the receiveFrame() call
+     */
+    explicit AsyncDecoder(Decoder &&decoder,
+                          size_t packetQueueSize = DefaultQueueSize,
+                          size_t frameQueueSize  = DefaultQueueSize)
+        : m_decoder(std::move(decoder)),
+          m_packets(packetQueueSize),
+          m_frames(frameQueueSize)
+    {
+        m_worker = std::thread([this] { run(); });
+    }
+
+    ~AsyncDecoder()
+    {
+        stop();
+    }
+
+    /**
+     * Decoder is used by worker: it is safe to access only after stop()
+     */
+    Decoder& decoder() noexcept
+    {
+        return m_decoder;
+    }
+
+    /**
+     * @brief sendPacket - queue packet for decoding, wait while packet queue is full
+     *
+     * Null packet is same as sendEof().
+     *
+     * @param packet  packet to decode, moved out on success
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     * @return true if packet queued, false if decoder stopped or end of stream already sent
+     */
+    bool sendPacket(Packet &&packet, OptionalErrorCode ec = throws())
+    {
+        return send(packet, ec, true);
+    }
+
+    /**
+     * Like sendPacket() but returns false without waiting when packet queue is full.
+     */
+    bool trySendPacket(Packet &packet, OptionalErrorCode ec = throws())
+    {
+        return send(packet, ec, false);
+    }
+
+    /**
+     * @brief sendEof - signal end of stream: decoder is drained and receiveFrame() returns false
+     *        when all frames taken. Call flush() to continue decoding after it.
+     */
+    bool sendEof(OptionalErrorCode ec = throws())
+    {
+        Packet packet;
+        return send(packet, ec, true);
+    }
+
+    /**
+     * Like sendEof() but returns false without waiting when packet queue is full.
+     */
+    bool trySendEof(OptionalErrorCode ec = throws())
+    {
+        Packet packet;
+        return send(packet, ec, false);
+    }
+
+    /**
+     * @brief receiveFrame - take next decoded frame, wait while it is not ready
+     *
+     * @param frame   decoded frame
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     * @return true if frame received, false at the end of stream, on stop or on decoding error
+     */
+    bool receiveFrame(FrameType &frame, OptionalErrorCode ec = throws())
+    {
+        return receive(frame, ec, true);
+    }
+
+    /**
+     * Like receiveFrame() but returns false without waiting when no frame ready.
+     */
+    bool tryReceiveFrame(FrameType &frame, OptionalErrorCode ec = throws())
+    {
+        return receive(frame, ec, false);
+    }
+
+    /**
+     * @return true when end of stream reached: all frames after sendEof() are received
+     */
+    bool isEof() const noexcept
+    {
+        return m_eofReceived;
+    }
+
+    /**
+     * @brief flush - drop queued packets and frames, reset decoder state
+     *
+     * Must be called after seeking or to restart decoding after end of stream. Waits until worker
+     * resets decoder. Packet queue belongs to the sender, so request goes to the worker aside of
+     * it, packets sent before the call are dropped by the worker.
+     */
+    void flush()
+    {
+        if (!m_worker.joinable())
+            return;
+
+        const uint64_t generation = ++m_generation;
+        m_flushRequest.store(generation);
+        notifyWorker();
+
+        // Frames are taken while waiting: worker can be blocked on full frame queue
+        FrameItem item;
+        while (m_frames.pop(item)) {
+            if (item.command == Command::Flush && item.generation == generation)
+                break;
+        }
+
+        m_eofSent     = false;
+        m_eofReceived = false;
+    }
+
+    /**
+     * @brief stop - stop worker thread, queued packets and frames are dropped
+     */
+    void stop()
+    {
+        if (!m_worker.joinable())
+            return;
+
+        m_stop = true;
+        m_packets.close();
+        m_frames.close();
+        {
+            std::lock_guard<std::mutex> lock(m_workerMutex);
+        }
+        m_workerCond.notify_all();
+        m_worker.join();
+    }
+
+private:
+    enum class Command
+    {
+        Packet,
+        Flush,
+        Eof,
+        Error,
+    };
+
+    struct PacketItem
+    {
+        Packet   packet;
+        uint64_t generation = 0;
+        Command  command    = Command::Packet;
+    };
+
+    struct FrameItem
+    {
+        FrameType       frame;
+        uint64_t        generation = 0;
+        Command         command    = Command::Packet;
+        std::error_code error;
+    };
+
+    bool send(Packet &packet, OptionalErrorCode ec, bool wait)
+    {
+        clear_if(ec);
+
+        if (m_eofSent) {
+            throws_if(ec, AVERROR_EOF, ffmpeg_category());
+            return false;
+        }
+
+        const Command command = packet.isNull() ? Command::Eof : Command::Packet;
+
+        PacketItem item{std::move(packet), m_generation, command};
+        const bool queued = wait ? m_packets.push(item) : m_packets.tryPush(item);
+        if (!queued) {
+            // Give packet back
+            packet = std::move(item.packet);
+            if (m_packets.isClosed())
+                throws_if(ec, Errors::CodecNotOpened);
+            return false;
+        }
+
+        if (command == Command::Eof)
+            m_eofSent = true;
+        notifyWorker();
+        return true;
+    }
+
+    bool receive(FrameType &frame, OptionalErrorCode ec, bool wait)
+    {
+        clear_if(ec);
+
+        if (m_eofReceived)
+            return false;
+
+        FrameItem item;
+        while (wait ? m_frames.pop(item) : m_frames.tryPop(item)) {
+            // Produced before flush()
+            if (item.generation != m_generation)
+                continue;
+
+            switch (item.command) {
+                case Command::Packet:
+                    frame = std::move(item.frame);
+                    return true;
+
+                case Command::Eof:
+                    m_eofReceived = true;
+                    return false;
+
+                case Command::Error:
+                    throws_if(ec, item.error.value(), item.error.category());
+                    return false;
+
+                case Command::Flush:
+                    break;
+            }
+        }
+
+        return false;
+    }
+
+    void run()
+    {
+        PacketItem item;
+        while (nextPacket(item)) {
+            const uint64_t generation = item.generation;
+
+            // Dropped by flush()
+            if (generation != m_generation)
+                continue;
+
+            std::error_code ec;
+            m_decoder.decodeAll(item.packet, [this, generation](FrameType &frame) {
+                if (generation == m_generation)
+                    m_frames.push(FrameItem{std::move(frame), generation, Command::Packet, {}});
+            }, ec);
+
+            if (ec)
+                m_frames.push(FrameItem{FrameType(), generation, Command::Error, ec});
+
+            if (item.command == Command::Eof)
+                m_frames.push(FrameItem{FrameType(), generation, Command::Eof, {}});
+        }
+    }
+
+    // Worker side: serve flush request first, then take the packet
+    bool nextPacket(PacketItem &item)
+    {
+        for (;;) {
+            if (m_stop)
+                return false;
+
+            const uint64_t request = m_flushRequest.load();
+            if (request != m_flushed) {
+                m_flushed = request;
+                std::error_code ec;
+                m_decoder.flushBuffers(ec);
+                m_frames.push(FrameItem{FrameType(), request, Command::Flush, {}});
+                continue;
+            }
+
+            if (m_packets.tryPop(item))
+                return true;
+
+            if (m_packets.isClosed())
+                return false;
+
+            waitWork();
+        }
+    }
+
+    void waitWork()
+    {
+        std::unique_lock<std::mutex> lock(m_workerMutex);
+        m_workerWaiting.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        m_workerCond.wait(lock, [this] {
+            return m_stop || m_packets.isClosed() || !m_packets.empty() || m_flushRequest.load() != m_flushed;
+        });
+        m_workerWaiting.store(false);
+    }
+
+    void notifyWorker()
+    {
+        // Queue or request update and waiting flag check are sequentially consistent with
+        // waitWork()
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!m_workerWaiting.load())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(m_workerMutex);
+        }
+        m_workerCond.notify_all();
+    }
+
+private:
+    Decoder                 m_decoder;
+
+    SpscQueue<PacketItem>   m_packets;
+    SpscQueue<FrameItem>    m_frames;
+
+    std::atomic<uint64_t>   m_generation{0};
+    std::atomic<bool>       m_stop{false};
+
+    // Flush requests: generation to flush at, last served one is known to the worker only
+    std::atomic<uint64_t>   m_flushRequest{0};
+    uint64_t                m_flushed = 0;
+
+    std::mutex              m_workerMutex;
+    std::condition_variable m_workerCond;
+    std::atomic<bool>       m_workerWaiting{false};
+
+    // Caller side state, end of stream flag is reset by flush()
+    std::atomic<bool>       m_eofSent{false};
+    bool                    m_eofReceived = false;
+
+    std::thread             m_worker;
+};
+
+using AsyncVideoDecoder = AsyncDecoder<VideoDecoderContext>;
+using AsyncAudioDecoder = AsyncDecoder<AudioDecoderContext>;
+
+} // namespace av
@@ -0,0 +1,342 @@
+#pragma once
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <functional>
+
+#include "ffmpeg.h"
+#include "averror.h"
+#include "packet.h"
+#include "frame.h"
+#include "codeccontext.h"
+#include "spscqueue.h"
+
+namespace av {
+
+template<typename Encoder>
+struct EncoderFrameType;
+
+template<>
+struct EncoderFrameType<VideoEncoderContext>
+{
+    using type = VideoFrame;
+};
+
+template<>
+struct EncoderFrameType<AudioEncoderContext>
+{
+    using type = AudioSamples;
+};
+
+/**
+ * @brief The AsyncEncoder class - encodes frames on the worker thread
+ *
+ * Frames are passed to the worker via bounded frame queue: sendFrame() blocks while it is full,
+ * so slow encoder throttles producer without unbounded memory growth, but short encoder stalls do
+ * not block capturing/decoding loop.
+ *
+ * Packets are delivered in encoding order by one of the ways:
+ *  - to the callback, called from the worker thread;
+ *  - to the bounded packet queue, taken by receivePacket().
+ *
+ * Encoder is drained by sendEof()/finish() and can't be reused after it.
+ *
+ * Encoding errors are fatal: remaining frames are dropped and error is reported by the next
+ * sendFrame(), receivePacket() or finish() call.
+ */
+template<typename Encoder>
+class AsyncEncoder : public noncopyable
+{
+public:
+    using FrameType      = typename EncoderFrameType<Encoder>::type;
+    using PacketCallback = std::function<void(Packet &packet)>;
+
+    static constexpr size_t DefaultQueueSize = 16;
+
+    /**
+     * Packets delivered via receivePacket()
+     *
+     * @param encoder          opened encoder, owned by the worker until destruction
+     * @param frameQueueSize   max frames waiting for the encoding
+     * @param packetQueueSize  max packets waiting for the receivePacket() call
+     */
+    explicit AsyncEncoder(Encoder &&encoder,
+                          size_t frameQueueSize  = DefaultQueueSize,
+                          size_t packetQueueSize = DefaultQueueSize)
+        : m_encoder(std::move(encoder)),
+          m_frames(frameQueueSize),
+          m_packets(packetQueueSize)
+    {
+        m_worker = std::thread([this] { run(); });
+    }
+
+    /**
+     * Packets delivered to the callback. Packet can be moved out in the callback.
+     *
+     * @param encoder          opened encoder, owned by the worker until destruction
+     * @param callback         packet handler, called from the worker thread
+     * @param frameQueueSize   max frames waiting for the encoding
+     */
+    AsyncEncoder(Encoder &&encoder,
+                 PacketCallback callback,
+                 size_t frameQueueSize = DefaultQueueSize)
+        : m_encoder(std::move(encoder)),
+          m_frames(frameQueueSize),
+          m_packets(1),
+          m_callback(std::move(callback))
+    {
+        m_worker = std::thread([this] { run(); });
+    }
+
+    ~AsyncEncoder()
+    {
+        stop();
+    }
+
+    /**
+     * Encoder is used by worker: it is safe to access only after finish() or stop()
+     */
+    Encoder& encoder() noexcept
+    {
+        return m_encoder;
+    }
+
+    /**
+     * @brief sendFrame - queue frame for encoding, wait while frame queue is full
+     *
+     * @param frame   frame to encode, moved out on success
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     * @return true if frame queued
+     */
+    bool sendFrame(FrameType &&frame, OptionalErrorCode ec = throws())
+    {
+        return send(frame, false, ec, true);
+    }
+
+    /**
+     * Like sendFrame() but returns false without waiting when frame queue is full.
+     */
+    bool trySendFrame(FrameType &frame, OptionalErrorCode ec = throws())
+    {
+        return send(frame, false, ec, false);
+    }
+
+    /**
+     * @brief sendEof - flush encoder after all queued frames
+     */
+    bool sendEof(OptionalErrorCode ec = throws())
+    {
+        FrameType frame(nullptr);
+        return send(frame, true, ec, true);
+    }
+
+    /**
+     * @brief receivePacket - take next encoded packet, wait while it is not ready
+     *
+     * Only for encoder constructed without callback.
+     *
+     * @param packet  encoded packet
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     * @return true if packet received, false at the end of stream, on stop or on error
+     */
+    bool receivePacket(Packet &packet, OptionalErrorCode ec = throws())
+    {
+        return receive(packet, ec, true);
+    }
+
+    /**
+     * Like receivePacket() but returns false without waiting when no packet ready.
+     */
+    bool tryReceivePacket(Packet &packet, OptionalErrorCode ec = throws())
+    {
+        return receive(packet, ec, false);
+    }
+
+    /**
+     * @brief finish - send end of stream and, in callback mode, wait until all packets delivered
+     *
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     */
+    void finish(OptionalErrorCode ec = throws())
+    {
+        clear_if(ec);
+
+        if (!m_eofSent && m_worker.joinable()) {
+            FrameType frame(nullptr);
+            send(frame, true, ec, true);
+            if (is_error(ec))
+                return;
+        }
+
+        if (m_callback && m_worker.joinable())
+            m_worker.join();
+
+        reportError(ec);
+    }
+
+    /**
+     * @brief stop - stop worker thread, queued frames and packets are dropped
+     */
+    void stop()
+    {
+        if (!m_worker.joinable())
+            return;
+
+        m_stop = true;
+        m_frames.close();
+        m_packets.close();
+        m_worker.join();
+    }
+
+private:
+    struct FrameItem
+    {
+        FrameType frame;
+        bool      eof = false;
+    };
+
+    struct PacketItem
+    {
+        Packet packet;
+        bool   eof = false;
+    };
+
+    bool failed() const
+    {
+        std::lock_guard<std::mutex> lock(m_errorMutex);
+        return !!m_error;
+    }
+
+    void setError(const std::error_code &error)
+    {
+        std::lock_guard<std::mutex> lock(m_errorMutex);
+        if (!m_error)
+            m_error = error;
+    }
+
+    bool reportError(OptionalErrorCode ec)
+    {
+        std::error_code error;
+        {
+            std::lock_guard<std::mutex> lock(m_errorMutex);
+            error = m_error;
+        }
+
+        if (!error)
+            return false;
+
+        throws_if(ec, error.value(), error.category());
+        return true;
+    }
+
+    bool send(FrameType &frame, bool eof, OptionalErrorCode ec, bool wait)
+    {
+        clear_if(ec);
+
+        if (reportError(ec))
+            return false;
+
+        if (m_eofSent) {
+            throws_if(ec, AVERROR_EOF, ffmpeg_category());
+            return false;
+        }
+
+        FrameItem item{std::move(frame), eof};
+        const bool queued = wait ? m_frames.push(item) : m_frames.tryPush(item);
+        if (!queued) {
+            // Give frame back
+            frame = std::move(item.frame);
+            if (m_frames.isClosed() && !reportError(ec))
+                throws_if(ec, Errors::CodecNotOpened);
+            return false;
+        }
+
+        m_eofSent = eof;
+        return true;
+    }
+
+    bool receive(Packet &packet, OptionalErrorCode ec, bool wait)
+    {
+        clear_if(ec);
+
+        if (m_callback || m_eofReceived)
+            return false;
+
+        PacketItem item;
+        if (wait ? m_packets.pop(item) : m_packets.tryPop(item)) {
+            if (item.eof) {
+                m_eofReceived = true;
+                return false;
+            }
+            packet = std::move(item.packet);
+            return true;
+        }
+
+        // Closed by worker on error
+        reportError(ec);
+        return false;
+    }
+
+    void deliver(Packet &packet)
+    {
+        if (m_callback)
+            m_callback(packet);
+        else
+            m_packets.push(PacketItem{std::move(packet), false});
+    }
+
+    void run()
+    {
+        FrameItem item;
+        while (!m_stop && m_frames.pop(item)) {
+            // Drop frames after error, but do not block producer
+            if (failed()) {
+                if (item.eof)
+                    break;
+                continue;
+            }
+
+            std::error_code ec;
+            m_encoder.encodeAll(item.frame, [this](Packet &packet) {
+                deliver(packet);
+            }, ec);
+
+            if (ec) {
+                setError(ec);
+                m_packets.close();
+            } else if (item.eof && !m_callback) {
+                m_packets.push(PacketItem{Packet(), true});
+            }
+
+            if (item.eof)
+                break;
+        }
+    }
+
+private:
+    Encoder                 m_encoder;
+
+    SpscQueue<FrameItem>    m_frames;
+    SpscQueue<PacketItem>   m_packets;
+    PacketCallback          m_callback;
+
+    mutable std::mutex      m_errorMutex;
+    std::error_code         m_error;
+
+    std::atomic<bool>       m_stop{false};
+
+    // Caller side state
+    bool                    m_eofSent     = false;
+    bool                    m_eofReceived = false;
+
+    std::thread             m_worker;
+};
+
+using AsyncVideoEncoder = AsyncEncoder<VideoEncoderContext>;
+using AsyncAudioEncoder = AsyncEncoder<AudioEncoderContext>;
+
+} // namespace av
@@ -130,6 +130,11 @@ AVCodecID Codec::id() const
     return RAW_GET(id, AV_CODEC_ID_NONE);
 }
 
+int Codec::maxLowres() const
+{
+    return RAW_GET(max_lowres, 0);
+}
+
 Codec findEncodingCodec(AVCodecID id)
 {
     return Codec { avcodec_find_encoder(id) };
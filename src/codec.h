@@ -32,6 +32,9 @@ public:
     std::deque<uint64_t>       supportedChannelLayouts() const;
 
     AVCodecID id() const;
+
+    /// Maximum lowres factor supported by decoder, 0 - lowres decoding is not supported
+    int maxLowres() const;
 };
 
 
@@ -1,4 +1,8 @@
 #include <stdexcept>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <cstring>
 
 #include "avlog.h"
 #include "avutils.h"
@@ -10,6 +14,7 @@
 #include "dictionary.h"
 #include "codec.h"
 
+#include "videorescaler.h"
 #include "codeccontext.h"
 
 using namespace std;
@@ -31,6 +36,104 @@ make_error_pair(int status)
     return make_pair(status, nullptr);
 }
 
+// Process-wide codec threads budget
+struct ThreadBudget
+{
+    std::mutex mutex;
+    int        limit = 0;
+    int        used  = 0;
+};
+
+ThreadBudget& thread_budget()
+{
+    static ThreadBudget budget;
+    return budget;
+}
+
+// FFmpeg does not use more threads in auto mode too: frame threading adds one frame delay per thread
+constexpr int MaxAutoThreads = 16;
+
+int acquire_threads(int requested)
+{
+    if (requested <= 0) {
+        requested = static_cast<int>(std::thread::hardware_concurrency());
+        requested = std::min(std::max(requested, 1), MaxAutoThreads);
+    }
+
+    auto &budget = thread_budget();
+    std::lock_guard<std::mutex> lock(budget.mutex);
+    if (budget.limit > 0)
+        requested = std::max(1, std::min(requested, budget.limit - budget.used));
+    budget.used += requested;
+    return requested;
+}
+
+// Codec runs its own thread pool (libx264, libx265, dav1d...): active_thread_type stays zero,
+// but thread_count threads are started anyway
+bool codec_has_own_threads(const AVCodec *codec) noexcept
+{
+    if (!codec)
+        return false;
+#if defined(AV_CODEC_CAP_OTHER_THREADS)
+    return codec->capabilities & AV_CODEC_CAP_OTHER_THREADS;
+#elif defined(AV_CODEC_CAP_AUTO_THREADS)
+    return codec->capabilities & AV_CODEC_CAP_AUTO_THREADS;
+#else
+    return false;
+#endif
+}
+
+void release_threads(int count)
+{
+    if (count <= 0)
+        return;
+    auto &budget = thread_budget();
+    std::lock_guard<std::mutex> lock(budget.mutex);
+    budget.used -= count;
+}
+
+// Prepare caller-owned frame to reuse: keep AVFrame, drop data references and attached info
+template<typename T>
+void reset_reused_frame(T &frame)
+{
+    if (frame.isNull()) {
+        frame = T();
+        return;
+    }
+
+    av_frame_unref(frame.raw());
+    // Drop time base without rescaling
+    frame.setTimeBase(Rational());
+    frame.setStreamIndex(-1);
+    frame.setComplete(false);
+}
+
+// Dial with PTS/DTS of the decoded frame: packet/stream timebase -> decoder timebase
+template<typename T>
+void fix_decoded_frame_ts(T &outFrame, const Rational &srcTimeBase, const Rational &dstTimeBase, int streamIndex)
+{
+    outFrame.setTimeBase(srcTimeBase);
+
+    AVFrame *frame = outFrame.raw();
+
+    if (frame->pts == av::NoPts)
+        frame->pts = av::frame::get_best_effort_timestamp(frame);
+
+#if LIBAVCODEC_VERSION_MAJOR < 57
+    if (frame->pts == av::NoPts)
+        frame->pts = frame->pkt_pts;
+#endif
+
+    if (frame->pts == av::NoPts)
+        frame->pts = frame->pkt_dts;
+
+    // Convert to decoder/frame time base. Seems not nessesary.
+    outFrame.setTimeBase(dstTimeBase);
+
+    outFrame.setStreamIndex(streamIndex);
+    outFrame.setComplete(true);
+}
+
 }
 
 GenericCodecContext::GenericCodecContext(Stream st)
@@ -107,7 +210,7 @@ int encode(AVCodecContext *avctx,
     ret = avcodec_receive_packet(avctx, avpkt);
     if (ret < 0 && ret != AVERROR(EAGAIN) && ret != AVERROR_EOF)
         return ret;
-    if (got_packet_ptr)
+    if (ret >= 0 && got_packet_ptr)
         *got_packet_ptr = 1;
     return 0;
 }
@@ -188,14 +291,63 @@ VideoFrame VideoDecoderContext::decode(const Packet &packet, size_t offset, size
     return decodeVideo(ec, packet, offset, &decodedBytes, autoAllocateFrame);
 }
 
+void VideoDecoderContext::setDecodeMode(DecodeMode mode) noexcept
+{
+    if (!isValid())
+        return;
+
+    AVDiscard skipFrame      = AVDISCARD_DEFAULT;
+    AVDiscard skipLoopFilter = AVDISCARD_DEFAULT;
+    AVDiscard skipIdct       = AVDISCARD_DEFAULT;
+
+    switch (mode) {
+        case DecodeMode::All:
+            break;
+        case DecodeMode::NonRef:
+            skipFrame      = AVDISCARD_NONREF;
+            skipLoopFilter = AVDISCARD_NONREF;
+            skipIdct       = AVDISCARD_NONREF;
+            break;
+        case DecodeMode::KeyOnly:
+            skipFrame      = AVDISCARD_NONKEY;
+            break;
+        case DecodeMode::KeyOnlyFast:
+            skipFrame      = AVDISCARD_NONKEY;
+            skipLoopFilter = AVDISCARD_ALL;
+            break;
+    }
+
+    m_raw->skip_frame       = skipFrame;
+    m_raw->skip_loop_filter = skipLoopFilter;
+    m_raw->skip_idct        = skipIdct;
+}
+
+DecodeMode VideoDecoderContext::decodeMode() const noexcept
+{
+    if (!isValid())
+        return DecodeMode::All;
+
+    if (m_raw->skip_frame == AVDISCARD_NONREF)
+        return DecodeMode::NonRef;
+
+    if (m_raw->skip_frame == AVDISCARD_NONKEY)
+        return m_raw->skip_loop_filter == AVDISCARD_ALL ? DecodeMode::KeyOnlyFast : DecodeMode::KeyOnly;
+
+    return DecodeMode::All;
+}
+
 VideoFrame VideoDecoderContext::decodeVideo(OptionalErrorCode ec, const Packet &packet, size_t offset, size_t *decodedBytes, bool autoAllocateFrame)
 {
     clear_if(ec);
 
     VideoFrame outFrame;
+#if !NEW_CODEC_API
+    // avcodec_receive_frame() unreferences output frame before filling, so preallocated buffer
+    // only useful for the legacy API
     if (!autoAllocateFrame)
     {
-        outFrame = {pixelFormat(), width(), height(), 32};
+        // Decoder output size: without lowres fallback downscale
+        outFrame = {pixelFormat(), Parent::width(), Parent::height(), 32};
 
         if (!outFrame.isValid())
         {
@@ -203,6 +355,9 @@ VideoFrame VideoDecoderContext::decodeVideo(OptionalErrorCode ec, const Packet &
             return VideoFrame();
         }
     }
+#else
+    static_cast<void>(autoAllocateFrame);
+#endif
 
     int gotFrame = 0;
     auto st = decodeCommon(outFrame, packet, offset, gotFrame, avcodec_decode_video_legacy);
@@ -215,6 +370,9 @@ VideoFrame VideoDecoderContext::decodeVideo(OptionalErrorCode ec, const Packet &
     if (!gotFrame)
         return VideoFrame();
 
+    if (!finishDecodedFrame(outFrame, ec))
+        return VideoFrame();
+
     outFrame.setPictureType(AV_PICTURE_TYPE_I);
 
     if (decodedBytes)
@@ -223,6 +381,52 @@ VideoFrame VideoDecoderContext::decodeVideo(OptionalErrorCode ec, const Packet &
     return outFrame;
 }
 
+bool VideoDecoderContext::decode(const Packet &packet, VideoFrame &frame, OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    reset_reused_frame(frame);
+
+    int gotFrame = 0;
+    auto st = decodeCommon(frame, packet, 0, gotFrame, avcodec_decode_video_legacy);
+
+    if (get<1>(st)) {
+        throws_if(ec, get<0>(st), *get<1>(st));
+        return false;
+    }
+
+    if (!gotFrame)
+        return false;
+
+    return finishDecodedFrame(frame, ec);
+}
+
+bool VideoDecoderContext::receiveFrame(VideoFrame &frame, OptionalErrorCode ec)
+{
+    if (!receiveFrameCommon(frame, ec))
+        return false;
+
+    return finishDecodedFrame(frame, ec);
+}
+
+bool VideoDecoderContext::finishDecodedFrame(VideoFrame &frame, OptionalErrorCode ec)
+{
+    // Timestamps are fixed by decodeCommon()/receiveFrameCommon(), the rest is common for all
+    // decode paths. Picture type set by the decoder is kept.
+    applyLowresFallback(frame, ec);
+    return !is_error(ec);
+}
+
+int VideoDecoderContext::width() const
+{
+    return AV_CEIL_RSHIFT(Parent::width(), lowresSizeShift());
+}
+
+int VideoDecoderContext::height() const
+{
+    return AV_CEIL_RSHIFT(Parent::height(), lowresSizeShift());
+}
+
 VideoEncoderContext::VideoEncoderContext(VideoEncoderContext &&other)
     : Parent(std::move(other))
 {
@@ -269,6 +473,18 @@ void CodecContext2::swap(CodecContext2 &other)
     using std::swap;
     swap(m_stream, other.m_stream);
     swap(m_raw, other.m_raw);
+    swap(m_decodeTimeBase, other.m_decodeTimeBase);
+    swap(m_decodeStreamIndex, other.m_decodeStreamIndex);
+    swap(m_encodeTimeBase, other.m_encodeTimeBase);
+    swap(m_encodeStreamIndex, other.m_encodeStreamIndex);
+    swap(m_framePool, other.m_framePool);
+    swap(m_reservedThreads, other.m_reservedThreads);
+    swap(m_lowres, other.m_lowres);
+    swap(m_lowresRescaler, other.m_lowresRescaler);
+    swap(m_lowresFrame, other.m_lowresFrame);
+    swap(m_audioFifo, other.m_audioFifo);
+    swap(m_audioChunk, other.m_audioChunk);
+    swap(m_audioFifoPts, other.m_audioFifoPts);
 }
 
 CodecContext2::CodecContext2()
@@ -324,6 +540,9 @@ CodecContext2::CodecContext2(const Codec &codec, Direction direction, AVMediaTyp
 
 CodecContext2::~CodecContext2()
 {
+    releaseThreads();
+    freeAudioFifo();
+
     //
     // Do not track stream-oriented codec:
     //  - Stream always owned by FormatContext
@@ -450,6 +669,8 @@ void CodecContext2::close(OptionalErrorCode ec)
     if (isOpened())
     {
         avcodec_close(m_raw);
+        releaseThreads();
+        freeAudioFifo();
         return;
     }
     throws_if(ec, Errors::CodecNotOpened);
@@ -597,6 +818,62 @@ void CodecContext2::setStrict(int strict) noexcept
     RAW_SET2(isValid(), strict_std_compliance, strict);
 }
 
+void CodecContext2::setThreadCount(int count) noexcept
+{
+    RAW_SET2(isValid(), thread_count, std::max(count, static_cast<int>(AutoThreadCount)));
+}
+
+int CodecContext2::threadCount() const noexcept
+{
+    return RAW_GET2(isValid(), thread_count, 1);
+}
+
+void CodecContext2::setThreadType(ThreadType type) noexcept
+{
+    RAW_SET2(isValid(), thread_type, static_cast<int>(type));
+}
+
+ThreadType CodecContext2::threadType() const noexcept
+{
+    return static_cast<ThreadType>(RAW_GET2(isValid(), thread_type, 0));
+}
+
+ThreadType CodecContext2::activeThreadType() const noexcept
+{
+    return isOpened() ? static_cast<ThreadType>(m_raw->active_thread_type) : ThreadType::None;
+}
+
+CodecContext2::ThreadingInfo CodecContext2::threadingInfo() const noexcept
+{
+    ThreadingInfo info;
+    info.threadCount      = threadCount();
+    info.threadType       = threadType();
+    info.activeThreadType = activeThreadType();
+    info.reservedThreads  = m_reservedThreads;
+    return info;
+}
+
+void CodecContext2::setThreadBudget(int threads) noexcept
+{
+    auto &budget = thread_budget();
+    std::lock_guard<std::mutex> lock(budget.mutex);
+    budget.limit = std::max(threads, 0);
+}
+
+int CodecContext2::threadBudget() noexcept
+{
+    auto &budget = thread_budget();
+    std::lock_guard<std::mutex> lock(budget.mutex);
+    return budget.limit;
+}
+
+int CodecContext2::threadBudgetUsed() noexcept
+{
+    auto &budget = thread_budget();
+    std::lock_guard<std::mutex> lock(budget.mutex);
+    return budget.used;
+}
+
 int64_t CodecContext2::bitRate() const noexcept
 {
     return RAW_GET2(isValid(), bit_rate, int64_t(0));
@@ -682,6 +959,310 @@ bool CodecContext2::isFlags2(int flags) noexcept
     return false;
 }
 
+bool CodecContext2::sendPacket(const Packet &packet, OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    if (!isValid()) {
+        throws_if(ec, Errors::CodecInvalid);
+        return false;
+    }
+
+    if (!isOpened()) {
+        throws_if(ec, Errors::CodecNotOpened);
+        return false;
+    }
+
+    if (!codec().canDecode()) {
+        throws_if(ec, Errors::CodecInvalidForDecoce);
+        return false;
+    }
+
+#if NEW_CODEC_API
+    int sts = avcodec_send_packet(m_raw, packet.isNull() ? nullptr : packet.raw());
+
+    // Input full: caller must receive frames first
+    if (sts == AVERROR(EAGAIN))
+        return false;
+
+    // Flush packet sent twice: decoder already in draining mode
+    if (sts == AVERROR_EOF && packet.isNull())
+        return true;
+
+    if (sts < 0) {
+        throws_if(ec, sts, ffmpeg_category());
+        return false;
+    }
+
+    if (!packet.isNull()) {
+        m_decodeTimeBase    = packet.timeBase();
+        m_decodeStreamIndex = packet.streamIndex();
+    } else if (m_decodeStreamIndex < 0) {
+        m_decodeStreamIndex = m_stream.index();
+    }
+
+    return true;
+#else
+    static_cast<void>(packet);
+    throws_if(ec, AVERROR(ENOSYS), ffmpeg_category());
+    return false;
+#endif
+}
+
+void CodecContext2::flushBuffers(OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    if (!isValid()) {
+        throws_if(ec, Errors::CodecInvalid);
+        return;
+    }
+
+    if (!isOpened()) {
+        throws_if(ec, Errors::CodecNotOpened);
+        return;
+    }
+
+    avcodec_flush_buffers(m_raw);
+
+    if (m_audioFifo) {
+        av_audio_fifo_reset(m_audioFifo);
+        m_audioFifoPts = av::NoPts;
+    }
+}
+
+bool CodecContext2::sendFrameCommon(const AVFrame *frame, const Rational &timeBase, int streamIndex, OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    if (!isValid()) {
+        throws_if(ec, Errors::CodecInvalid);
+        return false;
+    }
+
+    if (!isOpened()) {
+        throws_if(ec, Errors::CodecNotOpened);
+        return false;
+    }
+
+    if (!codec().canEncode()) {
+        throws_if(ec, Errors::CodecInvalidForEncode);
+        return false;
+    }
+
+#if NEW_CODEC_API
+    int sts = avcodec_send_frame(m_raw, frame);
+
+    // Input full: caller must receive packets first
+    if (sts == AVERROR(EAGAIN))
+        return false;
+
+    // Flush frame sent twice: encoder already in draining mode
+    if (sts == AVERROR_EOF && !frame)
+        return true;
+
+    if (sts < 0) {
+        throws_if(ec, sts, ffmpeg_category());
+        return false;
+    }
+
+    if (frame) {
+        m_encodeTimeBase    = timeBase;
+        m_encodeStreamIndex = streamIndex;
+    }
+
+    return true;
+#else
+    static_cast<void>(frame);
+    static_cast<void>(timeBase);
+    static_cast<void>(streamIndex);
+    throws_if(ec, AVERROR(ENOSYS), ffmpeg_category());
+    return false;
+#endif
+}
+
+bool CodecContext2::receivePacket(Packet &packet, OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    packet = Packet();
+
+    if (!isValid()) {
+        throws_if(ec, Errors::CodecInvalid);
+        return false;
+    }
+
+    if (!isOpened()) {
+        throws_if(ec, Errors::CodecNotOpened);
+        return false;
+    }
+
+#if NEW_CODEC_API
+    int sts = avcodec_receive_packet(m_raw, packet.raw());
+
+    // Need more input or encoder fully flushed: not an error
+    if (sts == AVERROR(EAGAIN) || sts == AVERROR_EOF)
+        return false;
+
+    if (sts < 0) {
+        throws_if(ec, sts, ffmpeg_category());
+        return false;
+    }
+
+    setupEncodedPacket(packet, m_encodeTimeBase, m_encodeStreamIndex);
+    return true;
+#else
+    throws_if(ec, AVERROR(ENOSYS), ffmpeg_category());
+    return false;
+#endif
+}
+
+void CodecContext2::setupEncodedPacket(Packet &packet, const Rational &frameTimeBase, int frameStreamIndex)
+{
+    if (frameTimeBase != Rational()) {
+        packet.setTimeBase(frameTimeBase);
+        packet.setStreamIndex(frameStreamIndex);
+    } else if (m_stream.isValid()) {
+#if USE_CODECPAR
+        packet.setTimeBase(av_stream_get_codec_timebase(m_stream.raw()));
+#else
+        FF_DISABLE_DEPRECATION_WARNINGS
+        if (m_stream.raw()->codec) {
+            packet.setTimeBase(m_stream.raw()->codec->time_base);
+        }
+        FF_ENABLE_DEPRECATION_WARNINGS
+#endif
+        packet.setStreamIndex(m_stream.index());
+    }
+
+    // Recalc PTS/DTS/Duration
+    if (m_stream.isValid()) {
+        packet.setTimeBase(m_stream.timeBase());
+    }
+
+    packet.setComplete(true);
+}
+
+void CodecContext2::setFramePool(const std::shared_ptr<FramePool> &pool, OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    if (!m_raw)
+    {
+        throws_if(ec, Errors::CodecInvalid);
+        return;
+    }
+
+    if (isOpened())
+    {
+        throws_if(ec, Errors::CodecAlreadyOpened);
+        return;
+    }
+
+    if (pool)
+    {
+        m_raw->opaque      = pool.get();
+        m_raw->get_buffer2 = &FramePool::getBuffer2;
+    }
+    else
+    {
+        m_raw->opaque      = nullptr;
+        m_raw->get_buffer2 = avcodec_default_get_buffer2;
+    }
+
+    m_framePool = pool;
+}
+
+const std::shared_ptr<FramePool> &CodecContext2::framePool() const noexcept
+{
+    return m_framePool;
+}
+
+void CodecContext2::setLowres(int factor, OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    if (!isValid()) {
+        throws_if(ec, Errors::CodecInvalid);
+        return;
+    }
+
+    if (isOpened()) {
+        throws_if(ec, Errors::CodecAlreadyOpened);
+        return;
+    }
+
+    if (factor < 0 || factor > 3) {
+        throws_if(ec, AVERROR(EINVAL), ffmpeg_category());
+        return;
+    }
+
+    m_lowres      = factor;
+    m_raw->lowres = std::min(factor, codec().maxLowres());
+    m_lowresRescaler.reset();
+    m_lowresFrame = VideoFrame();
+}
+
+int CodecContext2::lowres() const noexcept
+{
+    return m_lowres;
+}
+
+int CodecContext2::lowresSizeShift() const noexcept
+{
+    if (!isValid())
+        return 0;
+    // Decoder applies native part of the factor to the context size on open
+    return isOpened() ? std::max(m_lowres - m_raw->lowres, 0) : m_lowres;
+}
+
+void CodecContext2::applyLowresFallback(VideoFrame &frame, OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    const int shift = isValid() ? std::max(m_lowres - m_raw->lowres, 0) : 0;
+    if (shift == 0 || !frame.isValid())
+        return;
+
+    const int width  = AV_CEIL_RSHIFT(frame.width(), shift);
+    const int height = AV_CEIL_RSHIFT(frame.height(), shift);
+
+    if (!m_lowresRescaler)
+        m_lowresRescaler = std::make_shared<VideoRescaler>(width, height, frame.pixelFormat(), SwsFlagFastBilinear);
+
+    // Scaled buffer is reused while nobody else references it: caller that reuses the frame
+    // releases it before the next decode
+    AVFrame *scaled = m_lowresFrame.raw();
+    if (!m_lowresFrame.isValid() ||
+        scaled->width != width || scaled->height != height || scaled->format != frame.raw()->format ||
+        !av_frame_is_writable(scaled))
+    {
+        m_lowresFrame = VideoFrame{frame.pixelFormat(), width, height, 32};
+        if (!m_lowresFrame.isValid()) {
+            throws_if(ec, Errors::FrameInvalid);
+            return;
+        }
+        scaled = m_lowresFrame.raw();
+    }
+
+    m_lowresRescaler->rescale(m_lowresFrame, frame, ec);
+    if (is_error(ec))
+        return;
+
+    // Properties are appended to the existing ones: drop side data and metadata of the previous
+    // frame, otherwise they accumulate on the reused frame
+    while (scaled->nb_side_data > 0)
+        av_frame_remove_side_data(scaled, scaled->side_data[0]->type);
+    av_dict_free(&scaled->metadata);
+    av_frame_copy_props(scaled, frame.raw());
+
+    // Caller frame object stays the same: decoded data are replaced with the scaled ones
+    av_frame_unref(frame.raw());
+    const int sts = av_frame_ref(frame.raw(), scaled);
+    if (sts < 0)
+        throws_if(ec, sts, ffmpeg_category());
+}
+
 bool CodecContext2::isValidForEncode(Direction direction, AVMediaType /*type*/) const noexcept
 {
     if (!isValid())
@@ -751,9 +1332,39 @@ void CodecContext2::open(const Codec &codec, AVDictionary **options, OptionalErr
         return;
     }
 
+    // "threads" option has priority over the context value
+    int requested = m_raw->thread_count;
+    if (options && *options) {
+        if (auto entry = av_dict_get(*options, "threads", nullptr, 0)) {
+            requested = strcmp(entry->value, "auto") == 0 ? AutoThreadCount : atoi(entry->value);
+            av_dict_set(options, "threads", nullptr, 0);
+        }
+    }
+
+    m_reservedThreads   = acquire_threads(requested);
+    m_raw->thread_count = m_reservedThreads;
+
     int stat = avcodec_open2(m_raw, codec.raw(), options);
-    if (stat < 0)
+    if (stat < 0) {
+        releaseThreads();
+        m_raw->thread_count = requested;
         throws_if(ec, stat, ffmpeg_category());
+        return;
+    }
+
+    // Codec without threading support works in the caller thread: return unused threads
+    const bool threaded = m_raw->active_thread_type || codec_has_own_threads(m_raw->codec);
+    const int  used     = threaded ? std::max(m_raw->thread_count, 1) : 1;
+    if (used < m_reservedThreads) {
+        release_threads(m_reservedThreads - used);
+        m_reservedThreads = used;
+    }
+}
+
+void CodecContext2::releaseThreads() noexcept
+{
+    release_threads(m_reservedThreads);
+    m_reservedThreads = 0;
 }
 
 std::pair<int, const error_category *> CodecContext2::decodeCommon(AVFrame *outFrame, const Packet &inPacket, size_t offset, int &frameFinished, int (*decodeProc)(AVCodecContext *, AVFrame *, int *, const AVPacket *)) noexcept
@@ -804,6 +1415,33 @@ std::pair<int, const error_category *> CodecContext2::encodeCommon(Packet &outPa
     return make_error_pair(stat);
 }
 
+std::pair<int, const error_category *> CodecContext2::receiveFrameCommon(AVFrame *outFrame, int &gotFrame) noexcept
+{
+    gotFrame = 0;
+
+    if (!isValid())
+        return make_error_pair(Errors::CodecInvalid);
+
+    if (!isOpened())
+        return make_error_pair(Errors::CodecNotOpened);
+
+#if NEW_CODEC_API
+    int sts = avcodec_receive_frame(m_raw, outFrame);
+
+    // Need more input or decoder fully flushed: not an error
+    if (sts == AVERROR(EAGAIN) || sts == AVERROR_EOF)
+        return make_error_pair(0);
+
+    if (sts >= 0)
+        gotFrame = 1;
+
+    return make_error_pair(sts);
+#else
+    static_cast<void>(outFrame);
+    return make_error_pair(AVERROR(ENOSYS));
+#endif
+}
+
 AudioDecoderContext::AudioDecoderContext(AudioDecoderContext &&other)
     : Parent(std::move(other))
 {
@@ -845,6 +1483,42 @@ AudioSamples AudioDecoderContext::decode(const Packet &inPacket, size_t offset,
     return outSamples;
 }
 
+bool AudioDecoderContext::decode(const Packet &inPacket, AudioSamples &samples, OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    reset_reused_frame(samples);
+
+    int gotFrame = 0;
+    auto st = decodeCommon(samples, inPacket, 0, gotFrame, avcodec_decode_audio_legacy);
+    if (get<1>(st))
+    {
+        throws_if(ec, get<0>(st), *get<1>(st));
+        return false;
+    }
+
+    if (!gotFrame)
+        return false;
+
+    // Fix channels layout
+    if (samples.channelsCount() && !samples.channelsLayout())
+        av::frame::set_channel_layout(samples.raw(), av_get_default_channel_layout(samples.channelsCount()));
+
+    return true;
+}
+
+bool AudioDecoderContext::receiveFrame(AudioSamples &samples, OptionalErrorCode ec)
+{
+    if (!receiveFrameCommon(samples, ec))
+        return false;
+
+    // Fix channels layout
+    if (samples.channelsCount() && !samples.channelsLayout())
+        av::frame::set_channel_layout(samples.raw(), av_get_default_channel_layout(samples.channelsCount()));
+
+    return true;
+}
+
 AudioEncoderContext::AudioEncoderContext(AudioEncoderContext &&other)
     : Parent(move(other))
 {
@@ -898,37 +1572,37 @@ CodecContext2::decodeCommon(T &outFrame,
     if (!frameFinished)
         return std::make_pair(0u, nullptr);
 
-    // Dial with PTS/DTS in packet/stream timebase
-
-    if (inPacket.timeBase() != Rational())
-        outFrame.setTimeBase(inPacket.timeBase());
-    else
-        outFrame.setTimeBase(m_stream.timeBase());
+    fix_decoded_frame_ts(outFrame,
+                         inPacket.timeBase() != Rational() ? inPacket.timeBase() : m_stream.timeBase(),
+                         timeBase(),
+                         inPacket ? inPacket.streamIndex() : m_stream.index());
 
-    AVFrame *frame = outFrame.raw();
-
-    if (frame->pts == av::NoPts)
-        frame->pts = av::frame::get_best_effort_timestamp(frame);
+    return st;
+}
 
-#if LIBAVCODEC_VERSION_MAJOR < 57
-    if (frame->pts == av::NoPts)
-        frame->pts = frame->pkt_pts;
-#endif
+template<typename T>
+bool CodecContext2::receiveFrameCommon(T &outFrame, OptionalErrorCode ec)
+{
+    clear_if(ec);
 
-    if (frame->pts == av::NoPts)
-        frame->pts = frame->pkt_dts;
+    reset_reused_frame(outFrame);
 
-    // Convert to decoder/frame time base. Seems not nessesary.
-    outFrame.setTimeBase(timeBase());
+    int gotFrame = 0;
+    auto st = receiveFrameCommon(outFrame.raw(), gotFrame);
+    if (std::get<1>(st)) {
+        throws_if(ec, std::get<0>(st), *std::get<1>(st));
+        return false;
+    }
 
-    if (inPacket)
-        outFrame.setStreamIndex(inPacket.streamIndex());
-    else
-        outFrame.setStreamIndex(m_stream.index());
+    if (!gotFrame)
+        return false;
 
-    outFrame.setComplete(true);
+    fix_decoded_frame_ts(outFrame,
+                         m_decodeTimeBase != Rational() ? m_decodeTimeBase : m_stream.timeBase(),
+                         timeBase(),
+                         m_decodeStreamIndex);
 
-    return st;
+    return true;
 }
 
 template<typename T>
@@ -944,34 +1618,148 @@ CodecContext2::encodeCommon(Packet &outPacket,
     if (!gotPacket)
         return std::make_pair(0u, nullptr);
 
-    if (inFrame && inFrame.timeBase() != Rational()) {
-        outPacket.setTimeBase(inFrame.timeBase());
-        outPacket.setStreamIndex(inFrame.streamIndex());
-    } else if (m_stream.isValid()) {
-#if USE_CODECPAR
-        outPacket.setTimeBase(av_stream_get_codec_timebase(m_stream.raw()));
-#else
-        FF_DISABLE_DEPRECATION_WARNINGS
-        if (m_stream.raw()->codec) {
-            outPacket.setTimeBase(m_stream.raw()->codec->time_base);
+    setupEncodedPacket(outPacket,
+                       inFrame ? inFrame.timeBase() : Rational(),
+                       inFrame.streamIndex());
+
+    return st;
+}
+
+
+#undef warnIfNotAudio
+#undef warnIfNotVideo
+
+bool CodecContext2::isAudioChunkingNeeded(const AudioSamples &samples) const noexcept
+{
+    if (!isValid() || !isOpened() || m_raw->codec_type != AVMEDIA_TYPE_AUDIO)
+        return false;
+
+    if (m_raw->frame_size <= 0 || (m_raw->codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE))
+        return false;
+
+    if (audioFifoSamples() > 0)
+        return true;
+
+    return samples.raw() && samples.samplesCount() != m_raw->frame_size;
+}
+
+bool CodecContext2::pushAudioSamples(const AudioSamples &samples, OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    const int channels = samples.channelsCount();
+    const auto format  = static_cast<AVSampleFormat>(samples.raw()->format);
+
+    if (!m_audioFifo) {
+        m_audioFifo = av_audio_fifo_alloc(format, channels, m_raw->frame_size * 2);
+        if (!m_audioFifo) {
+            throws_if(ec, AVERROR(ENOMEM), ffmpeg_category());
+            return false;
+        }
+
+        auto layout = samples.channelsLayout();
+        if (!layout)
+            layout = static_cast<uint64_t>(av_get_default_channel_layout(channels));
+
+        m_audioChunk = AudioSamples(samples.sampleFormat(), m_raw->frame_size, layout, samples.sampleRate());
+        if (!m_audioChunk.isValid()) {
+            freeAudioFifo();
+            throws_if(ec, AVERROR(ENOMEM), ffmpeg_category());
+            return false;
         }
-        FF_ENABLE_DEPRECATION_WARNINGS
-#endif
-        outPacket.setStreamIndex(m_stream.index());
     }
 
-    // Recalc PTS/DTS/Duration
-    if (m_stream.isValid()) {
-        outPacket.setTimeBase(m_stream.timeBase());
+    if (m_audioChunk.channelsCount() != channels || m_audioChunk.raw()->format != format) {
+        throws_if(ec, AVERROR(EINVAL), ffmpeg_category());
+        return false;
     }
 
-    outPacket.setComplete(true);
+    // Timestamps are continuous while FIFO is not empty, resynchronized otherwise
+    if (av_audio_fifo_size(m_audioFifo) == 0) {
+        const auto pts = samples.pts();
+        m_audioFifoPts = pts.isValid()
+                ? pts.timestamp(Rational(1, samples.sampleRate()))
+                : m_audioFifoPts;
+        m_audioChunk.setTimeBase(Rational());
+        m_audioChunk.setTimeBase(samples.timeBase());
+        m_audioChunk.setStreamIndex(samples.streamIndex());
+    }
 
-    return st;
+    const int sts = av_audio_fifo_write(m_audioFifo,
+                                        reinterpret_cast<void**>(samples.raw()->extended_data),
+                                        samples.samplesCount());
+    if (sts < 0) {
+        throws_if(ec, sts, ffmpeg_category());
+        return false;
+    }
+
+    return true;
 }
 
+const AudioSamples* CodecContext2::popAudioChunk(bool flush, OptionalErrorCode ec)
+{
+    clear_if(ec);
 
-#undef warnIfNotAudio
-#undef warnIfNotVideo
+    const int frameSize = m_raw->frame_size;
+    const int available = audioFifoSamples();
+    if (available == 0 || (available < frameSize && !flush))
+        return nullptr;
+
+    const int samples = std::min(available, frameSize);
+    const bool pad    = samples < frameSize && !(m_raw->codec->capabilities & AV_CODEC_CAP_SMALL_LAST_FRAME);
+
+    // Encoder still references previous chunk: it gets new buffer, old one is released by encoder
+    if (!av_frame_is_writable(m_audioChunk.raw())) {
+        AudioSamples chunk(m_audioChunk.sampleFormat(), frameSize, m_audioChunk.channelsLayout(), m_audioChunk.sampleRate());
+        if (!chunk.isValid()) {
+            throws_if(ec, AVERROR(ENOMEM), ffmpeg_category());
+            return nullptr;
+        }
+        chunk.setTimeBase(m_audioChunk.timeBase());
+        chunk.setStreamIndex(m_audioChunk.streamIndex());
+        m_audioChunk = std::move(chunk);
+    }
+
+    auto frame = m_audioChunk.raw();
+    frame->nb_samples = frameSize;
+
+    const int sts = av_audio_fifo_read(m_audioFifo, reinterpret_cast<void**>(frame->extended_data), samples);
+    if (sts < 0) {
+        throws_if(ec, sts, ffmpeg_category());
+        return nullptr;
+    }
+
+    if (pad)
+        av_samples_set_silence(frame->extended_data, samples, frameSize - samples, av::frame::get_channels(frame),
+                               static_cast<AVSampleFormat>(frame->format));
+    else
+        frame->nb_samples = samples;
+
+    const Rational sampleTimeBase(1, m_audioChunk.sampleRate());
+    if (m_audioFifoPts != av::NoPts) {
+        m_audioChunk.setPts(Timestamp(m_audioFifoPts, sampleTimeBase));
+        m_audioFifoPts += samples;
+    } else {
+        frame->pts = av::NoPts;
+    }
+
+    m_audioChunk.setComplete(true);
+    return &m_audioChunk;
+}
+
+int CodecContext2::audioFifoSamples() const noexcept
+{
+    return m_audioFifo ? av_audio_fifo_size(m_audioFifo) : 0;
+}
+
+void CodecContext2::freeAudioFifo() noexcept
+{
+    if (m_audioFifo) {
+        av_audio_fifo_free(m_audioFifo);
+        m_audioFifo = nullptr;
+    }
+    m_audioChunk   = AudioSamples();
+    m_audioFifoPts = av::NoPts;
+}
 
 } // namespace av
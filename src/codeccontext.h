@@ -8,15 +8,48 @@
 #include "sampleformat.h"
 #include "avlog.h"
 #include "frame.h"
+#include "packet.h"
 #include "codec.h"
+#include "framepool.h"
+#include "videorescaler.h"
 
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavformat/version.h>
+#include <libavutil/audio_fifo.h>
 }
 
 namespace av {
 
+/**
+ * Allowed codec threading methods, mask of the FF_THREAD_* values
+ */
+enum class ThreadType
+{
+    None  = 0,
+    Frame = FF_THREAD_FRAME,
+    Slice = FF_THREAD_SLICE,
+    Any   = FF_THREAD_FRAME | FF_THREAD_SLICE,
+};
+
+/**
+ * Video decoding modes, trade completeness for speed
+ */
+enum class DecodeMode
+{
+    /// Decode every frame
+    All,
+    /// Skip non-reference frames (skip_frame = AVDISCARD_NONREF), loop filter and IDCT are skipped
+    /// for them too. Stream can be decoded without artifacts, but with lower frame rate.
+    NonRef,
+    /// Decode only keyframes (skip_frame = AVDISCARD_NONKEY). Use with
+    /// FormatContext::setKeyPacketsOnly() to avoid reading of other packets at all.
+    KeyOnly,
+    /// Like KeyOnly, but loop filter skipped for all frames: faster, but less quality. Useful for
+    /// the thumbnails.
+    KeyOnlyFast,
+};
+
 class CodecContext2 : public FFWrapperPtr<AVCodecContext>, public noncopyable
 {
 protected:
@@ -97,6 +130,38 @@ public:
     int strict() const noexcept;
     void setStrict(int strict) noexcept;
 
+    // Threading
+    /// Threads count for codec, AutoThreadCount - resolve from std::thread::hardware_concurrency()
+    /// on open. On open requested count is limited by the process-wide thread budget, see
+    /// setThreadBudget(). "threads" option passed to the open() overrides this value.
+    /// @{
+    static constexpr int AutoThreadCount = 0;
+
+    struct ThreadingInfo
+    {
+        int        threadCount      = 1;                ///< requested count, granted after open
+        ThreadType threadType       = ThreadType::Any;  ///< allowed threading methods
+        ThreadType activeThreadType = ThreadType::None; ///< method used by the opened codec
+        int        reservedThreads  = 0;                ///< threads taken from the budget
+    };
+
+    void setThreadCount(int count) noexcept;
+    int threadCount() const noexcept;
+    void setThreadType(ThreadType type) noexcept;
+    ThreadType threadType() const noexcept;
+    ThreadType activeThreadType() const noexcept;
+    ThreadingInfo threadingInfo() const noexcept;
+    /// @}
+
+    /// Process-wide limit of the codec threads shared by all opened contexts, 0 - unlimited.
+    /// Each context gets at least one thread, so budget can be exceeded by the single-threaded
+    /// contexts only. Changed limit is applied for the contexts opened after the call.
+    /// @{
+    static void setThreadBudget(int threads) noexcept;
+    static int threadBudget() noexcept;
+    static int threadBudgetUsed() noexcept;
+    /// @}
+
     int64_t bitRate() const noexcept;
     std::pair<int64_t, int64_t> bitRateRange() const noexcept;
     void setBitRate(int64_t bitRate) noexcept;
@@ -122,6 +187,40 @@ public:
     bool isFlags2(int flags) noexcept;
     /// @}
 
+    //
+    // Decoding: send/receive API
+    //
+
+    /**
+     * @brief sendPacket - push packet into the decoder
+     *
+     * Single packet can produce any amount of frames (zero, one or more), so frames must be
+     * obtained with the receiveFrame() calls of the concrete decoder context until it returns
+     * false.
+     *
+     * Null (empty) packet puts decoder into the draining mode: all buffered frames can be taken
+     * with receiveFrame() after that.
+     *
+     * @param packet  packet to decode, null packet to flush decoder
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     * @return true if packet accepted by decoder, false if decoder input is full and frames must be
+     *         received before sending new data. On error false.
+     */
+    bool sendPacket(const class Packet &packet, OptionalErrorCode ec = throws());
+
+    /**
+     * @brief flushBuffers - reset internal codec state, buffered data is dropped
+     *
+     * Must be called after seeking instead of reopening decoder: codec setup (extradata, threads,
+     * hardware context) is kept. Also leaves draining mode, so decoding can be restarted after
+     * the null packet. Encoders support it only with AV_CODEC_CAP_ENCODER_FLUSH capability.
+     *
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     */
+    void flushBuffers(OptionalErrorCode ec = throws());
+
 
 protected:
 
@@ -140,6 +239,73 @@ protected:
     encodeCommon(class Packet &outPacket, const AVFrame *inFrame, int &gotPacket,
                          int (*encodeProc)(AVCodecContext*, AVPacket*,const AVFrame*, int*)) noexcept;
 
+    std::pair<int, const std::error_category*>
+    receiveFrameCommon(AVFrame *outFrame, int &gotFrame) noexcept;
+
+    template<typename T>
+    bool receiveFrameCommon(T &outFrame, OptionalErrorCode ec);
+
+    bool sendFrameCommon(const AVFrame *frame, const Rational &timeBase, int streamIndex, OptionalErrorCode ec);
+
+    // Audio encoder frame size FIFO
+    /// @{
+    bool isAudioChunkingNeeded(const AudioSamples &samples) const noexcept;
+    bool pushAudioSamples(const AudioSamples &samples, OptionalErrorCode ec);
+    const AudioSamples* popAudioChunk(bool flush, OptionalErrorCode ec);
+    int audioFifoSamples() const noexcept;
+    /// @}
+
+    template<typename T>
+    bool sendFrameCommon(const T &frame, OptionalErrorCode ec)
+    {
+        return sendFrameCommon(frame.raw(), frame.timeBase(), frame.streamIndex(), ec);
+    }
+
+    /**
+     * @brief receivePacket - take next encoded packet after sendFrame() call
+     *
+     * @param packet   output packet, previous content is dropped
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     * @return true if packet received, false if encoder needs more input, fully flushed or on error
+     */
+    bool receivePacket(class Packet &packet, OptionalErrorCode ec = throws());
+
+    /**
+     * @brief setFramePool - use pooled allocator for the decoded frames
+     *
+     * Must be called before codec opening: with frame threading get_buffer2 is copied to the worker
+     * contexts on open.
+     *
+     * @param pool   frame pool, null to restore default FFmpeg allocator
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     */
+    void setFramePool(const std::shared_ptr<FramePool> &pool, OptionalErrorCode ec = throws());
+
+    const std::shared_ptr<FramePool>& framePool() const noexcept;
+
+    /**
+     * @brief setLowres - decode with reduced resolution: 1/2, 1/4 or 1/8 for factor 1, 2 or 3
+     *
+     * Decoder is asked to produce low resolution frames directly (AVCodecContext::lowres). Part of
+     * the factor that is not supported by the decoder (Codec::maxLowres()) is done by the fast
+     * downscale of every decoded frame. Must be called before codec opening.
+     *
+     * @param factor   resolution reduction factor, 0..3. 0 - full resolution
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     */
+    void setLowres(int factor, OptionalErrorCode ec = throws());
+
+    int lowres() const noexcept;
+
+    /// Size reduction that is not applied to the AVCodecContext::width/height yet
+    int lowresSizeShift() const noexcept;
+
+    /// Downscale decoded frame by the part of lowres factor that is not supported by decoder
+    void applyLowresFallback(VideoFrame &frame, OptionalErrorCode ec);
+
 public:
     template<typename T>
     std::pair<int, const std::error_category*>
@@ -157,7 +323,36 @@ public:
                  int (*encodeProc)(AVCodecContext *, AVPacket *, const AVFrame *, int *));
 
 private:
-    Stream m_stream;
+    Stream   m_stream;
+
+    // Properties of the last packet that was sent to decoder, used to fix timestamps of the
+    // received frames
+    Rational m_decodeTimeBase;
+    int      m_decodeStreamIndex = -1;
+
+    // Properties of the last frame that was sent to encoder
+    Rational m_encodeTimeBase;
+    int      m_encodeStreamIndex = -1;
+
+    void setupEncodedPacket(class Packet &packet, const Rational &frameTimeBase, int frameStreamIndex);
+
+    std::shared_ptr<FramePool> m_framePool;
+
+    // Requested lowres factor, rescaler and its output for the decoders that do not support it
+    int      m_lowres = 0;
+    std::shared_ptr<VideoRescaler> m_lowresRescaler;
+    VideoFrame                     m_lowresFrame;
+
+    // Threads taken from the process-wide budget on open
+    int      m_reservedThreads = 0;
+    void releaseThreads() noexcept;
+
+    // Audio encoder input re-chunking: FIFO, reusable output frame and PTS of the first buffered
+    // sample in 1/sample_rate units
+    AVAudioFifo *m_audioFifo    = nullptr;
+    AudioSamples m_audioChunk;
+    int64_t      m_audioFifoPts = av::NoPts;
+    void freeAudioFifo() noexcept;
 };
 
 
@@ -248,6 +443,65 @@ public:
     {
         return codecType(_type);
     }
+
+protected:
+    /**
+     * Send packet to the decoder and pass every produced frame to the callback. Decoder input
+     * is drained automatically when it is full, so packet never lost.
+     */
+    template<typename T, typename Callback>
+    size_t decodeAllCommon(const Packet &packet, T &frame, Callback &callback, OptionalErrorCode ec)
+    {
+        clear_if(ec);
+
+        auto  &self  = static_cast<Clazz&>(*this);
+        size_t count = 0;
+
+        while (true)
+        {
+            const bool accepted = self.sendPacket(packet, ec);
+            if (is_error(ec))
+                return count;
+
+            while (self.receiveFrame(frame, ec))
+            {
+                ++count;
+                callback(frame);
+            }
+
+            if (is_error(ec) || accepted)
+                return count;
+        }
+    }
+
+    /**
+     * Send frame to the encoder and pass every produced packet to the callback. Encoder input
+     * is drained automatically when it is full, so frame never lost.
+     */
+    template<typename T, typename Callback>
+    size_t encodeAllCommon(const T &frame, Callback &callback, OptionalErrorCode ec)
+    {
+        clear_if(ec);
+
+        size_t count = 0;
+        Packet packet;
+
+        while (true)
+        {
+            const bool accepted = this->sendFrameCommon(frame, ec);
+            if (is_error(ec))
+                return count;
+
+            while (this->receivePacket(packet, ec))
+            {
+                ++count;
+                callback(packet);
+            }
+
+            if (is_error(ec) || accepted)
+                return count;
+        }
+    }
 };
 
 
@@ -382,20 +636,34 @@ class VideoDecoderContext : public VideoCodecContext<VideoDecoderContext, Direct
 public:
     using Parent = VideoCodecContext<VideoDecoderContext, Direction::Decoding>;
     using Parent::Parent;
+    using Parent::setFramePool;
+    using Parent::framePool;
+    using Parent::setLowres;
+    using Parent::lowres;
 
     VideoDecoderContext() = default;
     VideoDecoderContext(VideoDecoderContext&& other);
 
     VideoDecoderContext& operator=(VideoDecoderContext&& other);
 
+    /// Frame size with lowres reduction applied, see setLowres()
+    /// @{
+    int width() const;
+    int height() const;
+    /// @}
+
     /**
      * @brief decodeVideo  - decode video packet
      *
+     * @note Returns at most one frame per packet: other frames produced by decoder stay buffered.
+     *       Use decodeAll() or sendPacket()/receiveFrame() to drain decoder fully.
+     *
      * @param packet   packet to decode
      * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
      *                       av#throws the function will throw on error instead
      * @param autoAllocateFrame  it true - output will be allocated at the ffmpeg internal, otherwise
-     *                           it will be allocated before decode proc call.
+     *                           it will be allocated before decode proc call. Ignored with the
+     *                           send/receive FFmpeg API: decoder always allocates output itself.
      * @return encoded video frame, if error: exception thrown or error code returns, in both cases
      *         output undefined.
      */
@@ -412,7 +680,8 @@ public:
      * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
      *                       av#throws the function will throw on error instead
      * @param autoAllocateFrame  it true - output will be allocated at the ffmpeg internal, otherwise
-     *                           it will be allocated before decode proc call.
+     *                           it will be allocated before decode proc call. Ignored with the
+     *                           send/receive FFmpeg API: decoder always allocates output itself.
      * @return encoded video frame, if error: exception thrown or error code returns, in both cases
      *         output undefined.
      */
@@ -422,6 +691,78 @@ public:
                       OptionalErrorCode ec = throws(),
                       bool    autoAllocateFrame = true);
 
+    /**
+     * @brief decode - decode video packet into the caller-owned frame
+     *
+     * Frame object reused: old data unreferenced and AVFrame itself kept, so steady-state decoding
+     * loop does not allocate frames at all.
+     *
+     * @param[in] packet     packet to decode
+     * @param[out] frame     decoded frame, invalid (not complete) if decoder produces nothing
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     * @return true if frame decoded, false otherwise. On error false.
+     */
+    bool decode(const Packet &packet, VideoFrame &frame, OptionalErrorCode ec = throws());
+
+    /**
+     * @brief setDecodeMode - set skip_frame, skip_loop_filter and skip_idct according to mode
+     *
+     * Can be changed at any time, takes effect from the next decoded frame.
+     */
+    void setDecodeMode(DecodeMode mode) noexcept;
+
+    /**
+     * @return decode mode that matches current skip_* values, DecodeMode::All if they were set to
+     *         other combination via raw access
+     */
+    DecodeMode decodeMode() const noexcept;
+
+    /**
+     * @brief receiveFrame - take next decoded frame after sendPacket() call
+     *
+     * Frame object can be reused between calls: decoder unreferences old data before filling it.
+     *
+     * @param[out] frame     decoded frame
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     * @return true if frame received, false if decoder needs more input or fully flushed. On error
+     *         false.
+     */
+    bool receiveFrame(VideoFrame &frame, OptionalErrorCode ec = throws());
+
+    /**
+     * @brief decodeAll - decode packet and pass every produced frame to the callback
+     *
+     * Unlike decode(), that returns at most one frame per packet, drains decoder fully. Pass null
+     * packet to flush decoder at the end of stream.
+     *
+     * Callback signature: void(VideoFrame &frame). Frame object reused between callback calls, so
+     * make a copy (reference) or move it out when it must outlive callback.
+     *
+     * @param packet    packet to decode
+     * @param callback  frame handler
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     * @return count of decoded frames
+     */
+    template<typename Callback>
+    size_t decodeAll(const Packet &packet, Callback &&callback, OptionalErrorCode ec = throws())
+    {
+        VideoFrame frame;
+        return decodeAllCommon(packet, frame, callback, ec);
+    }
+
+    /**
+     * Like decodeAll() above but receives frames into the given frame object. Useful to avoid
+     * frame allocation per packet.
+     */
+    template<typename Callback>
+    size_t decodeAll(const Packet &packet, VideoFrame &frame, Callback &&callback, OptionalErrorCode ec = throws())
+    {
+        return decodeAllCommon(packet, frame, callback, ec);
+    }
+
 
 private:
     VideoFrame decodeVideo(OptionalErrorCode ec,
@@ -430,6 +771,9 @@ private:
                            size_t *decodedBytes,
                            bool    autoAllocateFrame);
 
+    // Post-processing of the decoded frame shared by all decode paths
+    bool finishDecodedFrame(VideoFrame &frame, OptionalErrorCode ec);
+
 };
 
 
@@ -438,6 +782,7 @@ class VideoEncoderContext : public VideoCodecContext<VideoEncoderContext, Direct
 public:
     using Parent = VideoCodecContext<VideoEncoderContext, Direction::Encoding>;
     using Parent::Parent;
+    using Parent::receivePacket;
 
     VideoEncoderContext() = default;
     VideoEncoderContext(VideoEncoderContext&& other);
@@ -468,6 +813,37 @@ public:
      */
     Packet encode(const VideoFrame &inFrame, OptionalErrorCode ec = throws());
 
+    /**
+     * @brief sendFrame - send frame to the encoder
+     *
+     * Unlike encode(), does not lose input when encoder is full and does not limit output to one
+     * packet per frame. Pass null frame to flush encoder at the end of stream.
+     *
+     * @param frame   frame to encode
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     * @return true if frame accepted by encoder, false if encoder input is full and packets must be
+     *         received before sending new data. On error false.
+     */
+    bool sendFrame(const VideoFrame &frame, OptionalErrorCode ec = throws())
+    {
+        return sendFrameCommon(frame, ec);
+    }
+
+    /**
+     * @brief encodeAll - encode frame and pass every produced packet to the callback
+     *
+     * Callback signature: void(Packet &packet). Packet object reused between callback calls, so
+     * move it out when it must outlive callback. Pass null frame to flush encoder.
+     *
+     * @return count of encoded packets
+     */
+    template<typename Callback>
+    size_t encodeAll(const VideoFrame &frame, Callback &&callback, OptionalErrorCode ec = throws())
+    {
+        return encodeAllCommon(frame, callback, ec);
+    }
+
 };
 
 
@@ -574,6 +950,8 @@ class AudioDecoderContext : public AudioCodecContext<AudioDecoderContext, Direct
 public:
     using Parent = AudioCodecContext<AudioDecoderContext, Direction::Decoding>;
     using Parent::Parent;
+    using Parent::setFramePool;
+    using Parent::framePool;
 
     AudioDecoderContext() = default;
     AudioDecoderContext(AudioDecoderContext&& other);
@@ -583,6 +961,35 @@ public:
     AudioSamples decode(const Packet &inPacket, OptionalErrorCode ec = throws());
     AudioSamples decode(const Packet &inPacket, size_t offset, OptionalErrorCode ec = throws());
 
+    /**
+     * @brief decode - decode audio packet into the caller-owned samples frame
+     * @see VideoDecoderContext::decode(const Packet&, VideoFrame&, OptionalErrorCode)
+     */
+    bool decode(const Packet &inPacket, AudioSamples &samples, OptionalErrorCode ec = throws());
+
+    /**
+     * @brief receiveFrame - take next decoded samples after sendPacket() call
+     * @see VideoDecoderContext::receiveFrame()
+     */
+    bool receiveFrame(AudioSamples &samples, OptionalErrorCode ec = throws());
+
+    /**
+     * @brief decodeAll - decode packet and pass every produced samples frame to the callback
+     * @see VideoDecoderContext::decodeAll()
+     */
+    template<typename Callback>
+    size_t decodeAll(const Packet &packet, Callback &&callback, OptionalErrorCode ec = throws())
+    {
+        AudioSamples samples;
+        return decodeAllCommon(packet, samples, callback, ec);
+    }
+
+    template<typename Callback>
+    size_t decodeAll(const Packet &packet, AudioSamples &samples, Callback &&callback, OptionalErrorCode ec = throws())
+    {
+        return decodeAllCommon(packet, samples, callback, ec);
+    }
+
 };
 
 
@@ -591,6 +998,7 @@ class AudioEncoderContext : public AudioCodecContext<AudioEncoderContext, Direct
 public:
     using Parent = AudioCodecContext<AudioEncoderContext, Direction::Encoding>;
     using Parent::Parent;
+    using Parent::receivePacket;
 
     AudioEncoderContext() = default;
     AudioEncoderContext(AudioEncoderContext&& other);
@@ -600,7 +1008,96 @@ public:
     Packet encode(OptionalErrorCode ec = throws());
     Packet encode(const AudioSamples &inSamples, OptionalErrorCode ec = throws());
 
+    /**
+     * @brief sendFrame - send samples to the encoder
+     * @see VideoEncoderContext::sendFrame()
+     */
+    bool sendFrame(const AudioSamples &frame, OptionalErrorCode ec = throws())
+    {
+        return sendFrameCommon(frame, ec);
+    }
+
+    /**
+     * @brief encodeAll - encode samples and pass every produced packet to the callback
+     * @see VideoEncoderContext::encodeAll()
+     */
+    template<typename Callback>
+    size_t encodeAll(const AudioSamples &frame, Callback &&callback, OptionalErrorCode ec = throws())
+    {
+        return encodeAllCommon(frame, callback, ec);
+    }
+
+    /**
+     * @brief encodeChunked - encode samples of any length
+     *
+     * Codecs with fixed frame size require exactly frameSize() samples per frame. Samples are
+     * buffered in the internal FIFO and encoded by frameSize() chunks, timestamps of the chunks
+     * are continuous: counted from the first buffered sample. Chunk frame is reused when encoder
+     * does not hold it, so steady state encoding does not allocate.
+     *
+     * Frames of the exact size are passed directly while FIFO is empty. Codecs with variable frame
+     * size always get samples directly.
+     *
+     * Null samples flush FIFO tail (padded with silence if codec does not accept small last
+     * frame) and drain encoder.
+     *
+     * All samples must have same format, channel layout and sample rate. Do not mix with
+     * sendFrame() / encodeAll() calls until FIFO is flushed.
+     *
+     * @param samples   samples to encode, null samples to flush
+     * @param callback  packet handler, void(Packet&)
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     * @return produced packets count
+     */
+    template<typename Callback>
+    size_t encodeChunked(const AudioSamples &samples, Callback &&callback, OptionalErrorCode ec = throws())
+    {
+        clear_if(ec);
+
+        if (!isAudioChunkingNeeded(samples))
+            return encodeAllCommon(samples, callback, ec);
+
+        const bool flush = !samples.raw();
+        if (!flush && !pushAudioSamples(samples, ec))
+            return 0;
+
+        size_t count = 0;
+        while (auto chunk = popAudioChunk(flush, ec)) {
+            count += encodeAllCommon(*chunk, callback, ec);
+            if (is_error(ec))
+                return count;
+        }
+
+        if (!is_error(ec) && flush)
+            count += encodeAllCommon(samples, callback, ec);
+
+        return count;
+    }
+
+    /// Samples buffered by encodeChunked() and not encoded yet
+    int bufferedSamples() const noexcept
+    {
+        return audioFifoSamples();
+    }
+
 };
 
 
+/// Frame type produced by the decoder context
+template<typename Decoder>
+struct DecoderFrameType;
+
+template<>
+struct DecoderFrameType<VideoDecoderContext>
+{
+    using type = VideoFrame;
+};
+
+template<>
+struct DecoderFrameType<AudioDecoderContext>
+{
+    using type = AudioSamples;
+};
+
 } // namespace av
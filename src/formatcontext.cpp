@@ -1,4 +1,11 @@
 #include <iostream>
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <limits>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 
 #include "avutils.h"
 #include "avtime.h"
@@ -39,6 +46,76 @@ int64_t custom_io_seek(void *opaque, int64_t offset, int whence)
 
 namespace av {
 
+struct FormatContext::ReadAhead
+{
+    // Null packet without error - end of stream
+    struct Item
+    {
+        Packet          packet;
+        std::error_code error;
+    };
+
+    size_t                  maxPackets = READ_AHEAD_DEFAULT_PACKETS;
+    size_t                  maxBytes   = READ_AHEAD_DEFAULT_BYTES;
+    bool                    enabled    = true;
+
+    std::mutex              mutex;
+    std::condition_variable cond;
+    std::deque<Item>        items;
+    size_t                  bytes   = 0;
+    bool                    running = false;
+    bool                    stop    = false;
+    std::atomic<bool>       interrupt{false};
+
+    std::thread             thread;
+
+    bool isFull() const noexcept
+    {
+        return !items.empty() && (items.size() >= maxPackets || bytes >= maxBytes);
+    }
+};
+
+struct FormatContext::Interleaver
+{
+    // DTS in AV_TIME_BASE units, equal DTS are written in the arrival order
+    struct Item
+    {
+        int64_t  dts;
+        uint64_t seq;
+        Packet   packet;
+    };
+
+    struct StreamQueue
+    {
+        std::vector<Item> heap;
+        int64_t           lastDts = AV_NOPTS_VALUE;
+    };
+
+    static bool later(const Item &left, const Item &right) noexcept
+    {
+        return left.dts != right.dts ? left.dts > right.dts : left.seq > right.seq;
+    }
+
+    int64_t                  maxDtsSkew = INTERLEAVE_DEFAULT_MAX_DTS_SKEW;
+    size_t                   maxBytes   = INTERLEAVE_DEFAULT_MAX_BYTES;
+    InterleaveFlush          flush      = InterleaveFlush::Earliest;
+    bool                     enabled    = true;
+
+    std::vector<StreamQueue> streams;
+    uint64_t                 seq    = 0;
+    int64_t                  maxDts = AV_NOPTS_VALUE; // latest buffered DTS
+    InterleaveStats          stats;
+
+    void clear()
+    {
+        for (auto &stream : streams)
+            stream.heap.clear();
+        maxDts                = AV_NOPTS_VALUE;
+        stats.bufferedPackets = 0;
+        stats.bufferedBytes   = 0;
+    }
+};
+
 FormatContext::FormatContext()
 {
     m_raw = avformat_alloc_context();
@@ -47,6 +124,7 @@ FormatContext::FormatContext()
 
 FormatContext::~FormatContext()
 {
+    stopReadAhead(true, true);
     if (isOpened())
         close();
     else if (m_raw)
@@ -57,6 +135,7 @@ FormatContext::~FormatContext()
 void FormatContext::setSocketTimeout(int64_t timeout)
 {
     m_socketTimeout = timeout;
+    resetSocketAccess();
 }
 
 void FormatContext::setInterruptCallback(const AvioInterruptCb &cb)
@@ -127,6 +206,11 @@ void FormatContext::close()
     if (!m_raw)
         return;
 
+    stopReadAhead(true, true);
+
+    if (m_interleaver)
+        m_interleaver->clear();
+
     if (isOpened())
     {
         closeCodecContexts();
@@ -266,6 +350,13 @@ void FormatContext::seek(const Timestamp &timestamp, size_t streamIndex, bool an
 void FormatContext::seek(int64_t position, int streamIndex, int flags, OptionalErrorCode ec)
 {
     clear_if(ec);
+    // Read-ahead packets are dropped anyway: do not wait for the blocked read
+    stopReadAhead(true, true);
+    // Interrupted read leaves the error in the I/O context, it is not reset by the seek
+    if (m_raw && m_raw->pb && m_raw->pb->error == AVERROR_EXIT) {
+        m_raw->pb->error       = 0;
+        m_raw->pb->eof_reached = 0;
+    }
     const auto sts = av_seek_frame(m_raw, streamIndex, position, flags);
     if (sts < 0) {
         throws_if(ec, sts, ffmpeg_category());
@@ -282,6 +373,45 @@ Timestamp FormatContext::startTime() const noexcept
     return {m_raw->start_time, AV_TIME_BASE_Q_CPP};
 }
 
+void FormatContext::selectStreams(const std::vector<size_t> &indices, OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    if (!m_raw) {
+        throws_if(ec, Errors::Unallocated);
+        return;
+    }
+
+    if (isOutput()) {
+        throws_if(ec, Errors::FormatInvalidDirection);
+        return;
+    }
+
+    for (auto index : indices) {
+        if (index >= m_raw->nb_streams) {
+            throws_if(ec, Errors::FormatInvalidStreamIndex);
+            return;
+        }
+    }
+
+    // Reader thread is restarted when queued packets are taken
+    stopReadAhead(false, false);
+
+    std::vector<bool> selected(m_raw->nb_streams, indices.empty());
+    for (auto index : indices)
+        selected[index] = true;
+
+    for (size_t i = 0; i < m_raw->nb_streams; ++i) {
+        auto st = m_raw->streams[i];
+        if (!selected[i])
+            st->discard = AVDISCARD_ALL;
+        else if (m_keyPacketsOnly && stream(i).mediaType() == AVMEDIA_TYPE_VIDEO)
+            st->discard = AVDISCARD_NONKEY;
+        else
+            st->discard = AVDISCARD_DEFAULT;
+    }
+}
+
 int FormatContext::eventFlags() const noexcept
 {
     if (isOutput())
@@ -303,6 +433,34 @@ void FormatContext::eventFlagsClear(int flags) noexcept
     m_raw->event_flags &= ~flags;
 }
 
+void FormatContext::setKeyPacketsOnly(bool enable)
+{
+    // Reader thread is restarted when queued packets are taken
+    stopReadAhead(false, false);
+
+    m_keyPacketsOnly = enable;
+
+    if (!m_raw || isOutput())
+        return;
+
+    for (size_t i = 0; i < m_raw->nb_streams; ++i) {
+        auto st = m_raw->streams[i];
+        if (stream(i).mediaType() != AVMEDIA_TYPE_VIDEO)
+            continue;
+
+        // Keep streams discarded by user
+        if (enable && st->discard < AVDISCARD_NONKEY)
+            st->discard = AVDISCARD_NONKEY;
+        else if (!enable && st->discard == AVDISCARD_NONKEY)
+            st->discard = AVDISCARD_DEFAULT;
+    }
+}
+
+bool FormatContext::isKeyPacketsOnly() const noexcept
+{
+    return m_keyPacketsOnly;
+}
+
 void FormatContext::substractStartTime(bool enable)
 {
     m_substractStartTime = enable;
@@ -442,31 +600,85 @@ Packet FormatContext::readPacket(OptionalErrorCode ec)
 {
     clear_if(ec);
 
+    Packet packet;
+    if (checkReadable(ec))
+        readNextPacket(packet, ec);
+    return packet;
+}
+
+size_t FormatContext::readPackets(std::vector<Packet> &packets, size_t maxBytes, OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    if (!checkReadable(ec))
+        return 0;
+
+    size_t count = 0;
+    size_t bytes = 0;
+    for (auto &packet : packets) {
+        if (!readNextPacket(packet, ec))
+            break;
+
+        ++count;
+        bytes += packet.size();
+        if (maxBytes && bytes >= maxBytes)
+            break;
+    }
+
+    return count;
+}
+
+bool FormatContext::checkReadable(OptionalErrorCode ec)
+{
     if (!m_raw)
     {
         throws_if(ec, Errors::Unallocated);
-        return Packet();
+        return false;
     }
 
     if (!m_streamsInfoFound)
     {
         fflog(AV_LOG_ERROR, "Streams does not found. Try call findStreamInfo()\n");
         throws_if(ec, Errors::FormatNoStreams);
-        return Packet();
+        return false;
     }
 
-    Packet packet;
+    return true;
+}
+
+bool FormatContext::readNextPacket(Packet &packet, OptionalErrorCode ec)
+{
+    if (!m_readAhead)
+        return readPacketDirect(packet, ec);
+
+    packet = readPacketAhead(ec);
+    return !is_error(ec) && !packet.isNull();
+}
+
+bool FormatContext::readPacketDirect(Packet &packet, OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    packet.reset();
 
     int sts = 0;
-    int tries = 0;
-    const int retryCount = 5;
     do
     {
-        resetSocketAccess();
-        sts = av_read_frame(m_raw, packet.raw());
-        ++tries;
+        av_packet_unref(packet.raw());
+
+        int tries = 0;
+        const int retryCount = 5;
+        do
+        {
+            // Clock is checked by the interrupt callback only when timeout is set
+            if (m_socketTimeout > -1)
+                resetSocketAccess();
+            sts = av_read_frame(m_raw, packet.raw());
+            ++tries;
+        }
+        while (sts == AVERROR(EAGAIN) && (retryCount < 0 || tries <= retryCount));
     }
-    while (sts == AVERROR(EAGAIN) && (retryCount < 0 || tries <= retryCount));
+    while (sts == 0 && isDiscardedPacket(packet.raw()));
 
     // End of file
     if (sts == AVERROR_EOF /*|| avio_feof(m_raw->pb)*/) {
@@ -482,7 +694,7 @@ Packet FormatContext::readPacket(OptionalErrorCode ec)
         if (packet)
             sts = 0; // not an error
         else
-            return packet;
+            return false;
     }
 
     if (sts == 0)
@@ -492,13 +704,13 @@ Packet FormatContext::readPacket(OptionalErrorCode ec)
         {
             // TODO: need verification
             throws_if(ec, pberr, ffmpeg_category());
-            return packet;
+            return false;
         }
     }
     else
     {
         throws_if(ec, sts, ffmpeg_category());
-        return packet;
+        return false;
     }
 
     if (packet.streamIndex() >= 0)
@@ -506,7 +718,7 @@ Packet FormatContext::readPacket(OptionalErrorCode ec)
         if ((size_t)packet.streamIndex() > streamsCount())
         {
             throws_if(ec, Errors::FormatInvalidStreamIndex);
-            return packet;
+            return false;
         }
 
         packet.setTimeBase(m_raw->streams[packet.streamIndex()]->time_base);
@@ -524,7 +736,7 @@ Packet FormatContext::readPacket(OptionalErrorCode ec)
 
     packet.setComplete(true);
 
-    return packet;
+    return true;
 }
 
 void FormatContext::openOutput(const string &uri, OptionalErrorCode ec)
@@ -680,7 +892,10 @@ void FormatContext::writePacket(OptionalErrorCode ec)
 
 void FormatContext::writePacket(const Packet &pkt, OptionalErrorCode ec)
 {
-    writePacket(pkt, ec, av_interleaved_write_frame);
+    if (m_interleaver && m_interleaver->enabled)
+        writePacketInterleaved(pkt, ec);
+    else
+        writePacket(pkt, ec, av_interleaved_write_frame);
 }
 
 void FormatContext::writePacketDirect(OptionalErrorCode ec)
@@ -849,6 +1064,12 @@ void FormatContext::writeTrailer(OptionalErrorCode ec)
         return;
     }
 
+    if (m_interleaver) {
+        writeInterleaved(true, ec);
+        if (is_error(ec))
+            return;
+    }
+
     resetSocketAccess();
     auto sts = av_write_trailer(m_raw);
     sts = checkPbError(sts);
@@ -856,6 +1077,172 @@ void FormatContext::writeTrailer(OptionalErrorCode ec)
         throws_if(ec, sts, ffmpeg_category());
 }
 
+void FormatContext::enableInterleaver(int64_t maxDtsSkew, size_t maxBytes, InterleaveFlush flush, OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    if (isOpened() && !isOutput()) {
+        throws_if(ec, Errors::FormatInvalidDirection);
+        return;
+    }
+
+    if (!m_interleaver)
+        m_interleaver.reset(new Interleaver);
+
+    // Buffered packets are kept, new limits are applied by the next write
+    m_interleaver->maxDtsSkew = std::max<int64_t>(maxDtsSkew, 0);
+    m_interleaver->maxBytes   = maxBytes;
+    m_interleaver->flush      = flush;
+    m_interleaver->enabled    = true;
+}
+
+void FormatContext::disableInterleaver(OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    if (!m_interleaver)
+        return;
+
+    if (m_interleaver->stats.bufferedPackets) {
+        writeInterleaved(true, ec);
+        if (is_error(ec))
+            return;
+    }
+
+    m_interleaver->enabled = false;
+}
+
+bool FormatContext::isInterleaverEnabled() const noexcept
+{
+    return m_interleaver && m_interleaver->enabled;
+}
+
+FormatContext::InterleaveStats FormatContext::interleaveStats() const noexcept
+{
+    return m_interleaver ? m_interleaver->stats : InterleaveStats();
+}
+
+void FormatContext::writePacketInterleaved(const Packet &pkt, OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    // Flush request: write buffered packets, then pass it to the muxer
+    if (pkt.isNull()) {
+        writeInterleaved(true, ec);
+        if (is_error(ec))
+            return;
+        writePacket(pkt, ec, av_write_frame);
+        return;
+    }
+
+    if (!isOpened())
+    {
+        throws_if(ec, Errors::FormatNotOpened);
+        return;
+    }
+
+    if (!m_headerWriten)
+    {
+        throws_if(ec, Errors::FormatHeaderNotWriten);
+        return;
+    }
+
+    auto st = stream(pkt.streamIndex());
+    if (st.isNull()) {
+        fflog(AV_LOG_WARNING, "Required stream does not exists: %d, total=%ld\n", pkt.streamIndex(), streamsCount());
+        throws_if(ec, Errors::FormatInvalidStreamIndex);
+        return;
+    }
+
+    auto &il = *m_interleaver;
+    if (il.streams.size() < streamsCount())
+        il.streams.resize(streamsCount());
+
+    // Reference, time base is converted once here: it is not changed by writePacketDirect()
+    Packet packet = pkt;
+    if (st.timeBase() != packet.timeBase())
+        packet.setTimeBase(st.timeBase());
+
+    auto &queue = il.streams[static_cast<size_t>(pkt.streamIndex())];
+
+    int64_t dts = AV_NOPTS_VALUE;
+    if (packet.dts().isValid())
+        dts = packet.dts().timestamp(av::TimeBaseQ);
+    else if (packet.pts().isValid())
+        dts = packet.pts().timestamp(av::TimeBaseQ);
+    else if (queue.lastDts != AV_NOPTS_VALUE)
+        dts = queue.lastDts;
+
+    // Nothing to order by: behind everything buffered
+    if (dts == AV_NOPTS_VALUE)
+        dts = std::numeric_limits<int64_t>::min();
+
+    queue.lastDts = std::max(queue.lastDts, dts);
+    if (il.maxDts == AV_NOPTS_VALUE || dts > il.maxDts)
+        il.maxDts = dts;
+
+    const size_t size = packet.size();
+    queue.heap.push_back(Interleaver::Item{dts, il.seq++, std::move(packet)});
+    std::push_heap(queue.heap.begin(), queue.heap.end(), Interleaver::later);
+
+    ++il.stats.bufferedPackets;
+    il.stats.bufferedBytes    += size;
+    il.stats.peakBufferedBytes = std::max(il.stats.peakBufferedBytes, il.stats.bufferedBytes);
+
+    writeInterleaved(false, ec);
+}
+
+void FormatContext::writeInterleaved(bool all, OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    auto &il = *m_interleaver;
+
+    const bool overflow = il.maxBytes && il.stats.bufferedBytes > il.maxBytes;
+    if (overflow) {
+        ++il.stats.forcedFlushes;
+        if (il.flush == InterleaveFlush::All)
+            all = true;
+    }
+
+    while (il.stats.bufferedPackets) {
+        Interleaver::StreamQueue *earliest = nullptr;
+        bool everyStream = true;
+        for (auto &queue : il.streams) {
+            if (queue.heap.empty()) {
+                everyStream = false;
+                continue;
+            }
+            if (!earliest || Interleaver::later(earliest->heap.front(), queue.heap.front()))
+                earliest = &queue;
+        }
+
+        const int64_t dts = earliest->heap.front().dts;
+        bool ready = all || everyStream || (overflow && il.stats.bufferedBytes > il.maxBytes);
+        if (!ready && il.maxDtsSkew && dts != std::numeric_limits<int64_t>::min() &&
+            il.maxDts - dts > il.maxDtsSkew) {
+            ready = true;
+            ++il.stats.skewWrites;
+        }
+
+        if (!ready)
+            break;
+
+        std::pop_heap(earliest->heap.begin(), earliest->heap.end(), Interleaver::later);
+        Packet packet = std::move(earliest->heap.back().packet);
+        earliest->heap.pop_back();
+
+        --il.stats.bufferedPackets;
+        il.stats.bufferedBytes -= packet.size();
+        if (!il.stats.bufferedPackets)
+            il.maxDts = AV_NOPTS_VALUE;
+
+        writePacket(packet, ec, av_write_frame);
+        if (is_error(ec))
+            return;
+    }
+}
+
 int FormatContext::avioInterruptCb(void *opaque)
 {
     if (!opaque)
@@ -866,6 +1253,9 @@ int FormatContext::avioInterruptCb(void *opaque)
 
 int FormatContext::avioInterruptCb()
 {
+    if (m_readAhead && m_readAhead->interrupt)
+        return 1;
+
     if (m_interruptCb && m_interruptCb())
         return 1;
 
@@ -932,6 +1322,153 @@ void FormatContext::closeCodecContexts()
 #endif
 }
 
+bool FormatContext::isDiscardedPacket(const AVPacket *packet)
+{
+    if (packet->stream_index < 0 || static_cast<size_t>(packet->stream_index) >= m_raw->nb_streams)
+        return false;
+
+    // Not all demuxers honor discard
+    if (m_raw->streams[packet->stream_index]->discard >= AVDISCARD_ALL)
+        return true;
+
+    if (!m_keyPacketsOnly || (packet->flags & AV_PKT_FLAG_KEY))
+        return false;
+
+    return stream(packet->stream_index).mediaType() == AVMEDIA_TYPE_VIDEO;
+}
+
+void FormatContext::enableReadAhead(size_t maxPackets, size_t maxBytes, OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    if (isOutput()) {
+        throws_if(ec, Errors::FormatInvalidDirection);
+        return;
+    }
+
+    // Apply new limits to the new reader thread, queued packets are kept
+    stopReadAhead(false, false);
+
+    if (!m_readAhead)
+        m_readAhead.reset(new ReadAhead);
+
+    std::lock_guard<std::mutex> lock(m_readAhead->mutex);
+    m_readAhead->maxPackets = std::max<size_t>(maxPackets, 1);
+    m_readAhead->maxBytes   = std::max<size_t>(maxBytes, 1);
+    m_readAhead->enabled    = true;
+}
+
+void FormatContext::disableReadAhead()
+{
+    if (!m_readAhead)
+        return;
+
+    stopReadAhead(false, false);
+    m_readAhead->enabled = false;
+}
+
+bool FormatContext::isReadAheadEnabled() const noexcept
+{
+    return m_readAhead && m_readAhead->enabled;
+}
+
+Packet FormatContext::readPacketAhead(OptionalErrorCode ec)
+{
+    auto &ra = *m_readAhead;
+
+    std::unique_lock<std::mutex> lock(ra.mutex);
+    if (ra.items.empty()) {
+        if (!ra.enabled) {
+            lock.unlock();
+            Packet packet;
+            readPacketDirect(packet, ec);
+            return packet;
+        }
+
+        if (!ra.running) {
+            // Previous reader stopped at the end of stream, on error or by pause
+            if (ra.thread.joinable()) {
+                lock.unlock();
+                ra.thread.join();
+                lock.lock();
+            }
+            ra.running = true;
+            ra.thread  = std::thread([this] { readAheadLoop(); });
+        }
+    }
+
+    ra.cond.wait(lock, [&ra] { return !ra.items.empty(); });
+
+    ReadAhead::Item item = std::move(ra.items.front());
+    ra.items.pop_front();
+    ra.bytes -= std::min<size_t>(ra.bytes, item.packet.size());
+    lock.unlock();
+    ra.cond.notify_all();
+
+    if (item.error)
+        throws_if(ec, item.error.value(), item.error.category());
+
+    return std::move(item.packet);
+}
+
+void FormatContext::readAheadLoop()
+{
+    auto &ra = *m_readAhead;
+
+    while (true) {
+        std::error_code error;
+        Packet packet;
+        readPacketDirect(packet, error);
+        const bool last = error || packet.isNull();
+
+        std::unique_lock<std::mutex> lock(ra.mutex);
+        ra.cond.wait(lock, [&ra] { return ra.stop || !ra.isFull(); });
+
+        // Packet read before stop request is queued anyway: it is dropped on seek or close only
+        ra.bytes += packet.size();
+        ra.items.push_back(ReadAhead::Item{std::move(packet), error});
+
+        if (last || ra.stop)
+            break;
+
+        lock.unlock();
+        ra.cond.notify_all();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(ra.mutex);
+        ra.running = false;
+    }
+    ra.cond.notify_all();
+}
+
+void FormatContext::stopReadAhead(bool dropPackets, bool interrupt)
+{
+    if (!m_readAhead)
+        return;
+
+    auto &ra = *m_readAhead;
+
+    {
+        std::lock_guard<std::mutex> lock(ra.mutex);
+        ra.stop = true;
+    }
+    ra.interrupt = interrupt;
+    ra.cond.notify_all();
+
+    if (ra.thread.joinable())
+        ra.thread.join();
+
+    std::lock_guard<std::mutex> lock(ra.mutex);
+    ra.stop      = false;
+    ra.interrupt = false;
+    ra.running   = false;
+    if (dropPackets) {
+        ra.items.clear();
+        ra.bytes = 0;
+    }
+}
+
 int FormatContext::checkPbError(int stat)
 {
     // WORKAROUND: a lot of format specific writer_packet() functions always return zero code
@@ -50,8 +50,12 @@ struct CustomIO
     virtual const char* name() const { return ""; }
 };
 
+class ProbeCache;
+
 class FormatContext : public FFWrapperPtr<AVFormatContext>, public noncopyable
 {
+    friend class ProbeCache;
+
 public:
     FormatContext();
     ~FormatContext();
@@ -108,6 +112,30 @@ public:
     bool eventFlags(int flags) const noexcept;
     void eventFlagsClear(int flags) noexcept;
 
+    /**
+     * Demux-side keyframe-only mode: non-key packets of the video streams are discarded before
+     * they returned by readPacket(). Video streams marked with AVDISCARD_NONKEY, so demuxers that
+     * support it do not read such packets at all, for others packets are filtered.
+     *
+     * Matches DecodeMode::KeyOnly of the VideoDecoderContext.
+     */
+    void setKeyPacketsOnly(bool enable);
+    bool isKeyPacketsOnly() const noexcept;
+
+    /**
+     * @brief selectStreams - read only given streams, others are marked with AVDISCARD_ALL
+     *
+     * Packets of the discarded streams are not returned by readPacket(). Demuxers that support
+     * discarding (MPEG-TS, MP4, Matroska and others) do not even read and allocate them. Call it
+     * before findStreamInfo(): such demuxers do not deliver packets of the discarded streams
+     * while probing too, so they are not decoded to detect parameters.
+     *
+     * @param indices  streams to read, empty list - all streams
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     */
+    void selectStreams(const std::vector<size_t> &indices, OptionalErrorCode ec = throws());
+
     //
     // Input
     //
@@ -163,6 +191,81 @@ public:
 
     Packet readPacket(OptionalErrorCode ec = throws());
 
+    /**
+     * @brief readPackets - read batch of packets into the given packet objects
+     *
+     * Input state is checked once per batch and packet objects are reused (see Packet::reset()),
+     * so per-packet overhead is lower than for the readPacket() calls. Keep vector between calls
+     * to avoid allocations.
+     *
+     * @param packets   packets to fill, its size is the max packets count
+     * @param maxBytes  stop when total payload reaches this size, 0 - no limit
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     * @return filled packets count: first packets of the vector. Less than vector size at the end
+     *         of stream or on error.
+     */
+    size_t readPackets(std::vector<Packet> &packets, size_t maxBytes = 0, OptionalErrorCode ec = throws());
+
+    /**
+     * @brief readUntil - read packets and pass them to the callback until it returns false
+     *
+     * Single packet object is reused for all packets, callback can move packet out.
+     *
+     * @param callback  bool(Packet&), false to stop reading
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     * @return packets passed to the callback
+     */
+    template<typename Callback>
+    size_t readUntil(Callback &&callback, OptionalErrorCode ec = throws())
+    {
+        clear_if(ec);
+
+        if (!checkReadable(ec))
+            return 0;
+
+        size_t count = 0;
+        Packet packet;
+        while (readNextPacket(packet, ec)) {
+            ++count;
+            if (!callback(packet))
+                break;
+        }
+        return count;
+    }
+
+    //
+    // Read-ahead
+    //
+    static constexpr size_t READ_AHEAD_DEFAULT_PACKETS = 256;
+    static constexpr size_t READ_AHEAD_DEFAULT_BYTES   = 16 * 1024 * 1024;
+
+    /**
+     * @brief enableReadAhead - demux on the background thread
+     *
+     * Reader thread is started by the first readPacket() call and fills bounded queue of the
+     * packets, so slow input I/O overlaps with the decoding. readPacket() takes packets from the
+     * queue. Queue is limited by the packets count and by the total payload size: at least one
+     * packet is queued anyway.
+     *
+     * seek() drops queued packets and restarts reader from the new position, close() interrupts
+     * blocked read. Interrupt callback is called from the reader thread.
+     *
+     * Input must not be accessed by the other ways (e.g. via raw()) while reader thread works.
+     *
+     * @param maxPackets  queue limit, packets
+     * @param maxBytes    queue limit, bytes of the packets payload
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     */
+    void enableReadAhead(size_t maxPackets = READ_AHEAD_DEFAULT_PACKETS,
+                         size_t maxBytes   = READ_AHEAD_DEFAULT_BYTES,
+                         OptionalErrorCode ec = throws());
+    /// Stop reader thread. Already queued packets are returned by readPacket() first.
+    void disableReadAhead();
+    bool isReadAheadEnabled() const noexcept;
+
     //
     // Output
     //
@@ -196,6 +299,55 @@ public:
 
     void writeTrailer(OptionalErrorCode ec = throws());
 
+    //
+    // Interleaving
+    //
+    static constexpr int64_t INTERLEAVE_DEFAULT_MAX_DTS_SKEW = 10 * AV_TIME_BASE;
+    static constexpr size_t  INTERLEAVE_DEFAULT_MAX_BYTES    = 64 * 1024 * 1024;
+
+    /// What is written when buffered bytes exceed the limit
+    enum class InterleaveFlush
+    {
+        Earliest, ///< earliest packets, until buffer fits the limit
+        All,      ///< all buffered packets
+    };
+
+    struct InterleaveStats
+    {
+        size_t   bufferedPackets   = 0;
+        size_t   bufferedBytes     = 0;
+        size_t   peakBufferedBytes = 0;
+        uint64_t skewWrites        = 0; ///< packets written without waiting other streams, by DTS skew
+        uint64_t forcedFlushes     = 0; ///< buffered bytes limit overflows
+    };
+
+    /**
+     * @brief enableInterleaver - interleave writePacket() output with the bounded buffer
+     *
+     * av_interleaved_write_frame() buffers packets until every stream gets a packet: sparse
+     * streams (subtitles, data) make it grow without limit. With the interleaver packets are
+     * kept in the per-stream DTS heaps and the earliest one is written by writePacketDirect()
+     * when every stream has a packet, when it is behind the latest buffered DTS more than
+     * maxDtsSkew, or when buffered payload exceeds maxBytes (see InterleaveFlush).
+     *
+     * writePacket() without packet and writeTrailer() write all buffered packets, writePacket()
+     * passes flush request to the muxer after them.
+     *
+     * @param maxDtsSkew  AV_TIME_BASE units, 0 - no limit
+     * @param maxBytes    buffered payload limit, 0 - no limit
+     * @param flush       overflow policy
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     */
+    void enableInterleaver(int64_t         maxDtsSkew = INTERLEAVE_DEFAULT_MAX_DTS_SKEW,
+                           size_t          maxBytes   = INTERLEAVE_DEFAULT_MAX_BYTES,
+                           InterleaveFlush flush      = InterleaveFlush::Earliest,
+                           OptionalErrorCode ec = throws());
+    /// Write buffered packets, writePacket() uses av_interleaved_write_frame() after it
+    void disableInterleaver(OptionalErrorCode ec = throws());
+    bool isInterleaverEnabled() const noexcept;
+    InterleaveStats interleaveStats() const noexcept;
+
 private:
     void openInput(const std::string& uri, InputFormat format, AVDictionary **options, OptionalErrorCode ec);
     void openOutput(const std::string& uri, OutputFormat format, AVDictionary **options, OptionalErrorCode ec);
@@ -211,6 +363,17 @@ private:
     void        findStreamInfo(AVDictionary **options, size_t optionsCount, OptionalErrorCode ec);
     void        closeCodecContexts();
     int         checkPbError(int stat);
+    bool        isDiscardedPacket(const AVPacket *packet);
+
+    bool        checkReadable(OptionalErrorCode ec);
+    bool        readNextPacket(Packet &packet, OptionalErrorCode ec);
+    bool        readPacketDirect(Packet &packet, OptionalErrorCode ec);
+    Packet      readPacketAhead(OptionalErrorCode ec);
+    void        readAheadLoop();
+    void        stopReadAhead(bool dropPackets, bool interrupt);
+
+    void        writePacketInterleaved(const Packet &pkt, OptionalErrorCode ec);
+    void        writeInterleaved(bool all, OptionalErrorCode ec);
 
     void        openCustomIO(CustomIO *io, size_t internalBufferSize, bool isWritable, OptionalErrorCode ec);
     void        openCustomIOInput(CustomIO *io, size_t internalBufferSize, OptionalErrorCode ec);
@@ -228,6 +391,13 @@ private:
     bool                                               m_streamsInfoFound = false;
     bool                                               m_headerWriten     = false;
     bool                                               m_substractStartTime = false;
+    bool                                               m_keyPacketsOnly = false;
+
+    struct ReadAhead;
+    std::unique_ptr<ReadAhead>                         m_readAhead;
+
+    struct Interleaver;
+    std::unique_ptr<Interleaver>                       m_interleaver;
 };
 
 } // namespace av
@@ -0,0 +1,313 @@
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <cstdlib>
+
+#if defined(__linux__)
+#  include <sys/mman.h>
+#endif
+
+#include "frame.h"
+#include "framepool.h"
+
+extern "C" {
+#include <libavutil/buffer.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+}
+
+using namespace std;
+
+namespace {
+
+#if LIBAVUTIL_VERSION_MAJOR >= 57
+using buffer_size_t = size_t;
+#else
+using buffer_size_t = int;
+#endif
+
+uint8_t *align_ptr(uint8_t *ptr, size_t align)
+{
+    auto addr = reinterpret_cast<uintptr_t>(ptr);
+    return reinterpret_cast<uint8_t*>((addr + align - 1) & ~(uintptr_t(align) - 1));
+}
+
+#if defined(__linux__)
+void huge_page_buffer_free(void */*opaque*/, uint8_t *data)
+{
+    ::free(data);
+}
+#endif
+
+} // anonymous
+
+namespace av {
+
+struct FramePool::State
+{
+    // Buffer size is the only parameter that makes buffers interchangeable: same frame size
+    // needs different buffers for the codecs with different alignment requirements
+    using Key = size_t;
+
+    // Outstanding buffer: keeps state alive until last frame released
+    struct Holder
+    {
+        std::shared_ptr<State> state;
+        AVBufferRef           *pooled;
+    };
+
+    State(size_t align, bool hugePages)
+        : align(align),
+          hugePages(hugePages)
+    {
+    }
+
+    ~State()
+    {
+        for (auto &pool : pools)
+            av_buffer_pool_uninit(&pool.second);
+    }
+
+    static AVBufferRef *alloc(void *opaque, buffer_size_t size)
+    {
+        auto state = static_cast<State*>(opaque);
+        AVBufferRef *buf = nullptr;
+
+#if defined(__linux__)
+        if (state->hugePages && size_t(size) >= HugePageSize) {
+            const size_t allocSize = (size_t(size) + HugePageSize - 1) & ~(HugePageSize - 1);
+            void *ptr = nullptr;
+            if (posix_memalign(&ptr, HugePageSize, allocSize) == 0) {
+#  if defined(MADV_HUGEPAGE)
+                madvise(ptr, allocSize, MADV_HUGEPAGE);
+#  endif
+                buf = av_buffer_create(static_cast<uint8_t*>(ptr), size, huge_page_buffer_free, nullptr, 0);
+                if (!buf)
+                    ::free(ptr);
+            }
+        }
+#endif
+
+        if (!buf)
+            buf = av_buffer_alloc(size);
+
+        if (buf)
+            ++state->allocated;
+
+        return buf;
+    }
+
+    static void release(void *opaque, uint8_t */*data*/)
+    {
+        auto holder = static_cast<Holder*>(opaque);
+        av_buffer_unref(&holder->pooled);
+        --holder->state->live;
+        // Can destroy state
+        delete holder;
+    }
+
+    AVBufferRef *get(const std::shared_ptr<State> &self, size_t size)
+    {
+        const Key key = size;
+        AVBufferRef *pooled = nullptr;
+        {
+            // Keep lock during get: trim() can uninit pool concurrently
+            std::lock_guard<std::mutex> lock(mutex);
+            auto &pool = pools[key];
+            if (!pool) {
+                pool = av_buffer_pool_init2(size, this, &State::alloc, nullptr);
+                if (!pool) {
+                    pools.erase(key);
+                    return nullptr;
+                }
+            }
+            pooled = av_buffer_pool_get(pool);
+        }
+
+        if (!pooled)
+            return nullptr;
+
+        ++requests;
+
+        auto holder = new (std::nothrow) Holder{self, pooled};
+        if (!holder) {
+            av_buffer_unref(&pooled);
+            return nullptr;
+        }
+
+        AVBufferRef *buf = av_buffer_create(pooled->data, pooled->size, &State::release, holder, 0);
+        if (!buf) {
+            av_buffer_unref(&holder->pooled);
+            delete holder;
+            return nullptr;
+        }
+
+        size_t current = ++live;
+        size_t prevPeak = peak.load();
+        while (current > prevPeak && !peak.compare_exchange_weak(prevPeak, current))
+        {}
+
+        return buf;
+    }
+
+    const size_t               align;
+    const bool                 hugePages;
+
+    std::mutex                 mutex;
+    std::map<Key, AVBufferPool*> pools;
+
+    std::atomic<size_t>        live      {0};
+    std::atomic<size_t>        peak      {0};
+    std::atomic<size_t>        allocated {0};
+    std::atomic<size_t>        requests  {0};
+};
+
+
+FramePool::FramePool(size_t align, bool hugePages)
+{
+    // Must be power of two
+    if (align == 0 || (align & (align - 1)))
+        align = DefaultAlign;
+    m_state = std::make_shared<State>(align, hugePages);
+}
+
+FramePool::~FramePool() = default;
+
+size_t FramePool::align() const noexcept
+{
+    return m_state->align;
+}
+
+FramePool::Stats FramePool::stats() const noexcept
+{
+    Stats stats;
+    stats.live      = m_state->live;
+    stats.peak      = m_state->peak;
+    stats.allocated = m_state->allocated;
+
+    size_t requests = m_state->requests;
+    stats.recycled  = requests > stats.allocated ? requests - stats.allocated : 0;
+    return stats;
+}
+
+void FramePool::trim()
+{
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    for (auto &pool : m_state->pools)
+        av_buffer_pool_uninit(&pool.second);
+    m_state->pools.clear();
+}
+
+int FramePool::getBuffer2(AVCodecContext *ctx, AVFrame *frame, int flags)
+{
+    auto pool = static_cast<FramePool*>(ctx->opaque);
+
+    if (!pool || !ctx->codec || !(ctx->codec->capabilities & AV_CODEC_CAP_DR1) || ctx->hw_frames_ctx)
+        return avcodec_default_get_buffer2(ctx, frame, flags);
+
+    switch (ctx->codec_type) {
+        case AVMEDIA_TYPE_VIDEO:
+        {
+            auto desc = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(frame->format));
+            if (!desc || (desc->flags & AV_PIX_FMT_FLAG_HWACCEL))
+                break;
+            return pool->getVideoBuffer(ctx, frame);
+        }
+
+        case AVMEDIA_TYPE_AUDIO:
+            // Extended data pointers are not supported
+            if (frame::get_channels(frame) > AV_NUM_DATA_POINTERS)
+                break;
+            return pool->getAudioBuffer(ctx, frame);
+
+        default:
+            break;
+    }
+
+    return avcodec_default_get_buffer2(ctx, frame, flags);
+}
+
+int FramePool::getVideoBuffer(AVCodecContext *ctx, AVFrame *frame)
+{
+    const auto fmt   = static_cast<AVPixelFormat>(frame->format);
+    const auto align = static_cast<int>(m_state->align);
+
+    // Decoder can write beyond visible area: use same rules as avcodec_default_get_buffer2()
+    int w = frame->width;
+    int h = frame->height;
+    int linesizeAlign[AV_NUM_DATA_POINTERS];
+    avcodec_align_dimensions2(ctx, &w, &h, linesizeAlign);
+
+    int linesize[4] = {0};
+    int unaligned = 0;
+    do {
+        int sts = av_image_fill_linesizes(linesize, fmt, w);
+        if (sts < 0)
+            return sts;
+        // Increase width alignment for the next try: add lowest set bit
+        w += w & ~(w - 1);
+
+        // Codec requirements are applied on top of the pool alignment, both are powers of two
+        unaligned = 0;
+        for (int i = 0; i < 4; ++i)
+            unaligned |= linesize[i] % std::max(align, linesizeAlign[i]);
+    } while (unaligned);
+
+    // Planes offsets: calculated from the null base
+    uint8_t *planes[4] = {nullptr};
+    int size = av_image_fill_pointers(planes, fmt, h, nullptr, linesize);
+    if (size < 0)
+        return size;
+
+    // Padding for SIMD overreads and slack for the base alignment
+    const size_t poolSize = size_t(size) + 16 + 2 * size_t(align) - 1;
+
+    AVBufferRef *buf = m_state->get(m_state, poolSize);
+    if (!buf)
+        return AVERROR(ENOMEM);
+
+    uint8_t *base = align_ptr(buf->data, m_state->align);
+    for (int i = 0; i < 4; ++i) {
+        if (i == 0 || planes[i]) {
+            frame->data[i]     = base + (planes[i] - planes[0]);
+            frame->linesize[i] = linesize[i];
+        }
+    }
+
+    frame->extended_data = frame->data;
+    frame->buf[0]        = buf;
+
+    return 0;
+}
+
+int FramePool::getAudioBuffer(AVCodecContext */*ctx*/, AVFrame *frame)
+{
+    const auto fmt      = static_cast<AVSampleFormat>(frame->format);
+    const auto align    = static_cast<int>(m_state->align);
+    const int  channels = frame::get_channels(frame);
+    const int  planes   = av_sample_fmt_is_planar(fmt) ? channels : 1;
+
+    int linesize = 0;
+    int sts = av_samples_get_buffer_size(&linesize, channels, frame->nb_samples, fmt, align);
+    if (sts < 0)
+        return sts;
+
+    const size_t poolSize = size_t(linesize) * planes + size_t(align) - 1;
+
+    AVBufferRef *buf = m_state->get(m_state, poolSize);
+    if (!buf)
+        return AVERROR(ENOMEM);
+
+    uint8_t *base = align_ptr(buf->data, m_state->align);
+    for (int i = 0; i < planes; ++i)
+        frame->data[i] = base + i * linesize;
+
+    frame->linesize[0]   = linesize;
+    frame->extended_data = frame->data;
+    frame->buf[0]        = buf;
+
+    return 0;
+}
+
+} // namespace av
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <memory>
+
+#include "ffmpeg.h"
+#include "avutils.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+namespace av {
+
+/**
+ * @brief The FramePool class - pooled frame buffers allocator for decoders
+ *
+ * Installed to the decoder context via setFramePool() and serves AVCodecContext::get_buffer2.
+ * Buffers are taken from the AVBufferPool selected by buffer size. Size is calculated from frame
+ * parameters and decoder alignment requirements (avcodec_align_dimensions2()), so frames of the
+ * same size decoded by the different codecs can get the different pools. In steady state
+ * decoding does not allocate frame memory at all: released frame returns buffer back to the pool.
+ *
+ * Buffers bigger than huge page (2MiB) are aligned to the huge page boundary and, on Linux,
+ * marked with MADV_HUGEPAGE to reduce page faults count on 4K and bigger frames.
+ *
+ * Single pool can be shared between several decoders. Pool can be safely destroyed while decoded
+ * frames still alive: memory is freed when last frame released.
+ */
+class FramePool : public noncopyable
+{
+public:
+    static constexpr size_t DefaultAlign  = 64;
+    static constexpr size_t HugePageSize  = 2 * 1024 * 1024;
+
+    struct Stats
+    {
+        size_t live      = 0; ///< buffers held by frames right now
+        size_t peak      = 0; ///< maximum of the live buffers
+        size_t allocated = 0; ///< total buffers allocated by the pools
+        size_t recycled  = 0; ///< requests served without allocation
+    };
+
+    /**
+     * @param align       line size and plane alignment, power of two
+     * @param hugePages   align big buffers to the huge pages boundary
+     */
+    explicit FramePool(size_t align = DefaultAlign, bool hugePages = true);
+    ~FramePool();
+
+    size_t align() const noexcept;
+
+    Stats stats() const noexcept;
+
+    /**
+     * Drop all pools. Buffers used by frames right now are freed when frames released. Useful
+     * when stream parameters changed and old-sized buffers never will be requested.
+     */
+    void trim();
+
+    /**
+     * AVCodecContext::get_buffer2 compatible allocator. AVCodecContext::opaque must point to the
+     * FramePool object. Falls back to the avcodec_default_get_buffer2() for hardware frames and
+     * codecs without direct rendering support.
+     */
+    static int getBuffer2(AVCodecContext *ctx, AVFrame *frame, int flags);
+
+private:
+    int getVideoBuffer(AVCodecContext *ctx, AVFrame *frame);
+    int getAudioBuffer(AVCodecContext *ctx, AVFrame *frame);
+
+    struct State;
+    std::shared_ptr<State> m_state;
+};
+
+} // namespace av
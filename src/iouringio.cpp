@@ -0,0 +1,662 @@
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+#if defined(__unix__) || defined(__APPLE__)
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/stat.h>
+#  include <sys/uio.h>
+#  define AVCPP_HAS_PREAD 1
+#else
+#  define AVCPP_HAS_PREAD 0
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#  if __has_include(<linux/io_uring.h>)
+#    include <sys/mman.h>
+#    include <sys/syscall.h>
+#    include <linux/io_uring.h>
+#    if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#      define AVCPP_HAS_IO_URING 1
+#    endif
+#  endif
+#endif
+
+#ifndef AVCPP_HAS_IO_URING
+#  define AVCPP_HAS_IO_URING 0
+#endif
+
+#include "iouringio.h"
+
+namespace {
+
+#if AVCPP_HAS_IO_URING
+/**
+ * Minimal io_uring submission/completion queue over the raw system calls: one request submitted
+ * per call, completions are taken one by one.
+ */
+class Uring
+{
+public:
+    Uring() = default;
+    Uring(const Uring&) = delete;
+    Uring& operator=(const Uring&) = delete;
+
+    ~Uring()
+    {
+        if (m_sqes)
+            munmap(m_sqes, m_sqesSize);
+        if (m_cqPtr && m_cqPtr != m_sqPtr)
+            munmap(m_cqPtr, m_cqSize);
+        if (m_sqPtr)
+            munmap(m_sqPtr, m_sqSize);
+        if (m_fd >= 0)
+            ::close(m_fd);
+    }
+
+    bool setup(unsigned entries)
+    {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+
+        m_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (m_fd < 0)
+            return false;
+
+        m_sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        m_cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+            m_sqSize = m_cqSize = std::max(m_sqSize, m_cqSize);
+
+        m_sqPtr = mmap(nullptr, m_sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+        if (m_sqPtr == MAP_FAILED) {
+            m_sqPtr = nullptr;
+            return false;
+        }
+
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            m_cqPtr = m_sqPtr;
+        } else {
+            m_cqPtr = mmap(nullptr, m_cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+            if (m_cqPtr == MAP_FAILED) {
+                m_cqPtr = nullptr;
+                return false;
+            }
+        }
+
+        m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        void *sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+            return false;
+        m_sqes = static_cast<io_uring_sqe*>(sqes);
+
+        auto sq = static_cast<uint8_t*>(m_sqPtr);
+        m_sqTail  = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        m_sqMask  = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        m_sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+        auto cq = static_cast<uint8_t*>(m_cqPtr);
+        m_cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        m_cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        m_cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        m_cqes   = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        return true;
+    }
+
+    /// @return negative errno on error
+    int submit(uint8_t opcode, int fd, const iovec *iov, int64_t offset, uint64_t userData)
+    {
+        const unsigned tail  = *m_sqTail;
+        const unsigned index = tail & *m_sqMask;
+
+        io_uring_sqe &sqe = m_sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode    = opcode;
+        sqe.fd        = fd;
+        sqe.addr      = reinterpret_cast<uint64_t>(iov);
+        sqe.len       = 1;
+        sqe.off       = static_cast<uint64_t>(offset);
+        sqe.user_data = userData;
+
+        m_sqArray[index] = index;
+        __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+
+        int sts;
+        do {
+            sts = static_cast<int>(syscall(__NR_io_uring_enter, m_fd, 1, 0, 0, nullptr, 0));
+        } while (sts < 0 && errno == EINTR);
+
+        return sts < 0 ? -errno : 0;
+    }
+
+    /// Wait next completion. @return negative errno on error
+    int wait(uint64_t &userData, int &result)
+    {
+        while (true) {
+            const unsigned head = *m_cqHead;
+            if (head != __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE)) {
+                const io_uring_cqe &cqe = m_cqes[head & *m_cqMask];
+                userData = cqe.user_data;
+                result   = cqe.res;
+                __atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+                return 0;
+            }
+
+            const int sts = static_cast<int>(syscall(__NR_io_uring_enter, m_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0));
+            if (sts < 0 && errno != EINTR)
+                return -errno;
+        }
+    }
+
+private:
+    int           m_fd       = -1;
+    void         *m_sqPtr    = nullptr;
+    size_t        m_sqSize   = 0;
+    void         *m_cqPtr    = nullptr;
+    size_t        m_cqSize   = 0;
+    io_uring_sqe *m_sqes     = nullptr;
+    size_t        m_sqesSize = 0;
+
+    unsigned     *m_sqTail   = nullptr;
+    unsigned     *m_sqMask   = nullptr;
+    unsigned     *m_sqArray  = nullptr;
+    unsigned     *m_cqHead   = nullptr;
+    unsigned     *m_cqTail   = nullptr;
+    unsigned     *m_cqMask   = nullptr;
+    io_uring_cqe *m_cqes     = nullptr;
+};
+#endif
+
+} // anonymous
+
+namespace av {
+
+struct IoUringIO::State
+{
+    struct Block
+    {
+        std::vector<uint8_t> data;
+        iovec                iov{};
+        int64_t              offset  = 0;
+        size_t               size    = 0;     ///< requested bytes: filled for write
+        size_t               done    = 0;     ///< read: bytes transferred by previous requests
+        int                  result  = 0;     ///< bytes transferred or negative errno
+        bool                 pending = false; ///< submitted and not completed
+        bool                 valid   = false; ///< read: block belongs to the read-ahead window
+    };
+
+    size_t             blockSize;
+    std::vector<Block> blocks;
+
+#if AVCPP_HAS_IO_URING
+    std::unique_ptr<Uring> ring;
+#endif
+
+    int         fd   = -1;
+    Mode        mode = Mode::Read;
+    std::string path;
+
+    int64_t     position   = 0;
+    int64_t     nextOffset = 0;  ///< read: next block offset to request
+    int64_t     writtenEnd = 0;  ///< write: end of the written data
+    int         fillBlock  = -1; ///< write: block being filled
+    size_t      inFlight   = 0;
+    int         error      = 0;  ///< first write error, AVERROR
+
+    State(size_t blockSize, size_t queueDepth)
+        : blockSize(std::max<size_t>(blockSize, 4096)),
+          blocks(std::max<size_t>(queueDepth, 1))
+    {
+    }
+
+    bool isAsync() const noexcept
+    {
+#if AVCPP_HAS_IO_URING
+        return !!ring;
+#else
+        return false;
+#endif
+    }
+
+    void complete(Block &block, int result)
+    {
+        block.pending = false;
+        --inFlight;
+
+        if (mode == Mode::Read) {
+            // Short read is not the end of file: request the rest, only zero-size read means EOF
+            if (result > 0 && block.done + static_cast<size_t>(result) < block.size) {
+                block.done += static_cast<size_t>(result);
+                ++inFlight;
+                transfer(block);
+                return;
+            }
+            block.result = result < 0 ? result : static_cast<int>(block.done) + result;
+            return;
+        }
+
+        block.result = result;
+
+#if AVCPP_HAS_PREAD
+        // Short write: finish synchronously
+        if (mode == Mode::Write && result >= 0 && static_cast<size_t>(result) < block.size) {
+            size_t done = static_cast<size_t>(result);
+            while (done < block.size) {
+                const ssize_t sts = pwrite(fd, block.data.data() + done, block.size - done, block.offset + done);
+                if (sts < 0 && errno == EINTR)
+                    continue;
+                if (sts <= 0) {
+                    block.result = sts < 0 ? -errno : -EIO;
+                    break;
+                }
+                done += static_cast<size_t>(sts);
+                block.result = static_cast<int>(done);
+            }
+        }
+#endif
+
+        if (mode == Mode::Write && block.result < 0 && !error)
+            error = AVERROR(-block.result);
+    }
+
+    void submit(Block &block)
+    {
+        block.done = 0;
+        ++inFlight;
+        transfer(block);
+    }
+
+    /// Request not transferred part of the block: [done, size)
+    void transfer(Block &block)
+    {
+        uint8_t      *data   = block.data.data() + block.done;
+        const size_t  size   = block.size - block.done;
+        const int64_t offset = block.offset + static_cast<int64_t>(block.done);
+
+        block.pending      = true;
+        block.iov.iov_base = data;
+        block.iov.iov_len  = size;
+
+#if AVCPP_HAS_IO_URING
+        if (ring) {
+            const uint8_t opcode = mode == Mode::Read ? IORING_OP_READV : IORING_OP_WRITEV;
+            const auto index = static_cast<uint64_t>(&block - blocks.data());
+            const int sts = ring->submit(opcode, fd, &block.iov, offset, index);
+            if (sts == 0)
+                return;
+            // Submission failed: process request synchronously
+        }
+#endif
+
+#if AVCPP_HAS_PREAD
+        ssize_t sts;
+        do {
+            sts = mode == Mode::Read
+                    ? pread(fd, data, size, offset)
+                    : pwrite(fd, data, size, offset);
+        } while (sts < 0 && errno == EINTR);
+        complete(block, sts < 0 ? -errno : static_cast<int>(sts));
+#else
+        (void)data;
+        (void)size;
+        (void)offset;
+        complete(block, -ENOSYS);
+#endif
+    }
+
+    /// Wait any completion
+    bool waitOne()
+    {
+        if (!inFlight)
+            return false;
+
+#if AVCPP_HAS_IO_URING
+        if (ring) {
+            uint64_t index = 0;
+            int result = 0;
+            const int sts = ring->wait(index, result);
+            if (sts < 0 || index >= blocks.size()) {
+                // Ring is broken: nothing can be completed anymore
+                for (auto &block : blocks) {
+                    if (block.pending)
+                        complete(block, sts < 0 ? sts : -EIO);
+                }
+                return true;
+            }
+            complete(blocks[index], result);
+            return true;
+        }
+#endif
+        return false;
+    }
+
+    void waitAll()
+    {
+        while (inFlight && waitOne())
+        {}
+    }
+
+    void waitBlock(const Block &block)
+    {
+        while (block.pending && waitOne())
+        {}
+    }
+
+    //
+    // Read
+    //
+    Block* findReadBlock(int64_t pos)
+    {
+        for (auto &block : blocks) {
+            if (block.valid && pos >= block.offset && pos < block.offset + static_cast<int64_t>(blockSize))
+                return &block;
+        }
+        return nullptr;
+    }
+
+    void requestBlock(Block &block)
+    {
+        block.offset = nextOffset;
+        block.size   = blockSize;
+        block.valid  = true;
+        nextOffset  += static_cast<int64_t>(blockSize);
+        submit(block);
+    }
+
+    void restartRead(int64_t pos)
+    {
+        waitAll();
+        nextOffset = pos;
+        for (auto &block : blocks)
+            requestBlock(block);
+    }
+
+    int read(uint8_t *data, size_t size)
+    {
+        Block *block = findReadBlock(position);
+        if (!block) {
+            restartRead(position);
+            block = findReadBlock(position);
+        }
+
+        waitBlock(*block);
+        if (block->result < 0) {
+            // Try again on next call
+            block->valid = false;
+            return AVERROR(-block->result);
+        }
+
+        // Block is filled up to its end unless zero-size read reported the end of file
+        const int64_t available = block->offset + block->result - position;
+        if (available <= 0)
+            return AVERROR_EOF;
+
+        const auto count = static_cast<size_t>(std::min<int64_t>(static_cast<int64_t>(size), available));
+        std::memcpy(data, block->data.data() + (position - block->offset), count);
+        position += static_cast<int64_t>(count);
+
+        // Block consumed: reuse it for the next one
+        if (position == block->offset + static_cast<int64_t>(blockSize))
+            requestBlock(*block);
+
+        return static_cast<int>(count);
+    }
+
+    //
+    // Write
+    //
+    Block* acquireWriteBlock()
+    {
+        while (true) {
+            for (auto &block : blocks) {
+                if (!block.pending)
+                    return &block;
+            }
+            if (!waitOne())
+                return nullptr;
+        }
+    }
+
+    void queueFillBlock()
+    {
+        if (fillBlock < 0)
+            return;
+
+        auto &block = blocks[static_cast<size_t>(fillBlock)];
+        fillBlock = -1;
+        if (block.size)
+            submit(block);
+    }
+
+    int flushWrites()
+    {
+        queueFillBlock();
+        waitAll();
+        return error;
+    }
+
+    int write(const uint8_t *data, size_t size)
+    {
+        if (error)
+            return error;
+
+        size_t written = 0;
+        while (written < size) {
+            // Continue block only if data is contiguous
+            if (fillBlock >= 0) {
+                const auto &block = blocks[static_cast<size_t>(fillBlock)];
+                if (block.offset + static_cast<int64_t>(block.size) != position)
+                    queueFillBlock();
+            }
+
+            if (fillBlock < 0) {
+                Block *block = acquireWriteBlock();
+                if (!block)
+                    return AVERROR(EIO);
+                if (error)
+                    return error;
+                block->offset = position;
+                block->size   = 0;
+                fillBlock     = static_cast<int>(block - blocks.data());
+            }
+
+            auto &block = blocks[static_cast<size_t>(fillBlock)];
+            const size_t count = std::min(size - written, blockSize - block.size);
+            std::memcpy(block.data.data() + block.size, data + written, count);
+            block.size += count;
+            written    += count;
+            position   += static_cast<int64_t>(count);
+            writtenEnd  = std::max(writtenEnd, position);
+
+            if (block.size == blockSize)
+                queueFillBlock();
+        }
+
+        return static_cast<int>(written);
+    }
+
+    int64_t fileSize()
+    {
+#if AVCPP_HAS_PREAD
+        struct stat st;
+        if (fstat(fd, &st) < 0)
+            return AVERROR(errno);
+        return std::max<int64_t>(st.st_size, writtenEnd);
+#else
+        return AVERROR(ENOSYS);
+#endif
+    }
+};
+
+IoUringIO::IoUringIO(size_t blockSize, size_t queueDepth)
+    : m_state(new State(blockSize, queueDepth))
+{
+}
+
+IoUringIO::~IoUringIO()
+{
+    std::error_code ec;
+    close(ec);
+}
+
+void IoUringIO::open(const std::string &path, Mode mode, OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    if (isOpened()) {
+        throws_if(ec, EBUSY, std::system_category());
+        return;
+    }
+
+#if AVCPP_HAS_PREAD
+    auto &st = *m_state;
+
+    const int flags = mode == Mode::Read ? O_RDONLY : (O_WRONLY | O_CREAT | O_TRUNC);
+    st.fd = ::open(path.c_str(), flags | O_CLOEXEC, 0644);
+    if (st.fd < 0) {
+        throws_if(ec, errno, std::system_category());
+        return;
+    }
+
+    st.mode       = mode;
+    st.path       = path;
+    st.position   = 0;
+    st.nextOffset = 0;
+    st.writtenEnd = 0;
+    st.fillBlock  = -1;
+    st.inFlight   = 0;
+    st.error      = 0;
+
+    for (auto &block : st.blocks) {
+        block = State::Block();
+        block.data.resize(st.blockSize);
+    }
+
+#  if AVCPP_HAS_IO_URING
+    st.ring.reset(new Uring);
+    if (!st.ring->setup(static_cast<unsigned>(st.blocks.size())))
+        st.ring.reset();
+#  endif
+#else
+    static_cast<void>(path);
+    static_cast<void>(mode);
+    throws_if(ec, ENOSYS, std::system_category());
+#endif
+}
+
+void IoUringIO::close(OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    if (!isOpened())
+        return;
+
+    auto &st = *m_state;
+
+    int sts = 0;
+    if (st.mode == Mode::Write)
+        sts = st.flushWrites();
+    else
+        st.waitAll();
+
+#if AVCPP_HAS_IO_URING
+    st.ring.reset();
+#endif
+
+#if AVCPP_HAS_PREAD
+    if (::close(st.fd) < 0 && !sts)
+        sts = AVERROR(errno);
+#endif
+    st.fd = -1;
+
+    for (auto &block : st.blocks)
+        block = State::Block();
+
+    if (sts < 0)
+        throws_if(ec, sts, ffmpeg_category());
+}
+
+bool IoUringIO::isOpened() const noexcept
+{
+    return m_state->fd >= 0;
+}
+
+bool IoUringIO::isAsync() const noexcept
+{
+    return m_state->isAsync();
+}
+
+int IoUringIO::read(uint8_t *data, size_t size)
+{
+    if (!isOpened() || m_state->mode != Mode::Read)
+        return AVERROR(EBADF);
+    return m_state->read(data, size);
+}
+
+int IoUringIO::write(const uint8_t *data, size_t size)
+{
+    if (!isOpened() || m_state->mode != Mode::Write)
+        return AVERROR(EBADF);
+    return m_state->write(data, size);
+}
+
+int64_t IoUringIO::seek(int64_t offset, int whence)
+{
+    if (!isOpened())
+        return AVERROR(EBADF);
+
+    auto &st = *m_state;
+
+    // Write position change or size request: queued data must reach file
+    if (st.mode == Mode::Write) {
+        const int sts = st.flushWrites();
+        if (sts < 0)
+            return sts;
+    }
+
+    // AVSEEK_FORCE is only hint for the buffered access
+    whence &= ~AVSEEK_FORCE;
+
+    int64_t position;
+    switch (whence) {
+        case AVSEEK_SIZE:
+            return st.fileSize();
+        case SEEK_SET:
+            position = offset;
+            break;
+        case SEEK_CUR:
+            position = st.position + offset;
+            break;
+        case SEEK_END:
+        {
+            const int64_t size = st.fileSize();
+            if (size < 0)
+                return size;
+            position = size + offset;
+            break;
+        }
+        default:
+            return AVERROR(EINVAL);
+    }
+
+    if (position < 0)
+        return AVERROR(EINVAL);
+
+    st.position = position;
+    return position;
+}
+
+int IoUringIO::seekable() const
+{
+    return AVIO_SEEKABLE_NORMAL;
+}
+
+const char *IoUringIO::name() const
+{
+    return m_state->path.c_str();
+}
+
+} // namespace av
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <memory>
+
+#include "ffmpeg.h"
+#include "averror.h"
+#include "avutils.h"
+#include "formatcontext.h"
+
+namespace av {
+
+/**
+ * @brief The IoUringIO class - CustomIO over the local file with asynchronous block I/O
+ *
+ * File is accessed by blocks of the fixed size, several block requests are kept in flight:
+ *  - read mode: blocks after read position are requested in advance, read() waits only when data
+ *    is not ready yet. Seek out of the requested blocks restarts read-ahead from new position.
+ *  - write mode: write() copies data into the free block and queues it when block is full, so it
+ *    waits only when all blocks are in flight. Queued writes are waited by seek() and close().
+ *
+ * On Linux requests are submitted via io_uring. When io_uring is not available (old kernel,
+ * disabled by seccomp, other systems) blocks are read and written synchronously by the
+ * pread()/pwrite() with the same buffering, see isAsync().
+ *
+ * Write errors are reported by the next write(), seek() or close() call.
+ */
+class IoUringIO : public CustomIO, public noncopyable
+{
+public:
+    enum class Mode
+    {
+        Read,
+        Write, ///< file is created or truncated
+    };
+
+    static constexpr size_t DefaultBlockSize  = 256 * 1024;
+    static constexpr size_t DefaultQueueDepth = 8;
+
+    /**
+     * @param blockSize   single request size
+     * @param queueDepth  max requests in flight
+     */
+    explicit IoUringIO(size_t blockSize = DefaultBlockSize, size_t queueDepth = DefaultQueueDepth);
+    ~IoUringIO();
+
+    void open(const std::string &path, Mode mode, OptionalErrorCode ec = throws());
+
+    /**
+     * @brief close - wait queued writes and close file
+     */
+    void close(OptionalErrorCode ec = throws());
+
+    bool isOpened() const noexcept;
+
+    /// true if io_uring is used, false for pread()/pwrite() fallback
+    bool isAsync() const noexcept;
+
+    // CustomIO
+    int         read(uint8_t *data, size_t size) override;
+    int         write(const uint8_t *data, size_t size) override;
+    int64_t     seek(int64_t offset, int whence) override;
+    int         seekable() const override;
+    const char* name() const override;
+
+private:
+    struct State;
+    std::unique_ptr<State> m_state;
+};
+
+} // namespace av
@@ -0,0 +1,285 @@
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+#if defined(__unix__) || defined(__APPLE__)
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  define AVCPP_HAS_MMAP 1
+#else
+#  define AVCPP_HAS_MMAP 0
+#endif
+
+#include "mmapio.h"
+
+extern "C" {
+#include <libavutil/buffer.h>
+}
+
+namespace {
+
+#if AVCPP_HAS_MMAP
+size_t page_size()
+{
+    static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return size;
+}
+#endif
+
+} // anonymous
+
+namespace av {
+
+struct MmapIO::Mapping
+{
+    uint8_t     *data = nullptr;
+    size_t       size = 0;
+    std::string  path;
+
+    ~Mapping()
+    {
+#if AVCPP_HAS_MMAP
+        if (data)
+            munmap(data, size);
+#endif
+    }
+};
+
+MmapIO::MmapIO() = default;
+
+MmapIO::~MmapIO()
+{
+    close();
+}
+
+void MmapIO::open(const std::string &path, Access access, OptionalErrorCode ec)
+{
+    clear_if(ec);
+    close();
+
+#if AVCPP_HAS_MMAP
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throws_if(ec, errno, std::system_category());
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        const int err = errno;
+        ::close(fd);
+        throws_if(ec, err, std::system_category());
+        return;
+    }
+
+    auto mapping  = std::make_shared<Mapping>();
+    mapping->path = path;
+    mapping->size = static_cast<size_t>(st.st_size);
+
+    // Empty file can't be mapped, it is valid input anyway
+    if (mapping->size) {
+        void *ptr = mmap(nullptr, mapping->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr == MAP_FAILED) {
+            const int err = errno;
+            ::close(fd);
+            throws_if(ec, err, std::system_category());
+            return;
+        }
+        mapping->data = static_cast<uint8_t*>(ptr);
+        madvise(ptr, mapping->size, access == Access::Sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+    }
+
+    // Mapping keeps file referenced
+    ::close(fd);
+
+    m_mapping    = std::move(mapping);
+    m_position   = 0;
+    m_advisedEnd = 0;
+    adviseReadAhead();
+#else
+    static_cast<void>(path);
+    static_cast<void>(access);
+    throws_if(ec, ENOSYS, std::system_category());
+#endif
+}
+
+void MmapIO::close()
+{
+    m_mapping.reset();
+    m_position   = 0;
+    m_advisedEnd = 0;
+}
+
+bool MmapIO::isOpened() const noexcept
+{
+    return !!m_mapping;
+}
+
+int64_t MmapIO::size() const noexcept
+{
+    return m_mapping ? static_cast<int64_t>(m_mapping->size) : 0;
+}
+
+int64_t MmapIO::position() const noexcept
+{
+    return m_position;
+}
+
+void MmapIO::setReadAhead(size_t bytes) noexcept
+{
+    m_readAhead = bytes;
+}
+
+size_t MmapIO::readAhead() const noexcept
+{
+    return m_readAhead;
+}
+
+const uint8_t *MmapIO::data() const noexcept
+{
+    return m_mapping ? m_mapping->data : nullptr;
+}
+
+Packet MmapIO::packet(int64_t offset, size_t size, OptionalErrorCode ec) const
+{
+    clear_if(ec);
+
+    if (!m_mapping) {
+        throws_if(ec, EBADF, std::system_category());
+        return Packet();
+    }
+
+    if (offset < 0 || static_cast<size_t>(offset) > m_mapping->size || size > m_mapping->size - offset) {
+        throws_if(ec, EINVAL, std::system_category());
+        return Packet();
+    }
+
+    const uint8_t *ptr = m_mapping->data + offset;
+
+    // Decoders may read padding: it must be inside mapping
+    if (size + AV_INPUT_BUFFER_PADDING_SIZE > m_mapping->size - offset)
+        return Packet(ptr, size);
+
+    // Buffer holds mapping reference
+    auto holder = new std::shared_ptr<Mapping>(m_mapping);
+    AVBufferRef *buf = av_buffer_create(const_cast<uint8_t*>(ptr), size,
+                                        [](void *opaque, uint8_t*) {
+                                            delete static_cast<std::shared_ptr<Mapping>*>(opaque);
+                                        },
+                                        holder, AV_BUFFER_FLAG_READONLY);
+    if (!buf) {
+        delete holder;
+        throws_if(ec, ENOMEM, std::system_category());
+        return Packet();
+    }
+
+    AVPacket *pkt = av_packet_alloc();
+    if (!pkt) {
+        av_buffer_unref(&buf);
+        throws_if(ec, ENOMEM, std::system_category());
+        return Packet();
+    }
+
+    pkt->buf  = buf;
+    pkt->data = buf->data;
+    pkt->size = static_cast<int>(size);
+
+    Packet result(pkt, ec);
+    av_packet_free(&pkt);
+    return result;
+}
+
+int MmapIO::read(uint8_t *data, size_t size)
+{
+    if (!m_mapping)
+        return AVERROR(EBADF);
+
+    const auto fileSize = static_cast<int64_t>(m_mapping->size);
+    if (m_position >= fileSize)
+        return AVERROR_EOF;
+
+    const auto count = static_cast<size_t>(std::min<int64_t>(static_cast<int64_t>(size), fileSize - m_position));
+    std::memcpy(data, m_mapping->data + m_position, count);
+    m_position += static_cast<int64_t>(count);
+
+    adviseReadAhead();
+
+    return static_cast<int>(count);
+}
+
+int64_t MmapIO::seek(int64_t offset, int whence)
+{
+    if (!m_mapping)
+        return AVERROR(EBADF);
+
+    const auto fileSize = static_cast<int64_t>(m_mapping->size);
+
+    // AVSEEK_FORCE is only hint for the buffered access
+    whence &= ~AVSEEK_FORCE;
+
+    int64_t position;
+    switch (whence) {
+        case AVSEEK_SIZE:
+            return fileSize;
+        case SEEK_SET:
+            position = offset;
+            break;
+        case SEEK_CUR:
+            position = m_position + offset;
+            break;
+        case SEEK_END:
+            position = fileSize + offset;
+            break;
+        default:
+            return AVERROR(EINVAL);
+    }
+
+    if (position < 0)
+        return AVERROR(EINVAL);
+
+    // Read-ahead window restarts from the new position
+    if (position < m_position || position > m_advisedEnd)
+        m_advisedEnd = position;
+
+    m_position = position;
+    adviseReadAhead();
+
+    return m_position;
+}
+
+int MmapIO::seekable() const
+{
+    return AVIO_SEEKABLE_NORMAL;
+}
+
+const char *MmapIO::name() const
+{
+    return m_mapping ? m_mapping->path.c_str() : "";
+}
+
+void MmapIO::adviseReadAhead()
+{
+#if AVCPP_HAS_MMAP
+    if (!m_mapping || !m_mapping->data || !m_readAhead)
+        return;
+
+    // Request next window when position passed half of the current one
+    const auto fileSize = static_cast<int64_t>(m_mapping->size);
+    const auto window   = static_cast<int64_t>(m_readAhead);
+    if (m_advisedEnd >= fileSize || m_advisedEnd - m_position > window / 2)
+        return;
+
+    const auto pageMask = static_cast<int64_t>(page_size()) - 1;
+    const int64_t begin = std::max(m_position, m_advisedEnd) & ~pageMask;
+    const int64_t end   = std::min(m_position + window, fileSize);
+    if (end <= begin)
+        return;
+
+    madvise(m_mapping->data + begin, static_cast<size_t>(end - begin), MADV_WILLNEED);
+    m_advisedEnd = end;
+#endif
+}
+
+} // namespace av
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <string>
+#include <memory>
+
+#include "ffmpeg.h"
+#include "averror.h"
+#include "avutils.h"
+#include "packet.h"
+#include "formatcontext.h"
+
+namespace av {
+
+/**
+ * @brief The MmapIO class - read-only CustomIO over the memory-mapped local file
+ *
+ * read() copies data straight from the mapping without system calls, seek() only moves position.
+ * Kernel is hinted with madvise(): whole mapping is marked according to the access pattern and
+ * read-ahead window after the read position is requested with MADV_WILLNEED.
+ *
+ * AVIOContext reads directly into the destination (e.g. packet payload) when requested size is
+ * bigger than its internal buffer, so open input with small buffer (RecommendedBufferSize) to
+ * skip intermediate copy for the big packets:
+ * @code
+ * MmapIO io;
+ * io.open("input.mp4");
+ * FormatContext ictx;
+ * ictx.openInput(&io, throws(), MmapIO::RecommendedBufferSize);
+ * @endcode
+ *
+ * packet() makes packet that references mapping without copying: useful for the formats where
+ * payload offsets are known (raw streams, own indexes).
+ *
+ * Mapping is kept alive while such packets exist, even after close() or destruction.
+ *
+ * Available on POSIX systems only, open() fails with ENOSYS on others.
+ */
+class MmapIO : public CustomIO, public noncopyable
+{
+public:
+    enum class Access
+    {
+        Sequential, ///< MADV_SEQUENTIAL: aggressive read-ahead, pages freed soon after access
+        Random,     ///< MADV_RANDOM: no kernel read-ahead, only own read-ahead window
+    };
+
+    static constexpr size_t DefaultReadAhead      = 4 * 1024 * 1024;
+    static constexpr size_t RecommendedBufferSize = 32 * 1024;
+
+    MmapIO();
+    ~MmapIO();
+
+    /**
+     * @brief open - map file
+     *
+     * @param path    local file
+     * @param access  access pattern hint
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     */
+    void open(const std::string &path, Access access = Access::Sequential, OptionalErrorCode ec = throws());
+    void close();
+
+    bool isOpened() const noexcept;
+
+    int64_t size() const noexcept;
+    int64_t position() const noexcept;
+
+    /// Bytes after read position requested with MADV_WILLNEED, 0 - disable
+    void setReadAhead(size_t bytes) noexcept;
+    size_t readAhead() const noexcept;
+
+    /// Mapped file data, valid until close()
+    const uint8_t* data() const noexcept;
+
+    /**
+     * @brief packet - make packet from the file range
+     *
+     * Packet references mapping when range with input padding (AV_INPUT_BUFFER_PADDING_SIZE) fits
+     * into the file, data is copied otherwise. Referenced packet is read-only: it is copied on
+     * the write access via av_packet_make_writable().
+     *
+     * @param offset  range start
+     * @param size    range size
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     * @return packet, null on error
+     */
+    Packet packet(int64_t offset, size_t size, OptionalErrorCode ec = throws()) const;
+
+    // CustomIO
+    int         read(uint8_t *data, size_t size) override;
+    int64_t     seek(int64_t offset, int whence) override;
+    int         seekable() const override;
+    const char* name() const override;
+
+private:
+    void adviseReadAhead();
+
+private:
+    struct Mapping;
+    std::shared_ptr<Mapping> m_mapping;
+
+    int64_t     m_position  = 0;
+    size_t      m_readAhead = DefaultReadAhead;
+    int64_t     m_advisedEnd = 0;
+};
+
+} // namespace av
@@ -0,0 +1,241 @@
+#include <algorithm>
+#include <cerrno>
+
+#include "avlog.h"
+#include "multidemuxer.h"
+
+namespace av {
+
+struct MultiDemuxer::Input
+{
+    explicit Input(size_t prefetchPackets)
+        : queue(prefetchPackets)
+    {
+    }
+
+    std::unique_ptr<FormatContext> format;
+    size_t                         streamOffset = 0;
+
+    SpscQueue<Packet>              queue;
+    std::thread                    thread;
+    std::error_code                error; // set by the reader before the queue is closed
+
+    Packet                         head;
+    Timestamp                      lastTs;
+};
+
+MultiDemuxer::MultiDemuxer(size_t prefetchPackets)
+    : m_prefetchPackets(std::max<size_t>(prefetchPackets, 1))
+{
+}
+
+MultiDemuxer::~MultiDemuxer()
+{
+    stop();
+}
+
+size_t MultiDemuxer::addInput(std::unique_ptr<FormatContext> input, OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    if (m_started) {
+        throws_if(ec, EBUSY, std::system_category());
+        return 0;
+    }
+
+    if (!input || !input->isOpened() || input->isOutput()) {
+        throws_if(ec, Errors::FormatNotOpened);
+        return 0;
+    }
+
+    auto entry = std::make_unique<Input>(m_prefetchPackets);
+    entry->format       = std::move(input);
+    entry->streamOffset = m_streams.size();
+
+    const size_t index = m_inputs.size();
+    for (size_t i = 0; i < entry->format->streamsCount(); ++i)
+        m_streams.push_back(StreamMapping{index, i});
+
+    m_inputs.push_back(std::move(entry));
+    return index;
+}
+
+size_t MultiDemuxer::addInput(const std::string &uri, OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    auto input = std::make_unique<FormatContext>();
+    input->openInput(uri, ec);
+    if (is_error(ec))
+        return 0;
+
+    input->findStreamInfo(ec);
+    if (is_error(ec))
+        return 0;
+
+    return addInput(std::move(input), ec);
+}
+
+size_t MultiDemuxer::inputsCount() const noexcept
+{
+    return m_inputs.size();
+}
+
+FormatContext &MultiDemuxer::input(size_t index)
+{
+    return *m_inputs.at(index)->format;
+}
+
+size_t MultiDemuxer::streamsCount() const noexcept
+{
+    return m_streams.size();
+}
+
+Stream MultiDemuxer::stream(size_t globalIndex, OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    if (globalIndex >= m_streams.size()) {
+        throws_if(ec, Errors::FormatInvalidStreamIndex);
+        return Stream();
+    }
+
+    const auto &mapping = m_streams[globalIndex];
+    return m_inputs[mapping.input]->format->stream(mapping.stream, ec);
+}
+
+MultiDemuxer::StreamMapping MultiDemuxer::streamMapping(size_t globalIndex, OptionalErrorCode ec) const
+{
+    clear_if(ec);
+
+    if (globalIndex >= m_streams.size()) {
+        throws_if(ec, Errors::FormatInvalidStreamIndex);
+        return StreamMapping{0, 0};
+    }
+
+    return m_streams[globalIndex];
+}
+
+int MultiDemuxer::globalStreamIndex(size_t input, size_t stream) const noexcept
+{
+    if (input >= m_inputs.size() || stream >= m_inputs[input]->format->streamsCount())
+        return -1;
+    return static_cast<int>(m_inputs[input]->streamOffset + stream);
+}
+
+Packet MultiDemuxer::readPacket(OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    if (!m_started)
+        start();
+
+    if (!m_errors.empty()) {
+        const auto error = m_errors.front();
+        m_errors.pop_front();
+        throws_if(ec, error.value(), error.category());
+        return Packet();
+    }
+
+    if (m_heap.empty())
+        return Packet();
+
+    std::pop_heap(m_heap.begin(), m_heap.end(), heapCompare);
+    const size_t index = m_heap.back().input;
+    m_heap.pop_back();
+
+    auto &input = *m_inputs[index];
+    Packet packet = std::move(input.head);
+    packet.setStreamIndex(static_cast<int>(input.streamOffset) + packet.streamIndex());
+
+    if (fetchHead(index))
+        pushHeap(index);
+
+    return packet;
+}
+
+void MultiDemuxer::stop()
+{
+    for (auto &input : m_inputs)
+        input->queue.close();
+
+    for (auto &input : m_inputs) {
+        if (input->thread.joinable())
+            input->thread.join();
+        input->queue.clear();
+        input->head = Packet();
+    }
+
+    m_heap.clear();
+}
+
+void MultiDemuxer::start()
+{
+    m_started = true;
+
+    for (auto &input : m_inputs) {
+        Input *ptr = input.get();
+        input->thread = std::thread([this, ptr] { readLoop(*ptr); });
+    }
+
+    // Readers work in parallel, first packets are waited one by one
+    m_heap.reserve(m_inputs.size());
+    for (size_t i = 0; i < m_inputs.size(); ++i) {
+        if (fetchHead(i))
+            pushHeap(i);
+    }
+}
+
+void MultiDemuxer::readLoop(Input &input)
+{
+    std::error_code ec;
+    while (!input.queue.isClosed()) {
+        Packet packet = input.format->readPacket(ec);
+        if (ec || !packet)
+            break;
+        if (!input.queue.push(packet))
+            break;
+    }
+
+    if (ec)
+        null_log(AV_LOG_ERROR, "Input read error: %s\n", ec.message().c_str());
+
+    input.error = ec;
+    input.queue.close();
+}
+
+bool MultiDemuxer::fetchHead(size_t index)
+{
+    auto &input = *m_inputs[index];
+    if (input.queue.pop(input.head))
+        return true;
+
+    // Called once per input after its queue is drained
+    if (input.error)
+        m_errors.push_back(input.error);
+    return false;
+}
+
+void MultiDemuxer::pushHeap(size_t index)
+{
+    auto &input = *m_inputs[index];
+
+    auto ts = input.head.ts();
+    if (ts.isNoPts())
+        ts = input.lastTs;
+    else
+        input.lastTs = ts;
+
+    m_heap.push_back(HeapItem{ts, index});
+    std::push_heap(m_heap.begin(), m_heap.end(), heapCompare);
+}
+
+bool MultiDemuxer::heapCompare(const HeapItem &left, const HeapItem &right) noexcept
+{
+    // Earliest on the top, equal timestamps are taken in the inputs order
+    if (left.ts != right.ts)
+        return left.ts > right.ts;
+    return left.input > right.input;
+}
+
+} // namespace av
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <thread>
+#include <system_error>
+
+#include "ffmpeg.h"
+#include "averror.h"
+#include "avutils.h"
+#include "packet.h"
+#include "stream.h"
+#include "timestamp.h"
+#include "spscqueue.h"
+#include "formatcontext.h"
+
+namespace av {
+
+/**
+ * @brief The MultiDemuxer class - merges packets of several inputs in the presentation order
+ *
+ * Every input is read on its own thread into the bounded queue of prefetchPackets packets. Reader
+ * keeps the next packet of every input in the min-heap ordered by Packet::ts(), so packets are
+ * returned in the global time order and every input is read only as far as needed: one queue
+ * ahead of the merge point. Packets without timestamps take the last timestamp of their input.
+ *
+ * Streams of all inputs are numbered globally in the inputs order: streams of the second input
+ * follow streams of the first one and so on. Returned packets carry global stream index, see
+ * streamMapping() for the reverse lookup.
+ *
+ * Inputs are compared by their own timestamps: use FormatContext::substractStartTime() to align
+ * recordings that start at different times.
+ *
+ * Inputs can be added until the first readPacket() call, it starts prefetching. Inputs must not be
+ * accessed directly after that.
+ */
+class MultiDemuxer : public noncopyable
+{
+public:
+    static constexpr size_t DefaultPrefetchPackets = 64;
+
+    struct StreamMapping
+    {
+        size_t input;
+        size_t stream;
+    };
+
+    /**
+     * @param prefetchPackets  packets read ahead per input
+     */
+    explicit MultiDemuxer(size_t prefetchPackets = DefaultPrefetchPackets);
+    ~MultiDemuxer();
+
+    /**
+     * @brief addInput - take ownership of the opened input
+     *
+     * @param input  opened input with found streams info, see FormatContext::findStreamInfo() and
+     *               ProbeCache
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     * @return input index
+     */
+    size_t addInput(std::unique_ptr<FormatContext> input, OptionalErrorCode ec = throws());
+
+    /**
+     * @brief addInput - open input and find streams info
+     */
+    size_t addInput(const std::string &uri, OptionalErrorCode ec = throws());
+
+    size_t         inputsCount() const noexcept;
+    FormatContext& input(size_t index);
+
+    /// Streams of all inputs
+    size_t         streamsCount() const noexcept;
+    Stream         stream(size_t globalIndex, OptionalErrorCode ec = throws());
+    StreamMapping  streamMapping(size_t globalIndex, OptionalErrorCode ec = throws()) const;
+    /// -1 if no such stream
+    int            globalStreamIndex(size_t input, size_t stream) const noexcept;
+
+    /**
+     * @brief readPacket - next packet in the presentation order of all inputs
+     *
+     * Read error of the input is reported once, when its prefetched packets are returned, other
+     * inputs can be read further. Errors of several inputs are reported by the consequent calls,
+     * one per call.
+     *
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     * @return packet with global stream index, null packet when all inputs are finished
+     */
+    Packet readPacket(OptionalErrorCode ec = throws());
+
+    /**
+     * @brief stop - stop prefetching, prefetched packets are dropped
+     *
+     * Waits for the packets being read, it is called from destructor.
+     */
+    void stop();
+
+private:
+    struct Input;
+    struct HeapItem
+    {
+        Timestamp ts;
+        size_t    input;
+    };
+
+    void start();
+    void readLoop(Input &input);
+    bool fetchHead(size_t index);
+    void pushHeap(size_t index);
+
+    static bool heapCompare(const HeapItem &left, const HeapItem &right) noexcept;
+
+private:
+    size_t                              m_prefetchPackets;
+    std::vector<std::unique_ptr<Input>> m_inputs;
+    std::vector<StreamMapping>          m_streams;
+    std::vector<HeapItem>               m_heap;
+    std::deque<std::error_code>         m_errors; // read errors of the finished inputs, not reported yet
+    bool                                m_started = false;
+};
+
+} // namespace av
@@ -0,0 +1,319 @@
+#include <algorithm>
+#include <cerrno>
+
+#include "avlog.h"
+#include "muxerqueue.h"
+
+namespace av {
+
+struct MuxerQueue::StreamQueue
+{
+    explicit StreamQueue(size_t capacity)
+        : queue(capacity)
+    {
+    }
+
+    SpscQueue<Packet> queue;
+    std::atomic<bool> finished{false};
+
+    // Writer side
+    Packet            head;
+    bool              hasHead = false;
+    bool              done    = false;
+    Timestamp         lastDts;
+};
+
+MuxerQueue::MuxerQueue(FormatContext &format, size_t queuePackets)
+    : m_format(format),
+      m_queuePackets(std::max<size_t>(queuePackets, 1))
+{
+}
+
+MuxerQueue::~MuxerQueue()
+{
+    if (m_writer.joinable())
+        cancel();
+}
+
+void MuxerQueue::setMaxInterleaveDelta(int64_t delta) noexcept
+{
+    m_maxInterleaveDelta.store(delta);
+}
+
+int64_t MuxerQueue::maxInterleaveDelta() const noexcept
+{
+    return m_maxInterleaveDelta.load();
+}
+
+void MuxerQueue::start(OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    if (m_writer.joinable()) {
+        throws_if(ec, EBUSY, std::system_category());
+        return;
+    }
+
+    if (!m_format.isOpened() || !m_format.isOutput()) {
+        throws_if(ec, Errors::FormatNotOpened);
+        return;
+    }
+
+    if (!m_format.streamsCount()) {
+        throws_if(ec, Errors::FormatNoStreams);
+        return;
+    }
+
+    m_streams.clear();
+    for (size_t i = 0; i < m_format.streamsCount(); ++i)
+        m_streams.push_back(std::make_unique<StreamQueue>(m_queuePackets));
+
+    m_heap.clear();
+    m_heap.reserve(m_streams.size());
+    m_canceled = false;
+    m_failed   = false;
+    m_error.clear();
+
+    m_writer = std::thread([this] { writeLoop(); });
+}
+
+void MuxerQueue::push(Packet packet, OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    auto reportClosed = [this, &ec] {
+        if (m_failed.load(std::memory_order_acquire))
+            throws_if(ec, m_error.value(), m_error.category());
+        else
+            throws_if(ec, EPIPE, std::system_category());
+    };
+
+    const int index = packet.streamIndex();
+    if (index < 0 || static_cast<size_t>(index) >= m_streams.size()) {
+        throws_if(ec, Errors::FormatInvalidStreamIndex);
+        return;
+    }
+
+    auto &stream = *m_streams[index];
+    if (m_failed.load(std::memory_order_acquire) || m_canceled.load() ||
+        stream.finished.load(std::memory_order_acquire)) {
+        reportClosed();
+        return;
+    }
+
+    if (!stream.queue.push(packet)) {
+        reportClosed();
+        return;
+    }
+
+    m_pushes.fetch_add(1);
+    notifyWriter();
+}
+
+void MuxerQueue::finishStream(size_t streamIndex)
+{
+    if (streamIndex >= m_streams.size())
+        return;
+
+    m_streams[streamIndex]->finished.store(true, std::memory_order_release);
+    m_pushes.fetch_add(1);
+    notifyWriter();
+}
+
+void MuxerQueue::finish(OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    if (!m_writer.joinable())
+        return;
+
+    for (auto &stream : m_streams)
+        stream->finished.store(true, std::memory_order_release);
+    m_pushes.fetch_add(1);
+    notifyWriter();
+
+    m_writer.join();
+    for (auto &stream : m_streams)
+        stream->queue.close();
+
+    if (m_failed.load(std::memory_order_acquire))
+        throws_if(ec, m_error.value(), m_error.category());
+}
+
+void MuxerQueue::cancel()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_canceled = true;
+    }
+    m_cond.notify_all();
+
+    // Wake up blocked producers
+    for (auto &stream : m_streams)
+        stream->queue.close();
+
+    if (m_writer.joinable())
+        m_writer.join();
+
+    for (auto &stream : m_streams) {
+        stream->queue.clear();
+        stream->head = Packet();
+    }
+    m_heap.clear();
+}
+
+MuxerQueue::Stats MuxerQueue::stats() const noexcept
+{
+    Stats stats;
+    stats.packetsWritten = m_packetsWritten.load();
+    stats.bytesWritten   = m_bytesWritten.load();
+    stats.forcedWrites   = m_forcedWrites.load();
+    return stats;
+}
+
+void MuxerQueue::writeLoop()
+{
+    while (!m_canceled.load()) {
+        const uint64_t seen = m_pushes.load();
+
+        size_t active    = 0;
+        bool   queueFull = false;
+        const bool hasActive = fillHeads(active, queueFull);
+
+        if (m_heap.empty()) {
+            if (!hasActive)
+                break;
+            waitPush(seen);
+            continue;
+        }
+
+        if (!canWrite(m_heap.front(), active, queueFull)) {
+            waitPush(seen);
+            continue;
+        }
+
+        const bool forced = m_heap.size() < active;
+
+        std::pop_heap(m_heap.begin(), m_heap.end(), heapCompare);
+        const auto item = m_heap.back();
+        m_heap.pop_back();
+
+        auto &stream = *m_streams[item.stream];
+        Packet packet = std::move(stream.head);
+        stream.hasHead = false;
+        if (!item.dts.isNoPts())
+            stream.lastDts = item.dts;
+
+        const size_t size = packet.size();
+        std::error_code ec;
+        m_format.writePacketDirect(packet, ec);
+        if (ec) {
+            null_log(AV_LOG_ERROR, "Can't write packet of the stream %zu: %s\n", item.stream, ec.message().c_str());
+            m_error = ec;
+            m_failed.store(true, std::memory_order_release);
+            for (auto &queue : m_streams)
+                queue->queue.close();
+            break;
+        }
+
+        ++m_packetsWritten;
+        m_bytesWritten += size;
+        if (forced)
+            ++m_forcedWrites;
+    }
+}
+
+bool MuxerQueue::fillHeads(size_t &active, bool &queueFull)
+{
+    active    = 0;
+    queueFull = false;
+
+    for (size_t i = 0; i < m_streams.size(); ++i) {
+        auto &stream = *m_streams[i];
+        if (stream.done)
+            continue;
+
+        if (!stream.hasHead) {
+            // Finish flag is checked before the last look into queue: packets pushed before it
+            // are not lost
+            const bool finished = stream.finished.load(std::memory_order_acquire);
+            if (!stream.queue.tryPop(stream.head)) {
+                if (finished) {
+                    stream.done = true;
+                    continue;
+                }
+            } else {
+                stream.hasHead = true;
+
+                auto dts = stream.head.dts();
+                if (dts.isNoPts())
+                    dts = stream.head.pts();
+                if (dts.isNoPts())
+                    dts = stream.lastDts;
+
+                m_heap.push_back(HeapItem{dts, i});
+                std::push_heap(m_heap.begin(), m_heap.end(), heapCompare);
+            }
+        }
+
+        ++active;
+        if (stream.queue.size() >= stream.queue.capacity())
+            queueFull = true;
+    }
+
+    return active > 0;
+}
+
+bool MuxerQueue::canWrite(const HeapItem &top, size_t active, bool queueFull) const
+{
+    // Every active stream has a packet: top is the earliest one
+    if (m_heap.size() == active || queueFull || top.dts.isNoPts())
+        return true;
+
+    const int64_t delta = m_maxInterleaveDelta.load();
+    if (delta <= 0)
+        return false;
+
+    const int64_t topDts = top.dts.timestamp(av::TimeBaseQ);
+    for (const auto &stream : m_streams) {
+        if (stream->done || stream->hasHead)
+            continue;
+        if (stream->lastDts.isNoPts() || topDts - stream->lastDts.timestamp(av::TimeBaseQ) <= delta)
+            return false;
+    }
+
+    return true;
+}
+
+void MuxerQueue::waitPush(uint64_t seen)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_writerWaiting.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    m_cond.wait(lock, [this, seen] {
+        return m_canceled.load() || m_pushes.load() != seen;
+    });
+    m_writerWaiting.store(false);
+}
+
+void MuxerQueue::notifyWriter()
+{
+    // Counter update and waiting flag check are sequentially consistent with waitPush()
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!m_writerWaiting.load())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+    }
+    m_cond.notify_one();
+}
+
+bool MuxerQueue::heapCompare(const HeapItem &left, const HeapItem &right) noexcept
+{
+    // Earliest on the top, equal timestamps are taken in the streams order
+    if (left.dts != right.dts)
+        return left.dts > right.dts;
+    return left.stream > right.stream;
+}
+
+} // namespace av
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <system_error>
+#include <condition_variable>
+
+#include "ffmpeg.h"
+#include "averror.h"
+#include "avutils.h"
+#include "packet.h"
+#include "timestamp.h"
+#include "spscqueue.h"
+#include "formatcontext.h"
+
+namespace av {
+
+/**
+ * @brief The MuxerQueue class - thread-safe front-end of the output FormatContext
+ *
+ * Every output stream has its own lock-free SpscQueue: encoder threads push() packets of their
+ * streams without contention, one producer per stream. Single writer thread takes the stream
+ * queue heads in the DTS order (min-heap, O(log streams) per packet) and writes them with
+ * FormatContext::writePacketDirect(), so libavformat interleaving queue is not used.
+ *
+ * Packet is written when every active stream has a packet at least as late, or when the
+ * streams that have no packets are behind it more than max interleave delta (sparse streams),
+ * or when some stream queue is full: producers are never blocked by the lagging stream forever.
+ * Last two cases are counted as forced writes, they can break strict DTS interleaving.
+ *
+ * Output must be opened with written header before start(). It must not be accessed by other
+ * threads until finish(): write trailer after it.
+ */
+class MuxerQueue : public noncopyable
+{
+public:
+    static constexpr size_t  DefaultQueuePackets       = 256;
+    static constexpr int64_t DefaultMaxInterleaveDelta = 10 * AV_TIME_BASE; ///< same as libavformat
+
+    struct Stats
+    {
+        size_t   packetsWritten = 0;
+        uint64_t bytesWritten   = 0;
+        size_t   forcedWrites   = 0;
+    };
+
+    /**
+     * @param format        opened output
+     * @param queuePackets  capacity of the every stream queue
+     */
+    explicit MuxerQueue(FormatContext &format, size_t queuePackets = DefaultQueuePackets);
+    ~MuxerQueue();
+
+    /// Max DTS distance in AV_TIME_BASE units to the stream without packets, 0 - wait it always
+    void    setMaxInterleaveDelta(int64_t delta) noexcept;
+    int64_t maxInterleaveDelta() const noexcept;
+
+    /**
+     * @brief start - create streams queues and start writer thread
+     *
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     */
+    void start(OptionalErrorCode ec = throws());
+
+    /**
+     * @brief push - queue packet of the stream packet.streamIndex(), wait while queue is full
+     *
+     * Only one thread may push packets of the single stream. Fails with writer error after it,
+     * with EPIPE after finish() or cancel().
+     */
+    void push(Packet packet, OptionalErrorCode ec = throws());
+
+    /**
+     * @brief finishStream - no more packets for the stream, writer does not wait for it anymore
+     *
+     * Called by the stream producer after the last push().
+     */
+    void finishStream(size_t streamIndex);
+
+    /**
+     * @brief finish - finish all streams, write queued packets and stop writer
+     *
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead: writer error
+     */
+    void finish(OptionalErrorCode ec = throws());
+
+    /**
+     * @brief cancel - stop writer, queued packets are dropped
+     */
+    void cancel();
+
+    Stats stats() const noexcept;
+
+private:
+    struct StreamQueue;
+    struct HeapItem
+    {
+        Timestamp dts;
+        size_t    stream;
+    };
+
+    void writeLoop();
+    bool fillHeads(size_t &active, bool &queueFull);
+    bool canWrite(const HeapItem &top, size_t active, bool queueFull) const;
+    void waitPush(uint64_t seen);
+    void notifyWriter();
+
+    static bool heapCompare(const HeapItem &left, const HeapItem &right) noexcept;
+
+private:
+    FormatContext                             &m_format;
+    const size_t                               m_queuePackets;
+    std::atomic<int64_t>                       m_maxInterleaveDelta{DefaultMaxInterleaveDelta};
+
+    std::vector<std::unique_ptr<StreamQueue>>  m_streams;
+    std::vector<HeapItem>                      m_heap;
+    std::thread                                m_writer;
+
+    std::atomic<uint64_t>                      m_pushes{0};   // state changes seen by the writer
+    std::atomic<bool>                          m_writerWaiting{false};
+    std::atomic<bool>                          m_canceled{false};
+    std::atomic<bool>                          m_failed{false};
+    std::error_code                            m_error;       // set by the writer before m_failed
+    std::mutex                                 m_mutex;
+    std::condition_variable                    m_cond;
+
+    std::atomic<size_t>                        m_packetsWritten{0};
+    std::atomic<uint64_t>                      m_bytesWritten{0};
+    std::atomic<size_t>                        m_forcedWrites{0};
+};
+
+} // namespace av
@@ -336,6 +336,14 @@ void Packet::setTimeBase(const Rational &tb)
     m_timeBase = tb;
 }
 
+void Packet::reset()
+{
+    av_packet_unref(raw());
+    raw()->stream_index = -1;
+    m_completeFlag      = false;
+    m_timeBase          = Rational(0, 0);
+}
+
 bool Packet::isReferenced() const
 {
     return raw()->buf;
@@ -95,6 +95,12 @@ public:
     const Rational& timeBase() const { return m_timeBase; }
     void setTimeBase(const Rational &value);
 
+    /**
+     * Drop payload reference and reset properties to defaults. AVPacket itself is kept, so packet
+     * object can be reused to read next packet without allocation.
+     */
+    void reset();
+
     bool     isReferenced() const;
     int      refCount() const;
 
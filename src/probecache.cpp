@@ -0,0 +1,536 @@
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "avlog.h"
+#include "probecache.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/mem.h>
+#include <libavutil/opt.h>
+}
+
+namespace {
+
+const char     EntryMagic[8] = {'A', 'V', 'C', 'P', 'P', 'R', 'B', '1'};
+const uint32_t MaxStreams     = 4096;
+const uint32_t MaxExtradata   = 64 * 1024 * 1024;
+
+uint64_t fnv1a(const void *data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+    auto ptr = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= ptr[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+std::string local_path(const std::string &uri)
+{
+    static const char prefix[] = "file:";
+    if (uri.compare(0, sizeof(prefix) - 1, prefix) == 0)
+        return uri.substr(sizeof(prefix) - 1);
+    return uri;
+}
+
+// Decoding options that differ from the defaults, "key=value" pairs
+bool changed_options(void *obj, std::string &out)
+{
+    char *buf = nullptr;
+    if (av_opt_serialize(obj, AV_OPT_FLAG_DECODING_PARAM, AV_OPT_SERIALIZE_SKIP_DEFAULTS, &buf, '=', ',') < 0)
+        return false;
+    out = buf ? buf : "";
+    av_freep(&buf);
+    return true;
+}
+
+class BlobWriter
+{
+public:
+    explicit BlobWriter(std::string &out) : m_out(out) {}
+
+    void bytes(const void *data, size_t size)
+    {
+        m_out.append(static_cast<const char*>(data), size);
+    }
+
+    template<typename T>
+    void value(T value)
+    {
+        // Enums and integers of the different width are stored uniformly
+        const int64_t stored = static_cast<int64_t>(value);
+        bytes(&stored, sizeof(stored));
+    }
+
+    void value(AVRational value)
+    {
+        this->value(value.num);
+        this->value(value.den);
+    }
+
+    void string(const std::string &value)
+    {
+        this->value(value.size());
+        bytes(value.data(), value.size());
+    }
+
+private:
+    std::string &m_out;
+};
+
+class BlobReader
+{
+public:
+    explicit BlobReader(const std::string &in) : m_in(in) {}
+
+    bool bytes(void *data, size_t size)
+    {
+        if (size > m_in.size() - m_pos)
+            return false;
+        std::memcpy(data, m_in.data() + m_pos, size);
+        m_pos += size;
+        return true;
+    }
+
+    template<typename T>
+    bool value(T &value)
+    {
+        int64_t stored;
+        if (!bytes(&stored, sizeof(stored)))
+            return false;
+        value = static_cast<T>(stored);
+        return true;
+    }
+
+    bool value(AVRational &value)
+    {
+        return this->value(value.num) && this->value(value.den);
+    }
+
+    bool string(std::string &value)
+    {
+        uint64_t size;
+        if (!this->value(size) || size > m_in.size() - m_pos)
+            return false;
+        value.assign(m_in.data() + m_pos, static_cast<size_t>(size));
+        m_pos += static_cast<size_t>(size);
+        return true;
+    }
+
+    bool atEnd() const noexcept
+    {
+        return m_pos == m_in.size();
+    }
+
+private:
+    const std::string &m_in;
+    size_t             m_pos = 0;
+};
+
+// Codec parameters fields except extradata, same order for writing and reading
+template<typename Io, typename Par>
+bool codecpar_fields(Io &io, Par *par)
+{
+    bool ok =
+        io.value(par->codec_type) &&
+        io.value(par->codec_id) &&
+        io.value(par->codec_tag) &&
+        io.value(par->format) &&
+        io.value(par->bit_rate) &&
+        io.value(par->bits_per_coded_sample) &&
+        io.value(par->bits_per_raw_sample) &&
+        io.value(par->profile) &&
+        io.value(par->level) &&
+        io.value(par->width) &&
+        io.value(par->height) &&
+        io.value(par->sample_aspect_ratio) &&
+        io.value(par->field_order) &&
+        io.value(par->color_range) &&
+        io.value(par->color_primaries) &&
+        io.value(par->color_trc) &&
+        io.value(par->color_space) &&
+        io.value(par->chroma_location) &&
+        io.value(par->video_delay) &&
+        io.value(par->sample_rate) &&
+        io.value(par->block_align) &&
+        io.value(par->frame_size) &&
+        io.value(par->initial_padding) &&
+        io.value(par->trailing_padding) &&
+        io.value(par->seek_preroll);
+    FF_DISABLE_DEPRECATION_WARNINGS
+    ok = ok &&
+        io.value(par->channel_layout) &&
+        io.value(par->channels);
+    FF_ENABLE_DEPRECATION_WARNINGS
+    return ok;
+}
+
+// Writer interface adapter: fields are passed by value
+struct WriterAdapter
+{
+    BlobWriter &writer;
+
+    template<typename T>
+    bool value(const T &value)
+    {
+        writer.value(value);
+        return true;
+    }
+};
+
+template<typename Io, typename St>
+bool stream_fields(Io &io, St *st)
+{
+    return
+        io.value(st->time_base) &&
+        io.value(st->start_time) &&
+        io.value(st->duration) &&
+        io.value(st->nb_frames) &&
+        io.value(st->r_frame_rate) &&
+        io.value(st->avg_frame_rate) &&
+        io.value(st->sample_aspect_ratio);
+}
+
+struct CodecParameters
+{
+    AVCodecParameters *par = avcodec_parameters_alloc();
+
+    ~CodecParameters()
+    {
+        avcodec_parameters_free(&par);
+    }
+};
+
+struct StreamFields
+{
+    AVRational time_base{0, 1};
+    int64_t    start_time = 0;
+    int64_t    duration   = 0;
+    int64_t    nb_frames  = 0;
+    AVRational r_frame_rate{0, 1};
+    AVRational avg_frame_rate{0, 1};
+    AVRational sample_aspect_ratio{0, 1};
+};
+
+struct StoredStream
+{
+    StreamFields    fields;
+    CodecParameters codec;
+};
+
+std::string serialize(const std::string &key, const AVFormatContext *ctx)
+{
+    std::string blob;
+    BlobWriter writer(blob);
+    WriterAdapter adapter{writer};
+
+    writer.bytes(EntryMagic, sizeof(EntryMagic));
+    writer.value(LIBAVFORMAT_VERSION_INT);
+    writer.value(LIBAVCODEC_VERSION_INT);
+    writer.string(key);
+
+    writer.value(ctx->start_time);
+    writer.value(ctx->duration);
+    writer.value(ctx->bit_rate);
+    writer.value(ctx->nb_streams);
+
+    for (unsigned i = 0; i < ctx->nb_streams; ++i) {
+        const AVStream *st = ctx->streams[i];
+        stream_fields(adapter, st);
+        codecpar_fields(adapter, st->codecpar);
+        writer.value(st->codecpar->extradata_size);
+        if (st->codecpar->extradata_size > 0)
+            writer.bytes(st->codecpar->extradata, static_cast<size_t>(st->codecpar->extradata_size));
+    }
+
+    return blob;
+}
+
+bool restore(const std::string &key, const std::string &blob, AVFormatContext *ctx)
+{
+    BlobReader reader(blob);
+
+    char magic[sizeof(EntryMagic)];
+    unsigned formatVersion = 0, codecVersion = 0;
+    std::string storedKey;
+    if (!reader.bytes(magic, sizeof(magic)) || std::memcmp(magic, EntryMagic, sizeof(magic)) != 0 ||
+        !reader.value(formatVersion) || formatVersion != LIBAVFORMAT_VERSION_INT ||
+        !reader.value(codecVersion) || codecVersion != LIBAVCODEC_VERSION_INT ||
+        !reader.string(storedKey) || storedKey != key)
+        return false;
+
+    int64_t  startTime, duration, bitRate;
+    uint32_t streamsCount;
+    if (!reader.value(startTime) || !reader.value(duration) || !reader.value(bitRate) ||
+        !reader.value(streamsCount) || streamsCount > MaxStreams || streamsCount != ctx->nb_streams)
+        return false;
+
+    // Whole entry is validated before the context is touched
+    std::vector<StoredStream> streams(streamsCount);
+    for (uint32_t i = 0; i < streamsCount; ++i) {
+        auto &stored = streams[i];
+        AVCodecParameters *par = stored.codec.par;
+        uint32_t extradataSize;
+        if (!par || !stream_fields(reader, &stored.fields) || !codecpar_fields(reader, par) ||
+            !reader.value(extradataSize) || extradataSize > MaxExtradata)
+            return false;
+
+        if (extradataSize) {
+            par->extradata = static_cast<uint8_t*>(av_mallocz(extradataSize + AV_INPUT_BUFFER_PADDING_SIZE));
+            if (!par->extradata)
+                return false;
+            par->extradata_size = static_cast<int>(extradataSize);
+            if (!reader.bytes(par->extradata, extradataSize))
+                return false;
+        }
+
+        // Demuxer must create the same stream, parameters it does not know yet are accepted
+        const AVCodecParameters *current = ctx->streams[i]->codecpar;
+        if ((current->codec_type != AVMEDIA_TYPE_UNKNOWN && current->codec_type != par->codec_type) ||
+            (current->codec_id != AV_CODEC_ID_NONE && current->codec_id != par->codec_id))
+            return false;
+    }
+
+    if (!reader.atEnd())
+        return false;
+
+    for (uint32_t i = 0; i < streamsCount; ++i) {
+        AVStream *st = ctx->streams[i];
+        if (avcodec_parameters_copy(st->codecpar, streams[i].codec.par) < 0)
+            return false;
+#if !USE_CODECPAR
+        FF_DISABLE_DEPRECATION_WARNINGS
+        avcodec_parameters_to_context(st->codec, st->codecpar);
+        FF_ENABLE_DEPRECATION_WARNINGS
+#endif
+        const auto &fields = streams[i].fields;
+        st->time_base           = fields.time_base;
+        st->start_time          = fields.start_time;
+        st->duration            = fields.duration;
+        st->nb_frames           = fields.nb_frames;
+        st->r_frame_rate        = fields.r_frame_rate;
+        st->avg_frame_rate      = fields.avg_frame_rate;
+        st->sample_aspect_ratio = fields.sample_aspect_ratio;
+    }
+
+    ctx->start_time = startTime;
+    ctx->duration   = duration;
+    ctx->bit_rate   = bitRate;
+    return true;
+}
+
+} // anonymous
+
+namespace av {
+
+ProbeCache::ProbeCache(size_t maxEntries)
+    : m_maxEntries(maxEntries)
+{
+}
+
+void ProbeCache::setDirectory(const std::string &directory)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_directory = directory;
+}
+
+std::string ProbeCache::directory() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_directory;
+}
+
+bool ProbeCache::findStreamInfo(FormatContext &format, OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    AVFormatContext *ctx = format.raw();
+    if (!ctx || !format.isOpened() || format.isOutput()) {
+        format.findStreamInfo(ec);
+        return false;
+    }
+
+    const std::string key = makeKey(format);
+
+    std::string blob;
+    if (!key.empty() && lookup(key, blob) && restore(key, blob, ctx)) {
+        format.m_streamsInfoFound = true;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_stats.hits;
+        return true;
+    }
+
+    const unsigned headerStreams = ctx->nb_streams;
+    format.findStreamInfo(ec);
+    if (is_error(ec))
+        return false;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_stats.misses;
+    }
+
+    // Streams found while probing would be absent on the next open: entry is useless
+    if (!key.empty() && ctx->nb_streams == headerStreams)
+        store(key, serialize(key, ctx));
+
+    return false;
+}
+
+void ProbeCache::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.clear();
+    m_order.clear();
+}
+
+size_t ProbeCache::size() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_entries.size();
+}
+
+ProbeCache::Stats ProbeCache::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+std::string ProbeCache::makeKey(const FormatContext &format) const
+{
+    const AVFormatContext *ctx = format.raw();
+    const std::string path = local_path(format.m_uri);
+    if (path.empty() || !ctx->iformat)
+        return std::string();
+
+    // Demuxer and its options define streams info as well as the file content
+    std::string options;
+    std::string privateOptions;
+    if (!changed_options(const_cast<AVFormatContext*>(ctx), options) ||
+        (ctx->iformat->priv_class && ctx->priv_data && !changed_options(ctx->priv_data, privateOptions)))
+        return std::string();
+
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        return std::string();
+
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return std::string();
+
+    std::vector<char> header(HeaderHashSize);
+    in.read(header.data(), static_cast<std::streamsize>(header.size()));
+    const auto headerSize = static_cast<size_t>(in.gcount());
+
+    options += '|';
+    options += privateOptions;
+
+    char suffix[96];
+    std::snprintf(suffix, sizeof(suffix), "|%llu|%lld|%016llx|%016llx",
+                  static_cast<unsigned long long>(st.st_size),
+                  static_cast<long long>(st.st_mtime),
+                  static_cast<unsigned long long>(fnv1a(header.data(), headerSize)),
+                  static_cast<unsigned long long>(fnv1a(options.data(), options.size())));
+
+    return format.m_uri + "|" + ctx->iformat->name + suffix;
+}
+
+bool ProbeCache::lookup(const std::string &key, std::string &blob)
+{
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_entries.find(key);
+        if (it != m_entries.end()) {
+            blob = it->second;
+            return true;
+        }
+        if (m_directory.empty())
+            return false;
+        path = entryPath(key);
+    }
+
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+
+    blob.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    if (blob.empty())
+        return false;
+
+    // Entry is validated by restore(), memory copy is replaced by store() if it is stale
+    std::lock_guard<std::mutex> lock(m_mutex);
+    insert(key, blob);
+    return true;
+}
+
+void ProbeCache::store(const std::string &key, std::string blob)
+{
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_directory.empty())
+            path = entryPath(key);
+        insert(key, blob);
+    }
+
+    if (path.empty())
+        return;
+
+    // Concurrent writers of the same entry use own temporary files, rename is atomic
+    char suffix[32];
+    std::snprintf(suffix, sizeof(suffix), ".%zx.tmp", std::hash<std::thread::id>()(std::this_thread::get_id()));
+    const std::string tmpPath = path + suffix;
+    {
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!out || !out.write(blob.data(), static_cast<std::streamsize>(blob.size())) || !out.flush()) {
+            null_log(AV_LOG_WARNING, "Can't write probe cache entry %s\n", tmpPath.c_str());
+            out.close();
+            std::remove(tmpPath.c_str());
+            return;
+        }
+    }
+
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        null_log(AV_LOG_WARNING, "Can't write probe cache entry %s: %s\n", path.c_str(), std::strerror(errno));
+        std::remove(tmpPath.c_str());
+    }
+}
+
+void ProbeCache::insert(const std::string &key, const std::string &blob)
+{
+    if (!m_maxEntries)
+        return;
+
+    auto it = m_entries.find(key);
+    if (it != m_entries.end()) {
+        it->second = blob;
+        return;
+    }
+
+    while (m_entries.size() >= m_maxEntries && !m_order.empty()) {
+        m_entries.erase(m_order.front());
+        m_order.pop_front();
+    }
+    m_entries.emplace(key, blob);
+    m_order.push_back(key);
+}
+
+std::string ProbeCache::entryPath(const std::string &key) const
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.avprobe",
+                  static_cast<unsigned long long>(fnv1a(key.data(), key.size())));
+    return m_directory + "/" + name;
+}
+
+} // namespace av
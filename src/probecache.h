@@ -0,0 +1,94 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "ffmpeg.h"
+#include "averror.h"
+#include "avutils.h"
+#include "formatcontext.h"
+
+namespace av {
+
+/**
+ * @brief The ProbeCache class - cache of the FormatContext::findStreamInfo() results
+ *
+ * avformat_find_stream_info() reads and decodes the beginning of the input to fill codec
+ * parameters: tens of milliseconds for MP4, hundreds for MPEG-TS. For the inputs that are opened
+ * again and again the result is stored once and restored on the next open without probing:
+ * codec parameters (with extradata), time base, start time, duration and frame rates of every
+ * stream, start time, duration and bit rate of the container.
+ *
+ * Entry key is the input URI, demuxer name, hash of the demuxer options that differ from the
+ * defaults, file size, modification time and hash of the first HeaderHashSize bytes. Only local
+ * files are cached: other inputs are always probed. Entry is applied only if demuxer created the
+ * same streams with the same codecs after openInput(), otherwise input is probed and entry
+ * replaced. Demuxers that create streams while reading (AVFMTCTX_NOHEADER) are cached only when
+ * all streams present in the header.
+ *
+ * Entries are kept in memory, up to maxEntries, oldest are dropped first, entries read from the
+ * directory included. When directory is set, entries are also stored there, one file per key, and
+ * survive process restart. Files use native byte order and are rejected when produced by other
+ * libavformat version.
+ *
+ * Class is thread-safe: single cache can be shared by all the threads that open inputs.
+ */
+class ProbeCache : public noncopyable
+{
+public:
+    static constexpr size_t DefaultMaxEntries = 4096;
+    static constexpr size_t HeaderHashSize    = 64 * 1024;
+
+    struct Stats
+    {
+        size_t hits   = 0; ///< inputs restored from the cache
+        size_t misses = 0; ///< inputs probed
+    };
+
+    explicit ProbeCache(size_t maxEntries = DefaultMaxEntries);
+
+    /**
+     * @brief setDirectory - persistent storage location, empty - memory only
+     *
+     * Directory must exist. Failures of the storage are not reported: input is probed instead.
+     */
+    void setDirectory(const std::string &directory);
+    std::string directory() const;
+
+    /**
+     * @brief findStreamInfo - restore streams info of the opened input or probe and store it
+     *
+     * Replacement of the FormatContext::findStreamInfo() call after openInput().
+     *
+     * @param format  opened input
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     * @return true if streams info restored from the cache
+     */
+    bool findStreamInfo(FormatContext &format, OptionalErrorCode ec = throws());
+
+    /// Drop memory entries, files in the directory are kept
+    void   clear();
+    size_t size() const;
+    Stats  stats() const;
+
+private:
+    std::string makeKey(const FormatContext &format) const;
+    bool        lookup(const std::string &key, std::string &blob);
+    void        store(const std::string &key, std::string blob);
+    // Memory entry up to maxEntries, m_mutex must be held
+    void        insert(const std::string &key, const std::string &blob);
+    std::string entryPath(const std::string &key) const;
+
+private:
+    mutable std::mutex                           m_mutex;
+    size_t                                       m_maxEntries;
+    std::string                                  m_directory;
+    std::unordered_map<std::string, std::string> m_entries;
+    std::deque<std::string>                      m_order;
+    Stats                                        m_stats;
+};
+
+} // namespace av
@@ -0,0 +1,322 @@
+#include <cstdio>
+#include <algorithm>
+
+#include "avlog.h"
+#include "packet.h"
+#include "codeccontext.h"
+#include "remuxengine.h"
+
+namespace av {
+
+struct RemuxEngine::JobState
+{
+    size_t                                index = 0;
+    Job                                   job;
+    std::atomic<bool>                     canceled{false};
+    std::atomic<size_t>                   packets{0};
+    std::atomic<uint64_t>                 bytes{0};
+    bool                                  outputOpened = false; // set and read by the worker only
+    bool                                  interrupted  = false; // I/O interrupted by cancel, worker only
+
+    // Guarded by the engine mutex
+    State                                 state = State::Queued;
+    std::error_code                       error;
+    std::chrono::steady_clock::time_point started;
+    std::chrono::steady_clock::time_point finished;
+};
+
+RemuxEngine::RemuxEngine(size_t threads)
+{
+    if (!threads)
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    for (size_t i = 0; i < threads; ++i)
+        m_workers.emplace_back([this] { workerLoop(); });
+}
+
+RemuxEngine::~RemuxEngine()
+{
+    cancelAll();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cond.notify_all();
+
+    for (auto &worker : m_workers)
+        worker.join();
+}
+
+void RemuxEngine::setJobFinishedCallback(JobFinished callback)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_jobFinished = std::move(callback);
+}
+
+size_t RemuxEngine::addJob(const Job &job)
+{
+    auto state = std::make_unique<JobState>();
+    state->job = job;
+
+    size_t index;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        index = state->index = m_jobs.size();
+        m_jobs.push_back(std::move(state));
+    }
+    m_cond.notify_all();
+    return index;
+}
+
+size_t RemuxEngine::addJob(const std::string &input, const std::string &output)
+{
+    Job job;
+    job.input  = input;
+    job.output = output;
+    return addJob(job);
+}
+
+size_t RemuxEngine::jobsCount() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_jobs.size();
+}
+
+RemuxEngine::Job RemuxEngine::job(size_t index) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return index < m_jobs.size() ? m_jobs[index]->job : Job();
+}
+
+RemuxEngine::JobStats RemuxEngine::stats(size_t index) const
+{
+    JobStats stats;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (index >= m_jobs.size())
+        return stats;
+
+    const auto &state = *m_jobs[index];
+    stats.state   = state.state;
+    stats.packets = state.packets.load();
+    stats.bytes   = state.bytes.load();
+    stats.error   = state.error;
+
+    if (state.state != State::Queued) {
+        const auto end = state.state == State::Running ? std::chrono::steady_clock::now() : state.finished;
+        stats.seconds = std::chrono::duration<double>(end - state.started).count();
+    }
+
+    return stats;
+}
+
+void RemuxEngine::cancel(size_t index)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (index < m_jobs.size())
+        m_jobs[index]->canceled = true;
+}
+
+void RemuxEngine::cancelAll()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto &state : m_jobs)
+        state->canceled = true;
+}
+
+void RemuxEngine::wait()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cond.wait(lock, [this] { return m_finished == m_jobs.size(); });
+}
+
+void RemuxEngine::workerLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_cond.wait(lock, [this] { return m_stop || m_nextJob < m_jobs.size(); });
+        if (m_nextJob >= m_jobs.size())
+            return;
+
+        // Jobs are never removed: reference stays valid while the engine lives
+        auto &state = *m_jobs[m_nextJob++];
+        lock.unlock();
+        run(state);
+        lock.lock();
+    }
+}
+
+void RemuxEngine::run(JobState &state)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        state.started = std::chrono::steady_clock::now();
+        state.state   = state.canceled ? State::Canceled : State::Running;
+    }
+
+    // Cancel request that came after the job finished its I/O does not change the result
+    std::error_code ec;
+    bool canceled = state.canceled;
+    if (!canceled) {
+        remux(state, ec);
+        canceled = state.interrupted;
+    }
+
+    JobFinished callback;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        state.finished = std::chrono::steady_clock::now();
+        // Interrupted I/O reports its own error: cancel request takes precedence
+        if (canceled)
+            state.state = State::Canceled;
+        else
+            state.state = ec ? State::Failed : State::Done;
+        state.error = state.state == State::Failed ? ec : std::error_code();
+        callback    = m_jobFinished;
+    }
+
+    // Output path may belong to someone else until the job opens it
+    if (state.state != State::Done && state.outputOpened)
+        std::remove(state.job.output.c_str());
+
+    if (state.state == State::Failed) {
+        null_log(AV_LOG_ERROR, "Remux '%s' -> '%s' failed: %s\n",
+                 state.job.input.c_str(), state.job.output.c_str(), ec.message().c_str());
+    }
+
+    if (callback)
+        callback(state.index, stats(state.index));
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_finished;
+    }
+    m_cond.notify_all();
+}
+
+void RemuxEngine::remux(JobState &state, OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    const auto &job = state.job;
+    auto interrupt = [&state] {
+        if (!state.canceled.load())
+            return 0;
+        state.interrupted = true;
+        return 1;
+    };
+
+    //
+    // INPUT
+    //
+    FormatContext ictx;
+    ictx.setInterruptCallback(interrupt);
+
+    ictx.openInput(job.input, InputFormat(job.inputFormat), ec);
+    if (is_error(ec))
+        return;
+
+    ictx.findStreamInfo(ec);
+    if (is_error(ec))
+        return;
+
+    //
+    // OUTPUT
+    //
+    OutputFormat oformat(job.outputFormat, job.output);
+    if (oformat.isNull()) {
+        throws_if(ec, Errors::FormatNullOutputFormat);
+        return;
+    }
+
+    FormatContext octx;
+    octx.setInterruptCallback(interrupt);
+    octx.setFormat(oformat);
+
+    // Input stream index -> output stream index, -1 - skipped
+    std::vector<int> streamMapping(ictx.streamsCount(), -1);
+    int ostIdx = 0;
+
+    for (size_t i = 0; i < ictx.streamsCount(); ++i) {
+        auto ist    = ictx.stream(i);
+        auto icoder = GenericCodecContext(ist);
+
+        if (!oformat.codecSupported(icoder.codec())) {
+            null_log(AV_LOG_INFO, "%s: stream %zu codec '%s' is not supported by the output format '%s', skipped\n",
+                     job.input.c_str(), i, avcodec_get_name(icoder.raw()->codec_id), oformat.name());
+            continue;
+        }
+
+        std::error_code err;
+        auto ost = octx.addStream(icoder.codec(), err);
+        if (err == Errors::FormatCodecUnsupported) {
+            continue;
+        } else if (err) {
+            throws_if(ec, err.value(), err.category());
+            return;
+        }
+
+        ost.setTimeBase(ist.timeBase());
+
+        auto ocoder = GenericCodecContext(ost);
+        ocoder.copyContextFrom(icoder, ec);
+        if (is_error(ec))
+            return;
+
+#if USE_CODECPAR
+        // Copy goes to the codec context only: muxer takes parameters from the stream
+        avcodec_parameters_from_context(ost.raw()->codecpar, ocoder.raw());
+        ost.raw()->codecpar->codec_tag = 0;
+#endif
+
+        streamMapping[i] = ostIdx++;
+    }
+
+    if (!ostIdx) {
+        throws_if(ec, Errors::FormatNoStreams);
+        return;
+    }
+
+    octx.openOutput(job.output, ec);
+    if (is_error(ec))
+        return;
+    state.outputOpened = true;
+
+    octx.writeHeader(ec);
+    if (is_error(ec))
+        return;
+
+    //
+    // PROCESS
+    //
+    for (;;) {
+        auto pkt = ictx.readPacket(ec);
+        if (is_error(ec))
+            return;
+        if (!pkt)
+            break;
+
+        const int index = pkt.streamIndex();
+        if (index < 0 || static_cast<size_t>(index) >= streamMapping.size() || streamMapping[index] < 0)
+            continue;
+
+        const size_t size = pkt.size();
+        pkt.setStreamIndex(streamMapping[index]);
+
+        octx.writePacket(pkt, ec);
+        if (is_error(ec))
+            return;
+
+        ++state.packets;
+        state.bytes += size;
+    }
+
+    // Flush output context
+    octx.writePacket(ec);
+    if (is_error(ec))
+        return;
+
+    octx.writeTrailer(ec);
+}
+
+} // namespace av
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <mutex>
+#include <deque>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <system_error>
+#include <condition_variable>
+
+#include "ffmpeg.h"
+#include "averror.h"
+#include "avutils.h"
+#include "format.h"
+#include "formatcontext.h"
+
+namespace av {
+
+/**
+ * @brief The RemuxEngine class - stream copy of many files on the fixed thread pool
+ *
+ * Every job copies streams of the single input to the single output in its own pair of
+ * FormatContext objects, like a separate remux process does, but probing libraries, threads and
+ * the process itself are reused across jobs. Streams with codecs not supported by the output
+ * format are skipped.
+ *
+ * Jobs are started as soon as a worker is free, in the order they are added. Job is canceled
+ * through the FormatContext interrupt callback, so blocked I/O is interrupted too; job that
+ * completed its I/O before the callback fired is done. Output of the failed or canceled job is
+ * removed if the job opened it: existing file is kept when job fails before the output is opened
+ * or is canceled while queued.
+ *
+ * Job finished callback is called from the worker threads.
+ */
+class RemuxEngine : public noncopyable
+{
+public:
+    enum class State
+    {
+        Queued,
+        Running,
+        Done,
+        Failed,
+        Canceled,
+    };
+
+    struct Job
+    {
+        std::string input;
+        std::string output;
+        std::string inputFormat;  ///< empty - probe
+        std::string outputFormat; ///< empty - guess by the output name
+    };
+
+    struct JobStats
+    {
+        State           state   = State::Queued;
+        size_t          packets = 0;  ///< packets written
+        uint64_t        bytes   = 0;  ///< payload bytes written
+        double          seconds = 0;  ///< wall time of the job, grows while job is running
+        std::error_code error;
+
+        double packetsPerSecond() const noexcept { return seconds > 0 ? packets / seconds : 0; }
+        double bytesPerSecond()   const noexcept { return seconds > 0 ? bytes / seconds : 0; }
+    };
+
+    using JobFinished = std::function<void(size_t job, const JobStats &stats)>;
+
+    /**
+     * @param threads  worker threads, 0 - hardware concurrency
+     */
+    explicit RemuxEngine(size_t threads = 0);
+    /// Cancels not finished jobs
+    ~RemuxEngine();
+
+    /// Set before adding jobs
+    void setJobFinishedCallback(JobFinished callback);
+
+    /**
+     * @brief addJob - queue the job
+     * @return job index
+     */
+    size_t addJob(const Job &job);
+    size_t addJob(const std::string &input, const std::string &output);
+
+    size_t   jobsCount() const;
+    Job      job(size_t index) const;
+    JobStats stats(size_t index) const;
+
+    /// Queued job is not started, running one is interrupted
+    void cancel(size_t index);
+    void cancelAll();
+
+    /// Wait until all added jobs are finished
+    void wait();
+
+private:
+    struct JobState;
+
+    void workerLoop();
+    void run(JobState &state);
+    void remux(JobState &state, OptionalErrorCode ec);
+
+private:
+    mutable std::mutex                     m_mutex;
+    std::condition_variable                m_cond;
+    std::deque<std::unique_ptr<JobState>>  m_jobs;
+    size_t                                 m_nextJob  = 0;
+    size_t                                 m_finished = 0;
+    bool                                   m_stop     = false;
+    JobFinished                            m_jobFinished;
+    std::vector<std::thread>               m_workers;
+};
+
+} // namespace av
@@ -0,0 +1,222 @@
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstring>
+
+#include "ringbufferio.h"
+
+namespace {
+
+// Interrupt callback poll period while waiting
+const auto InterruptPollInterval = std::chrono::milliseconds(10);
+
+} // anonymous
+
+namespace av {
+
+RingBufferIO::RingBufferIO(size_t capacity, Policy policy)
+    : m_buffer(std::max<size_t>(capacity, 1)),
+      m_policy(policy),
+      m_interrupted(std::make_shared<std::atomic_bool>(false))
+{
+    m_stats.capacity = m_buffer.size();
+}
+
+RingBufferIO::~RingBufferIO()
+{
+    interrupt();
+}
+
+size_t RingBufferIO::capacity() const noexcept
+{
+    return m_buffer.size();
+}
+
+RingBufferIO::Policy RingBufferIO::policy() const noexcept
+{
+    return m_policy;
+}
+
+void RingBufferIO::setDropAlignment(size_t bytes) noexcept
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_dropAlignment = std::max<size_t>(bytes, 1);
+}
+
+size_t RingBufferIO::dropAlignment() const noexcept
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_dropAlignment;
+}
+
+void RingBufferIO::setInterruptCallback(const AvioInterruptCb &cb)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_interruptCb = cb;
+}
+
+AvioInterruptCb RingBufferIO::interruptCallback()
+{
+    // Flag is shared: callback stays valid if it outlives the buffer
+    auto interrupted = m_interrupted;
+    return [interrupted]() -> int {
+        return interrupted->load(std::memory_order_acquire) ? 1 : 0;
+    };
+}
+
+size_t RingBufferIO::push(const uint8_t *data, size_t size)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    const size_t cap = m_buffer.size();
+    size_t accepted = 0;
+    while (accepted < size) {
+        if (m_finished || checkInterrupt())
+            break;
+
+        const size_t remaining = size - accepted;
+        if (m_policy == Policy::DropOldest && cap - m_size < remaining)
+            drop(std::min(remaining, cap) - (cap - m_size));
+
+        const size_t space = cap - m_size;
+        if (space == 0) {
+            ++m_stats.producerWaits;
+            wait(lock, [this, cap] { return m_size < cap || m_finished; });
+            continue;
+        }
+
+        const size_t count = std::min(space, remaining);
+        const size_t tail  = (m_head + m_size) % cap;
+        const size_t first = std::min(count, cap - tail);
+        std::memcpy(m_buffer.data() + tail, data + accepted, first);
+        std::memcpy(m_buffer.data(), data + accepted + first, count - first);
+
+        m_size   += count;
+        accepted += count;
+
+        m_stats.bytesPushed += count;
+        m_stats.peakSize     = std::max(m_stats.peakSize, m_size);
+        m_cond.notify_all();
+    }
+
+    return accepted;
+}
+
+void RingBufferIO::finish()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_finished = true;
+    }
+    m_cond.notify_all();
+}
+
+void RingBufferIO::interrupt()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_interrupted->store(true, std::memory_order_release);
+    }
+    m_cond.notify_all();
+}
+
+bool RingBufferIO::isInterrupted() const noexcept
+{
+    return m_interrupted->load(std::memory_order_acquire);
+}
+
+void RingBufferIO::reset()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_head     = 0;
+    m_size     = 0;
+    m_finished = false;
+    m_interrupted->store(false, std::memory_order_release);
+    m_stats          = Stats();
+    m_stats.capacity = m_buffer.size();
+}
+
+RingBufferIO::Stats RingBufferIO::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto result = m_stats;
+    result.size = m_size;
+    return result;
+}
+
+int RingBufferIO::read(uint8_t *data, size_t size)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (m_size == 0) {
+        if (checkInterrupt())
+            return AVERROR_EXIT;
+        if (m_finished)
+            return AVERROR_EOF;
+
+        ++m_stats.readerWaits;
+        wait(lock, [this] { return m_size > 0 || m_finished; });
+    }
+
+    if (checkInterrupt())
+        return AVERROR_EXIT;
+
+    const size_t cap   = m_buffer.size();
+    const size_t count = std::min(std::min(size, m_size), static_cast<size_t>(INT_MAX));
+    const size_t first = std::min(count, cap - m_head);
+    std::memcpy(data, m_buffer.data() + m_head, first);
+    std::memcpy(data + first, m_buffer.data(), count - first);
+
+    m_head  = (m_head + count) % cap;
+    m_size -= count;
+
+    m_stats.bytesRead += count;
+    m_cond.notify_all();
+
+    return static_cast<int>(count);
+}
+
+const char *RingBufferIO::name() const
+{
+    return "ringbuffer";
+}
+
+bool RingBufferIO::checkInterrupt()
+{
+    if (m_interrupted->load(std::memory_order_acquire))
+        return true;
+
+    if (m_interruptCb && m_interruptCb()) {
+        m_interrupted->store(true, std::memory_order_release);
+        m_cond.notify_all();
+        return true;
+    }
+
+    return false;
+}
+
+template<typename Predicate>
+void RingBufferIO::wait(std::unique_lock<std::mutex> &lock, Predicate &&ready)
+{
+    auto wakeup = [&] {
+        return m_interrupted->load(std::memory_order_acquire) || ready();
+    };
+
+    // External callback can't notify: it is polled
+    if (m_interruptCb)
+        m_cond.wait_for(lock, InterruptPollInterval, wakeup);
+    else
+        m_cond.wait(lock, wakeup);
+}
+
+void RingBufferIO::drop(size_t size)
+{
+    size = std::min((size + m_dropAlignment - 1) / m_dropAlignment * m_dropAlignment, m_size);
+
+    m_head  = (m_head + size) % m_buffer.size();
+    m_size -= size;
+
+    m_stats.bytesDropped += size;
+}
+
+} // namespace av
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <vector>
+#include <condition_variable>
+
+#include "ffmpeg.h"
+#include "avutils.h"
+#include "formatcontext.h"
+
+namespace av {
+
+/**
+ * @brief The RingBufferIO class - in-memory byte FIFO between live producers and the demuxer
+ *
+ * Producer threads push() bytes (capture card, socket, ...), FormatContext::openInput() consumes
+ * them through read(), that waits for data. Input is not seekable: use formats that can be read
+ * sequentially (MPEG-TS, FLV, raw streams, fragmented MP4).
+ *
+ * When the buffer is full, producer waits for the reader (Policy::Block) or the oldest bytes are
+ * dropped (Policy::DropOldest). Dropped amount is rounded up to the drop alignment, so stream
+ * stays aligned to the packets of the fixed size (188 for MPEG-TS) if producer pushes whole
+ * packets.
+ *
+ * Waiting sides are woken up by:
+ *  - finish(): read() returns remaining data and EOF after it;
+ *  - interrupt(): read() returns AVERROR_EXIT, push() rejects data. Pass interruptCallback() to
+ *    FormatContext::setInterruptCallback() to abort the demuxer too;
+ *  - callback from setInterruptCallback(): it is polled while read() and push() wait, so the same
+ *    callback can be set to the FormatContext and here.
+ */
+class RingBufferIO : public CustomIO, public noncopyable
+{
+public:
+    enum class Policy
+    {
+        Block,
+        DropOldest,
+    };
+
+    struct Stats
+    {
+        size_t   capacity      = 0;
+        size_t   size          = 0; ///< bytes buffered now
+        size_t   peakSize      = 0; ///< max bytes buffered
+        uint64_t bytesPushed   = 0;
+        uint64_t bytesRead     = 0;
+        uint64_t bytesDropped  = 0;
+        uint64_t producerWaits = 0; ///< times producer waited for space
+        uint64_t readerWaits   = 0; ///< times reader waited for data
+    };
+
+    static constexpr size_t DefaultCapacity = 4 * 1024 * 1024;
+
+    explicit RingBufferIO(size_t capacity = DefaultCapacity, Policy policy = Policy::Block);
+    ~RingBufferIO();
+
+    size_t capacity() const noexcept;
+    Policy policy() const noexcept;
+
+    /// Policy::DropOldest drops multiple of this size, 1 by default
+    void   setDropAlignment(size_t bytes) noexcept;
+    size_t dropAlignment() const noexcept;
+
+    /// Polled while read() and push() wait, non-zero result interrupts them
+    void setInterruptCallback(const AvioInterruptCb &cb);
+
+    /**
+     * @brief interruptCallback - callback for FormatContext::setInterruptCallback()
+     * @return callable that returns 1 after interrupt()
+     */
+    AvioInterruptCb interruptCallback();
+
+    /**
+     * @brief push - append data, producer side, thread-safe
+     * @return bytes accepted: less than size only if buffer finished or interrupted
+     */
+    size_t push(const uint8_t *data, size_t size);
+
+    /**
+     * @brief finish - end of the stream, reader gets EOF after the buffered data
+     */
+    void finish();
+
+    /**
+     * @brief interrupt - abort waiting reader and producers
+     */
+    void interrupt();
+    bool isInterrupted() const noexcept;
+
+    /**
+     * @brief reset - drop buffered data, clear finished and interrupted state and stats
+     *
+     * Must not be called while producers or reader are active.
+     */
+    void reset();
+
+    Stats stats() const;
+
+    // CustomIO
+    int         read(uint8_t *data, size_t size) override;
+    const char* name() const override;
+
+private:
+    bool        checkInterrupt();
+    template<typename Predicate>
+    void        wait(std::unique_lock<std::mutex> &lock, Predicate &&ready);
+    void        drop(size_t size);
+
+private:
+    std::vector<uint8_t>              m_buffer;
+    const Policy                      m_policy;
+    size_t                            m_dropAlignment = 1;
+
+    mutable std::mutex                m_mutex;
+    std::condition_variable           m_cond;
+    size_t                            m_head = 0; // read position
+    size_t                            m_size = 0;
+    bool                              m_finished = false;
+    std::shared_ptr<std::atomic_bool> m_interrupted;
+    AvioInterruptCb                   m_interruptCb;
+    Stats                             m_stats;
+};
+
+} // namespace av
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <cstdint>
+
+#include "ffmpeg.h"
+#include "averror.h"
+#include "packet.h"
+#include "frame.h"
+#include "timestamp.h"
+#include "formatcontext.h"
+#include "codeccontext.h"
+
+namespace av {
+
+/**
+ * @brief The SeekableDecoder class - frame-accurate seeking of the single stream
+ *
+ * Demuxer is seeked to the keyframe before target, decoder is reset with
+ * CodecContext2::flushBuffers() (opened decoder is reused, not recreated) and frames are decoded
+ * forward: ones that are shown before the target are discarded. Result is the frame displayed at
+ * the target time: last frame with PTS not greater than target.
+ *
+ * After seek() decoding continues with nextFrame(). Packets of the other streams are dropped.
+ *
+ * Format and decoder are not owned and must outlive this object. Target is in the stream
+ * timeline as passed to the FormatContext::seek(), so FormatContext::substractStartTime() must
+ * be disabled.
+ */
+template<typename Decoder>
+class SeekableDecoder : public noncopyable
+{
+public:
+    using FrameType = typename DecoderFrameType<Decoder>::type;
+
+    /**
+     * @param format   opened input
+     * @param decoder  opened decoder of the one of the input streams
+     */
+    SeekableDecoder(FormatContext &format, Decoder &decoder)
+        : m_format(format),
+          m_decoder(decoder),
+          m_streamIndex(decoder.stream().index()),
+          m_timeBase(decoder.stream().timeBase())
+    {
+    }
+
+    int streamIndex() const noexcept
+    {
+        return m_streamIndex;
+    }
+
+    /**
+     * @brief seek - decode frame displayed at the target time
+     *
+     * If target is before the first frame, first frame is returned. If target is after the end of
+     * stream, last frame is returned.
+     *
+     * @param target  wanted presentation time
+     * @param frame   decoded frame
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     * @return true if frame decoded, false if stream has no frames or on error
+     */
+    bool seek(const Timestamp &target, FrameType &frame, OptionalErrorCode ec = throws())
+    {
+        clear_if(ec);
+
+        m_format.seek(target.timestamp(m_timeBase), m_streamIndex, AVSEEK_FLAG_BACKWARD, ec);
+        if (is_error(ec))
+            return false;
+
+        m_decoder.flushBuffers(ec);
+        if (is_error(ec))
+            return false;
+
+        m_packet       = Packet();
+        m_hasPacket    = false;
+        m_eof          = false;
+        m_hasLookahead = false;
+        m_discarded    = 0;
+
+        FrameType previous;
+        bool hasPrevious = false;
+
+        while (decodeNext(m_lookahead, ec)) {
+            const Timestamp pts = framePts(m_lookahead);
+            if (pts.isValid() && pts > target) {
+                if (!hasPrevious) {
+                    frame = std::move(m_lookahead);
+                    return true;
+                }
+                // Keep frame after target for the nextFrame()
+                m_hasLookahead = true;
+                frame = std::move(previous);
+                return true;
+            }
+
+            if (hasPrevious)
+                ++m_discarded;
+            previous    = std::move(m_lookahead);
+            hasPrevious = true;
+        }
+
+        if (is_error(ec) || !hasPrevious)
+            return false;
+
+        frame = std::move(previous);
+        return true;
+    }
+
+    /**
+     * @brief nextFrame - decode next frame in presentation order
+     *
+     * @param frame   decoded frame
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     * @return true if frame decoded, false at the end of stream or on error
+     */
+    bool nextFrame(FrameType &frame, OptionalErrorCode ec = throws())
+    {
+        clear_if(ec);
+
+        if (m_hasLookahead) {
+            m_hasLookahead = false;
+            frame = std::move(m_lookahead);
+            return true;
+        }
+
+        return decodeNext(frame, ec);
+    }
+
+    /**
+     * @return frames decoded and dropped by the last seek() to reach target
+     */
+    size_t discardedFrames() const noexcept
+    {
+        return m_discarded;
+    }
+
+private:
+    Timestamp framePts(const FrameType &frame) const
+    {
+        // Decoder without time base does not rescale timestamps: they are in stream time base
+        if (frame.timeBase() == Rational())
+            return {frame.raw()->pts, m_timeBase};
+        return frame.pts();
+    }
+
+    bool decodeNext(FrameType &frame, OptionalErrorCode ec)
+    {
+        while (true) {
+            if (m_decoder.receiveFrame(frame, ec))
+                return true;
+            if (is_error(ec) || m_eof)
+                return false;
+
+            if (!m_hasPacket) {
+                m_packet = m_format.readPacket(ec);
+                if (is_error(ec))
+                    return false;
+                // Empty packet at the end of file drains decoder
+                if (!m_packet.isNull() && m_packet.streamIndex() != m_streamIndex)
+                    continue;
+                m_hasPacket = true;
+            }
+
+            // Not accepted packet is sent again after frames are taken
+            if (m_decoder.sendPacket(m_packet, ec)) {
+                m_hasPacket = false;
+                m_eof       = m_packet.isNull();
+            } else if (is_error(ec)) {
+                return false;
+            }
+        }
+    }
+
+private:
+    FormatContext &m_format;
+    Decoder       &m_decoder;
+    int            m_streamIndex;
+    Rational       m_timeBase;
+
+    Packet         m_packet;
+    bool           m_hasPacket    = false;
+    bool           m_eof          = false;
+
+    FrameType      m_lookahead;
+    bool           m_hasLookahead = false;
+    size_t         m_discarded    = 0;
+};
+
+using SeekableVideoDecoder = SeekableDecoder<VideoDecoderContext>;
+using SeekableAudioDecoder = SeekableDecoder<AudioDecoderContext>;
+
+} // namespace av
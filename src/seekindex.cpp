@@ -0,0 +1,298 @@
+#include <algorithm>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "packet.h"
+#include "stream.h"
+#include "avlog.h"
+#include "seekindex.h"
+
+namespace {
+
+const char     SidecarMagic[8] = {'A', 'V', 'C', 'P', 'I', 'D', 'X', '2'};
+const uint64_t MaxSidecarEntries = uint64_t(1) << 32;
+
+struct FileKey
+{
+    uint64_t size  = 0;
+    int64_t  mtime = 0; ///< nanoseconds: same-size rewrite within a second changes key too
+};
+
+bool file_key(const std::string &path, FileKey &key)
+{
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0)
+        return false;
+    key.size  = static_cast<uint64_t>(st.st_size);
+#if defined(__APPLE__)
+    key.mtime = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#elif defined(__unix__)
+    key.mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#else
+    key.mtime = static_cast<int64_t>(st.st_mtime) * 1000000000;
+#endif
+    return true;
+}
+
+template<typename T>
+void write_value(std::ostream &out, const T &value)
+{
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template<typename T>
+bool read_value(std::istream &in, T &value)
+{
+    return !!in.read(reinterpret_cast<char*>(&value), sizeof(value));
+}
+
+} // anonymous
+
+namespace av {
+
+bool SeekIndex::isEmpty() const noexcept
+{
+    return m_streams.empty();
+}
+
+void SeekIndex::clear() noexcept
+{
+    m_streams.clear();
+}
+
+std::vector<int> SeekIndex::streams() const
+{
+    std::vector<int> result;
+    for (const auto &stream : m_streams)
+        result.push_back(stream.first);
+    return result;
+}
+
+const std::vector<SeekIndex::Entry> &SeekIndex::entries(int streamIndex) const
+{
+    static const std::vector<Entry> empty;
+    auto it = m_streams.find(streamIndex);
+    return it != m_streams.end() ? it->second.entries : empty;
+}
+
+void SeekIndex::build(FormatContext &format, OptionalErrorCode ec)
+{
+    clear_if(ec);
+    clear();
+
+    const size_t count = format.streamsCount();
+
+    // Minimal distance between entries in the stream time base, 0 - every keyframe
+    std::vector<int64_t> minDistance(count, -1);
+    for (size_t i = 0; i < count; ++i) {
+        auto st = format.stream(i);
+        if (st.discard() >= AVDISCARD_ALL)
+            continue;
+
+        m_streams[static_cast<int>(i)].timeBase = st.timeBase();
+        minDistance[i] = st.isVideo()
+                ? 0
+                : Rational(1, 1).rescale(MinOtherInterval, st.timeBase());
+    }
+
+    format.readUntil([&](Packet &packet) {
+        const int index = packet.streamIndex();
+        if (index < 0 || static_cast<size_t>(index) >= count || minDistance[index] < 0)
+            return true;
+
+        const auto raw = packet.raw();
+        const int64_t ts = raw->pts != av::NoPts ? raw->pts : raw->dts;
+        if (!packet.isKeyPacket() || raw->pos < 0 || ts == av::NoPts)
+            return true;
+
+        auto &entries = m_streams[index].entries;
+        if (!entries.empty() && ts - entries.back().pts < std::max<int64_t>(minDistance[index], 1))
+            return true;
+
+        entries.push_back(Entry{ts, raw->pos});
+        return true;
+    }, ec);
+
+    // Keep entries ordered by time: packets of the damaged streams can go backward
+    for (auto &stream : m_streams) {
+        auto &entries = stream.second.entries;
+        std::stable_sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+            return a.pts < b.pts;
+        });
+    }
+
+    for (auto it = m_streams.begin(); it != m_streams.end();) {
+        if (it->second.entries.empty())
+            it = m_streams.erase(it);
+        else
+            ++it;
+    }
+}
+
+bool SeekIndex::load(const std::string &sidecarPath, const std::string &mediaPath, OptionalErrorCode ec)
+{
+    clear_if(ec);
+    clear();
+
+    FileKey media;
+    if (!file_key(mediaPath, media)) {
+        throws_if(ec, errno, std::system_category());
+        return false;
+    }
+
+    std::ifstream in(sidecarPath, std::ios::binary | std::ios::ate);
+    if (!in)
+        return false;
+
+    // Entries count is checked against the file size before allocation
+    const std::streamoff fileSize = in.tellg();
+    in.seekg(0);
+
+    char magic[sizeof(SidecarMagic)];
+    FileKey stored;
+    uint32_t streamsCount = 0;
+    if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, SidecarMagic, sizeof(magic)) != 0 ||
+        !read_value(in, stored.size) || !read_value(in, stored.mtime) || !read_value(in, streamsCount))
+        return false;
+
+    if (stored.size != media.size || stored.mtime != media.mtime)
+        return false;
+
+    std::map<int, StreamIndex> streams;
+    for (uint32_t i = 0; i < streamsCount; ++i) {
+        int32_t index = 0, num = 0, den = 0;
+        uint64_t entriesCount = 0;
+        if (!read_value(in, index) || !read_value(in, num) || !read_value(in, den) ||
+            !read_value(in, entriesCount) || entriesCount > MaxSidecarEntries || den <= 0)
+            return false;
+
+        const std::streamoff left = fileSize - in.tellg();
+        if (left < 0 || entriesCount > static_cast<uint64_t>(left) / sizeof(Entry))
+            return false;
+
+        auto &stream = streams[index];
+        stream.timeBase = Rational(num, den);
+        stream.entries.resize(static_cast<size_t>(entriesCount));
+        if (!in.read(reinterpret_cast<char*>(stream.entries.data()),
+                     static_cast<std::streamsize>(entriesCount * sizeof(Entry))))
+            return false;
+    }
+
+    m_streams = std::move(streams);
+    return true;
+}
+
+void SeekIndex::save(const std::string &sidecarPath, const std::string &mediaPath, OptionalErrorCode ec) const
+{
+    clear_if(ec);
+
+    FileKey media;
+    if (!file_key(mediaPath, media)) {
+        throws_if(ec, errno, std::system_category());
+        return;
+    }
+
+    const std::string tmpPath = sidecarPath + ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            throws_if(ec, errno ? errno : EIO, std::system_category());
+            return;
+        }
+
+        out.write(SidecarMagic, sizeof(SidecarMagic));
+        write_value(out, media.size);
+        write_value(out, media.mtime);
+        write_value(out, static_cast<uint32_t>(m_streams.size()));
+
+        for (const auto &stream : m_streams) {
+            write_value(out, static_cast<int32_t>(stream.first));
+            write_value(out, static_cast<int32_t>(stream.second.timeBase.getNumerator()));
+            write_value(out, static_cast<int32_t>(stream.second.timeBase.getDenominator()));
+            write_value(out, static_cast<uint64_t>(stream.second.entries.size()));
+            out.write(reinterpret_cast<const char*>(stream.second.entries.data()),
+                      static_cast<std::streamsize>(stream.second.entries.size() * sizeof(Entry)));
+        }
+
+        if (!out.flush()) {
+            std::remove(tmpPath.c_str());
+            throws_if(ec, EIO, std::system_category());
+            return;
+        }
+    }
+
+    if (std::rename(tmpPath.c_str(), sidecarPath.c_str()) != 0) {
+        const int err = errno;
+        std::remove(tmpPath.c_str());
+        throws_if(ec, err, std::system_category());
+    }
+}
+
+bool SeekIndex::loadOrBuild(FormatContext &format, const std::string &mediaPath, OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    const auto path = sidecarPath(mediaPath);
+    if (load(path, mediaPath, ec))
+        return true;
+    if (is_error(ec))
+        return false;
+
+    build(format, ec);
+    if (is_error(ec))
+        return false;
+
+    // Cache is optional: unwritable location is not an error
+    std::error_code saveEc;
+    save(path, mediaPath, saveEc);
+    if (saveEc)
+        null_log(AV_LOG_WARNING, "Can't save seek index to %s: %s\n", path.c_str(), saveEc.message().c_str());
+
+    return false;
+}
+
+std::string SeekIndex::sidecarPath(const std::string &mediaPath)
+{
+    return mediaPath + ".avidx";
+}
+
+const SeekIndex::Entry *SeekIndex::find(const Timestamp &ts, int streamIndex) const
+{
+    auto it = m_streams.find(streamIndex);
+    if (it == m_streams.end() || ts.isNoPts())
+        return nullptr;
+
+    const auto &entries = it->second.entries;
+    const int64_t pts = ts.timestamp(it->second.timeBase);
+
+    auto next = std::upper_bound(entries.begin(), entries.end(), pts, [](int64_t value, const Entry &entry) {
+        return value < entry.pts;
+    });
+    if (next == entries.begin())
+        return nullptr;
+
+    return &*(next - 1);
+}
+
+bool SeekIndex::seek(FormatContext &format, const Timestamp &ts, int streamIndex, OptionalErrorCode ec) const
+{
+    clear_if(ec);
+
+    const Entry *entry = find(ts, streamIndex);
+    if (!entry)
+        return false;
+
+    if (format.inputFormat().flags() & AVFMT_NO_BYTE_SEEK)
+        format.seek(entry->pts, streamIndex, AVSEEK_FLAG_BACKWARD, ec);
+    else
+        format.seek(entry->pos, streamIndex, AVSEEK_FLAG_BYTE, ec);
+
+    return !is_error(ec);
+}
+
+} // namespace av
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "ffmpeg.h"
+#include "averror.h"
+#include "rational.h"
+#include "timestamp.h"
+#include "formatcontext.h"
+
+namespace av {
+
+/**
+ * @brief The SeekIndex class - keyframes index of the input with the persistent sidecar cache
+ *
+ * Input is scanned once with FormatContext::readPacket(): presentation time and byte position of
+ * the key packets are recorded. Seeking by the index is a single AVSEEK_FLAG_BYTE jump instead of
+ * the demuxer timestamp search, that is slow for the poorly indexed inputs (MPEG-TS, raw
+ * elementary streams).
+ *
+ * All keyframes of the video streams are recorded, other streams are thinned to one entry per
+ * MinOtherInterval. Discarded streams are not indexed.
+ *
+ * Index is saved to the sidecar file together with media file size and modification time, so
+ * stale sidecar is rejected on load. Sidecar uses native byte order: it is a local cache, not an
+ * interchange format.
+ */
+class SeekIndex
+{
+public:
+    struct Entry
+    {
+        int64_t pts; ///< presentation time in the stream time base, decoding time if PTS unknown
+        int64_t pos; ///< byte position of the packet
+    };
+
+    static constexpr int64_t MinOtherInterval = 1; ///< seconds
+
+    SeekIndex() = default;
+
+    bool isEmpty() const noexcept;
+    void clear() noexcept;
+
+    /// Indexed streams
+    std::vector<int> streams() const;
+    const std::vector<Entry>& entries(int streamIndex) const;
+
+    /**
+     * @brief build - scan input and collect keyframes
+     *
+     * Input is read from the current position to the end: seek it before further reading.
+     *
+     * @param format  opened input with found streams info
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     */
+    void build(FormatContext &format, OptionalErrorCode ec = throws());
+
+    /**
+     * @brief load - read index from the sidecar
+     *
+     * @param sidecarPath  index file
+     * @param mediaPath    indexed file, its size and modification time must match stored ones
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     * @return false if sidecar absent, stale or damaged: it is not an error
+     */
+    bool load(const std::string &sidecarPath, const std::string &mediaPath, OptionalErrorCode ec = throws());
+
+    /**
+     * @brief save - write index to the sidecar, file is replaced atomically
+     */
+    void save(const std::string &sidecarPath, const std::string &mediaPath, OptionalErrorCode ec = throws()) const;
+
+    /**
+     * @brief loadOrBuild - load index from the default sidecar, build and save it if needed
+     *
+     * @return true if index loaded from the sidecar
+     */
+    bool loadOrBuild(FormatContext &format, const std::string &mediaPath, OptionalErrorCode ec = throws());
+
+    /// Default sidecar location: next to the media file
+    static std::string sidecarPath(const std::string &mediaPath);
+
+    /**
+     * @brief find - last keyframe of the stream at or before given time
+     * @return entry or nullptr if stream is not indexed or time is before the first keyframe
+     */
+    const Entry* find(const Timestamp &ts, int streamIndex) const;
+
+    /**
+     * @brief seek - jump to the last keyframe of the stream at or before given time
+     *
+     * Byte seeking is used when format supports it, timestamp seeking to the keyframe otherwise.
+     * Decode forward from this point to reach exact time, see SeekableDecoder.
+     *
+     * @return false if no keyframe found for the time
+     */
+    bool seek(FormatContext &format, const Timestamp &ts, int streamIndex, OptionalErrorCode ec = throws()) const;
+
+private:
+    struct StreamIndex
+    {
+        Rational           timeBase;
+        std::vector<Entry> entries;
+    };
+
+    std::map<int, StreamIndex> m_streams;
+};
+
+} // namespace av
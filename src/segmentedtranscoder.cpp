@@ -0,0 +1,495 @@
+#include <algorithm>
+#include <mutex>
+#include <cinttypes>
+#include <thread>
+#include <condition_variable>
+
+#include "avlog.h"
+#include "format.h"
+#include "formatcontext.h"
+#include "packet.h"
+#include "frame.h"
+#include "segmentedtranscoder.h"
+
+extern "C" {
+#include <libavutil/mathematics.h>
+}
+
+using namespace std;
+
+namespace av {
+namespace {
+
+void default_encoder_setup(VideoEncoderContext &encoder, const VideoDecoderContext &decoder)
+{
+    encoder.setWidth(decoder.width());
+    encoder.setHeight(decoder.height());
+    if (decoder.pixelFormat() > -1)
+        encoder.setPixelFormat(decoder.pixelFormat());
+    encoder.setTimeBase(decoder.stream().timeBase());
+    encoder.setBitRate(decoder.bitRate());
+}
+
+// Open input and find the first video stream
+Stream open_video_input(FormatContext &ictx, const std::string &uri, OptionalErrorCode ec)
+{
+    ictx.openInput(uri, ec);
+    if (is_error(ec))
+        return Stream();
+
+    ictx.findStreamInfo(ec);
+    if (is_error(ec))
+        return Stream();
+
+    for (size_t i = 0; i < ictx.streamsCount(); ++i) {
+        auto st = ictx.stream(i);
+        if (st.mediaType() == AVMEDIA_TYPE_VIDEO)
+            return st;
+    }
+
+    null_log(AV_LOG_ERROR, "Video stream does not found\n");
+    throws_if(ec, Errors::FormatNoStreams);
+    return Stream();
+}
+
+int64_t packet_ts(const Packet &packet)
+{
+    return packet.raw()->pts != AV_NOPTS_VALUE ? packet.raw()->pts : packet.raw()->dts;
+}
+
+// DTS offset that puts chunk after the previous one: DTS only when PTS - DTS gap of every packet
+// allows it (encoder delay), otherwise PTS too
+void stitch_chunk(std::vector<Packet> &packets, int64_t lastDts, size_t idx)
+{
+    if (lastDts == AV_NOPTS_VALUE)
+        return;
+
+    int64_t firstDts = AV_NOPTS_VALUE;
+    int64_t headroom = INT64_MAX;
+    for (const auto &packet : packets) {
+        const AVPacket *pkt = packet.raw();
+        if (pkt->dts == AV_NOPTS_VALUE)
+            continue;
+        if (firstDts == AV_NOPTS_VALUE)
+            firstDts = pkt->dts;
+        if (pkt->pts != AV_NOPTS_VALUE)
+            headroom = std::min(headroom, pkt->pts - pkt->dts);
+    }
+
+    if (firstDts == AV_NOPTS_VALUE || firstDts > lastDts)
+        return;
+
+    const int64_t offset   = lastDts + 1 - firstDts;
+    const bool    dtsOnly  = offset <= headroom;
+    if (!dtsOnly)
+        null_log(AV_LOG_WARNING, "Chunk %zu: shifted by %" PRId64 " to keep DTS monotonic\n", idx, offset);
+
+    for (auto &packet : packets) {
+        AVPacket *pkt = packet.raw();
+        if (pkt->dts != AV_NOPTS_VALUE)
+            pkt->dts += offset;
+        if (!dtsOnly && pkt->pts != AV_NOPTS_VALUE)
+            pkt->pts += offset;
+    }
+}
+
+int64_t frame_ts(const VideoFrame &frame, const Rational &timeBase)
+{
+    const int64_t pts = frame.raw()->pts;
+    if (pts == AV_NOPTS_VALUE || frame.timeBase() == Rational())
+        return pts;
+    return av_rescale_q(pts, frame.timeBase().getValue(), timeBase.getValue());
+}
+
+} // anonymous
+
+
+SegmentedTranscoder::SegmentedTranscoder()
+    : m_encoderSetup(default_encoder_setup)
+{
+}
+
+void SegmentedTranscoder::setJobs(size_t jobs) noexcept
+{
+    m_jobs = jobs;
+}
+
+size_t SegmentedTranscoder::jobs() const noexcept
+{
+    if (m_jobs)
+        return m_jobs;
+    return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+void SegmentedTranscoder::setChunksCount(size_t count) noexcept
+{
+    m_chunksCount = count;
+}
+
+size_t SegmentedTranscoder::chunksCount() const noexcept
+{
+    return m_chunksCount ? m_chunksCount : jobs();
+}
+
+void SegmentedTranscoder::setEncoderSetup(EncoderSetup setup)
+{
+    m_encoderSetup = setup ? std::move(setup) : EncoderSetup(default_encoder_setup);
+}
+
+SegmentedTranscoder::Stats SegmentedTranscoder::stats() const noexcept
+{
+    Stats stats;
+    stats.chunks         = m_chunks;
+    stats.framesEncoded  = m_framesEncoded;
+    stats.packetsWritten = m_packetsWritten;
+    return stats;
+}
+
+std::vector<SegmentedTranscoder::Chunk> SegmentedTranscoder::findChunks(const std::string &inputUri, size_t count, OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    FormatContext ictx;
+    auto st = open_video_input(ictx, inputUri, ec);
+    if (is_error(ec))
+        return {};
+
+    const Rational timeBase = st.timeBase();
+    const int      index    = st.index();
+
+    int64_t start    = st.startTime().isNoPts() ? 0 : st.startTime().timestamp(timeBase);
+    int64_t duration = st.duration().isNoPts() ? AV_NOPTS_VALUE : st.duration().timestamp(timeBase);
+    if (duration == AV_NOPTS_VALUE || duration <= 0) {
+        if (ictx.duration().isNoPts()) {
+            // Can't split: single chunk for whole stream
+            return {Chunk{Timestamp(AV_NOPTS_VALUE, timeBase), Timestamp(AV_NOPTS_VALUE, timeBase)}};
+        }
+        duration = ictx.duration().timestamp(timeBase);
+    }
+
+    std::vector<int64_t> bounds;
+    for (size_t i = 1; i < count; ++i) {
+        const int64_t target = start + av_rescale(duration, static_cast<int64_t>(i), static_cast<int64_t>(count));
+        const int64_t prev   = bounds.empty() ? start : bounds.back();
+
+        ictx.seek(target, index, AVSEEK_FLAG_BACKWARD, ec);
+        if (is_error(ec))
+            return {};
+
+        // First keyframe after previous boundary
+        int64_t found = AV_NOPTS_VALUE;
+        while (true) {
+            Packet packet = ictx.readPacket(ec);
+            if (is_error(ec))
+                return {};
+            if (!packet)
+                break;
+            if (packet.streamIndex() != index || !packet.isKeyPacket())
+                continue;
+
+            const int64_t ts = packet_ts(packet);
+            if (ts != AV_NOPTS_VALUE && ts > prev) {
+                found = ts;
+                break;
+            }
+        }
+
+        if (found != AV_NOPTS_VALUE && (bounds.empty() || found > bounds.back()))
+            bounds.push_back(found);
+    }
+
+    std::vector<Chunk> chunks;
+    Timestamp chunkStart(AV_NOPTS_VALUE, timeBase);
+    for (auto bound : bounds) {
+        chunks.push_back({chunkStart, Timestamp(bound, timeBase)});
+        chunkStart = Timestamp(bound, timeBase);
+    }
+    chunks.push_back({chunkStart, Timestamp(AV_NOPTS_VALUE, timeBase)});
+
+    return chunks;
+}
+
+void SegmentedTranscoder::transcode(const std::string &inputUri, const std::string &outputUri, const Codec &codec, OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    m_chunks         = 0;
+    m_framesEncoded  = 0;
+    m_packetsWritten = 0;
+
+    auto chunks = findChunks(inputUri, chunksCount(), ec);
+    if (is_error(ec))
+        return;
+    m_chunks = chunks.size();
+
+    //
+    // Output stream parameters: from the encoder configured in the same way as chunk ones
+    //
+    FormatContext ictx;
+    auto ist = open_video_input(ictx, inputUri, ec);
+    if (is_error(ec))
+        return;
+
+    VideoDecoderContext decoder(ist);
+    decoder.open(Codec(), ec);
+    if (is_error(ec))
+        return;
+
+    OutputFormat ofmt;
+    ofmt.setFormat(std::string(), outputUri);
+
+    FormatContext octx;
+    octx.setFormat(ofmt);
+
+    const bool globalHeader = octx.outputFormat().isFlags(AVFMT_GLOBALHEADER);
+
+    Stream ost = octx.addStream(codec, ec);
+    if (is_error(ec))
+        return;
+
+    {
+        VideoEncoderContext encoder(ost, codec);
+        m_encoderSetup(encoder, decoder);
+        if (globalHeader)
+            encoder.addFlags(AV_CODEC_FLAG_GLOBAL_HEADER);
+        ost.setFrameRate(ist.frameRate());
+        ost.setTimeBase(encoder.timeBase());
+
+        encoder.open(ec);
+        if (is_error(ec))
+            return;
+    }
+
+    octx.openOutput(outputUri, ec);
+    if (is_error(ec))
+        return;
+
+    octx.writeHeader(ec);
+    if (is_error(ec))
+        return;
+
+    //
+    // Chunks workers
+    //
+    std::mutex                       mutex;
+    std::condition_variable          cond;
+    std::vector<std::vector<Packet>> results(chunks.size());
+    std::vector<char>                ready(chunks.size(), 0);
+    std::error_code                  workerError;
+    size_t                           nextChunk = 0;
+    size_t                           written   = 0;
+    std::atomic<bool>                cancel{false};
+
+    const size_t jobsCount = std::min(jobs(), chunks.size());
+    const size_t window    = jobsCount * ChunksAheadPerJob;
+
+    auto worker = [&]() {
+        while (true) {
+            size_t idx;
+            {
+                // Encoded chunks are buffered until the writer takes them: bound memory usage
+                std::unique_lock<std::mutex> lock(mutex);
+                cond.wait(lock, [&] { return cancel || nextChunk < written + window; });
+                if (cancel || nextChunk >= chunks.size())
+                    break;
+                idx = nextChunk++;
+            }
+
+            std::error_code err;
+            auto packets = transcodeChunk(inputUri, chunks[idx], codec, globalHeader, cancel, err);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (err) {
+                if (!workerError)
+                    workerError = err;
+                cancel = true;
+            }
+            results[idx] = std::move(packets);
+            ready[idx]   = 1;
+            cond.notify_all();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < jobsCount; ++i)
+        workers.emplace_back(worker);
+
+    //
+    // Write chunks in order
+    //
+    int64_t lastDts = AV_NOPTS_VALUE;
+    std::error_code writeError;
+    for (size_t idx = 0; idx < chunks.size(); ++idx) {
+        std::vector<Packet> packets;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [&] { return ready[idx] || cancel; });
+            if (!ready[idx] || workerError)
+                break;
+            packets = std::move(results[idx]);
+            written = idx + 1;
+        }
+        cond.notify_all();
+
+        // Muxer can change stream time base in writeHeader(): stitch in the written time base,
+        // same as lastDts
+        for (auto &packet : packets) {
+            packet.setStreamIndex(ost.index());
+            packet.setTimeBase(ost.timeBase());
+        }
+
+        // Encoder restarted at the chunk start: keep DTS monotonic
+        stitch_chunk(packets, lastDts, idx);
+
+        for (auto &packet : packets) {
+            if (packet.raw()->dts != AV_NOPTS_VALUE)
+                lastDts = packet.raw()->dts;
+
+            octx.writePacket(packet, writeError);
+            if (writeError)
+                break;
+            ++m_packetsWritten;
+        }
+
+        if (writeError)
+            break;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        cancel = true;
+    }
+    cond.notify_all();
+    for (auto &thread : workers)
+        thread.join();
+
+    if (workerError) {
+        throws_if(ec, workerError.value(), workerError.category());
+        return;
+    }
+
+    if (writeError) {
+        throws_if(ec, writeError.value(), writeError.category());
+        return;
+    }
+
+    octx.writeTrailer(ec);
+}
+
+std::vector<Packet> SegmentedTranscoder::transcodeChunk(const std::string &inputUri,
+                                                        const Chunk &chunk,
+                                                        const Codec &codec,
+                                                        bool globalHeader,
+                                                        const std::atomic<bool> &cancel,
+                                                        OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    std::vector<Packet> packets;
+
+    FormatContext ictx;
+    auto st = open_video_input(ictx, inputUri, ec);
+    if (is_error(ec))
+        return packets;
+
+    const Rational timeBase = st.timeBase();
+    const int      index    = st.index();
+    const int64_t  start    = chunk.start.isNoPts() ? AV_NOPTS_VALUE : chunk.start.timestamp(timeBase);
+    const int64_t  end      = chunk.end.isNoPts() ? AV_NOPTS_VALUE : chunk.end.timestamp(timeBase);
+
+    VideoDecoderContext decoder(st);
+    decoder.setRefCountedFrames(true);
+    decoder.open(Codec(), ec);
+    if (is_error(ec))
+        return packets;
+
+    VideoEncoderContext encoder(codec);
+    m_encoderSetup(encoder, decoder);
+    if (globalHeader)
+        encoder.addFlags(AV_CODEC_FLAG_GLOBAL_HEADER);
+    encoder.open(ec);
+    if (is_error(ec))
+        return packets;
+
+    if (start != AV_NOPTS_VALUE) {
+        ictx.seek(start, index, AVSEEK_FLAG_BACKWARD, ec);
+        if (is_error(ec))
+            return packets;
+    }
+
+    auto collect = [&packets](Packet &packet) {
+        packets.push_back(std::move(packet));
+    };
+
+    std::error_code encodeError;
+    auto encode = [&](VideoFrame &frame) {
+        if (encodeError)
+            return;
+
+        // Leading frames of the open GOP belong to the previous chunk
+        const int64_t ts = frame_ts(frame, timeBase);
+        if (ts == AV_NOPTS_VALUE ||
+            (start != AV_NOPTS_VALUE && ts < start) ||
+            (end != AV_NOPTS_VALUE && ts >= end))
+            return;
+
+        frame.setTimeBase(Rational());
+        frame.raw()->pts = av_rescale_q(ts, timeBase.getValue(), encoder.timeBase().getValue());
+        frame.setTimeBase(encoder.timeBase());
+        frame.setPictureType();
+
+        encoder.encodeAll(frame, collect, encodeError);
+        if (!encodeError)
+            ++m_framesEncoded;
+    };
+
+    bool endKeyFound = false;
+    while (true) {
+        // Other chunk failed or writer stopped: result is not needed
+        if (cancel)
+            return packets;
+
+        Packet packet = ictx.readPacket(ec);
+        if (is_error(ec))
+            return packets;
+        if (!packet)
+            break;
+        if (packet.streamIndex() != index)
+            continue;
+
+        // Decode next chunk keyframe and frames that precede it in presentation order: they
+        // can refer it (open GOP)
+        if (end != AV_NOPTS_VALUE) {
+            const int64_t ts = packet_ts(packet);
+            if (endKeyFound && ts != AV_NOPTS_VALUE && ts >= end)
+                break;
+            if (packet.isKeyPacket() && ts != AV_NOPTS_VALUE && ts >= end)
+                endKeyFound = true;
+        }
+
+        decoder.decodeAll(packet, encode, ec);
+        if (is_error(ec))
+            return packets;
+        if (encodeError)
+            break;
+    }
+
+    if (cancel)
+        return packets;
+
+    // Flush decoder and encoder
+    if (!encodeError)
+        decoder.decodeAll(Packet(), encode, ec);
+    if (is_error(ec))
+        return packets;
+
+    if (!encodeError)
+        encoder.encodeAll(VideoFrame(nullptr), collect, encodeError);
+
+    if (encodeError)
+        throws_if(ec, encodeError.value(), encodeError.category());
+
+    return packets;
+}
+
+} // namespace av
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <functional>
+
+#include "ffmpeg.h"
+#include "averror.h"
+#include "avutils.h"
+#include "codec.h"
+#include "timestamp.h"
+#include "codeccontext.h"
+
+namespace av {
+
+/**
+ * @brief The SegmentedTranscoder class - transcodes video of the single input in parallel
+ *
+ * Timeline is split to the chunks at the keyframes (found with FormatContext::seek() and
+ * Packet::isKeyPacket()). Each chunk is decoded and encoded by its own VideoDecoderContext /
+ * VideoEncoderContext pair on the separate thread. Encoded packets are written to the single
+ * output in the chunks order.
+ *
+ * Frames keep original timestamps, so output timeline is continuous. Encoder restarts on every
+ * chunk, so chunk start DTS (shifted back by the encoder delay) can overlap with previous chunk
+ * tail. Such chunk gets single DTS offset: DTS of all its packets are moved forward when the
+ * smallest PTS - DTS gap of the chunk allows it, otherwise whole chunk is shifted and PTS too.
+ *
+ * Only video stream is transcoded: other streams are ignored. Encoded chunks are kept in memory
+ * until all previous chunks are written, so workers run at most ChunksAheadPerJob * jobs chunks
+ * ahead of the writer.
+ */
+class SegmentedTranscoder : public noncopyable
+{
+public:
+    /**
+     * Keyframe-aligned interval [start, end) of the input video stream. NoPts start or end means
+     * start or end of the stream.
+     */
+    struct Chunk
+    {
+        Timestamp start;
+        Timestamp end;
+    };
+
+    /// Encoded chunks waiting for the writer or being encoded, per job
+    static constexpr size_t ChunksAheadPerJob = 2;
+
+    struct Stats
+    {
+        size_t chunks         = 0;
+        size_t framesEncoded  = 0;
+        size_t packetsWritten = 0;
+    };
+
+    /**
+     * Encoder configurator: called before open for every chunk encoder and for the encoder that
+     * initializes output stream parameters. Must produce same configuration for all of them.
+     * Opened decoder of the input passed as parameters source.
+     */
+    using EncoderSetup = std::function<void(VideoEncoderContext &encoder, const VideoDecoderContext &decoder)>;
+
+    SegmentedTranscoder();
+
+    /// Parallel chunks count, 0 - std::thread::hardware_concurrency()
+    void setJobs(size_t jobs) noexcept;
+    size_t jobs() const noexcept;
+
+    /// Chunks count, 0 - same as jobs count. More chunks - better load balancing.
+    void setChunksCount(size_t count) noexcept;
+    size_t chunksCount() const noexcept;
+
+    /// By default encoder takes size, pixel format and bitrate from decoder and stream time base
+    void setEncoderSetup(EncoderSetup setup);
+
+    /**
+     * @brief findChunks - split input video stream to the keyframe-aligned chunks
+     *
+     * Chunk boundaries are the first keyframes after evenly spaced positions, so result can
+     * contain less chunks than requested for the short streams or long GOPs.
+     *
+     * @param inputUri  input to split
+     * @param count     wanted chunks count
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     * @return chunks, empty on error
+     */
+    std::vector<Chunk> findChunks(const std::string &inputUri, size_t count, OptionalErrorCode ec = throws());
+
+    /**
+     * @brief transcode - transcode video stream of the input to the output
+     *
+     * @param inputUri   input
+     * @param outputUri  output, format guessed from the name
+     * @param codec      video encoder
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     */
+    void transcode(const std::string &inputUri,
+                   const std::string &outputUri,
+                   const Codec &codec,
+                   OptionalErrorCode ec = throws());
+
+    Stats stats() const noexcept;
+
+private:
+    std::vector<Packet> transcodeChunk(const std::string &inputUri,
+                                       const Chunk &chunk,
+                                       const Codec &codec,
+                                       bool globalHeader,
+                                       const std::atomic<bool> &cancel,
+                                       OptionalErrorCode ec);
+
+private:
+    size_t              m_jobs        = 0;
+    size_t              m_chunksCount = 0;
+    EncoderSetup        m_encoderSetup;
+
+    std::atomic<size_t> m_chunks         {0};
+    std::atomic<size_t> m_framesEncoded  {0};
+    std::atomic<size_t> m_packetsWritten {0};
+};
+
+} // namespace av
@@ -0,0 +1,528 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cerrno>
+#include <fstream>
+#include <sstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+#include "avlog.h"
+#include "segmentwriter.h"
+
+namespace {
+
+bool sync_file(const std::string &path)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    const bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+#else
+    static_cast<void>(path);
+    return true;
+#endif
+}
+
+std::string directory_of(const std::string &path)
+{
+    const auto pos = path.find_last_of('/');
+    return pos == std::string::npos ? std::string() : path.substr(0, pos + 1);
+}
+
+} // anonymous
+
+namespace av {
+
+struct SegmentWriter::Output
+{
+    size_t        index = 0;
+    std::string   path;
+    FormatContext format;
+};
+
+// Output prepared ahead of time by the worker
+struct SegmentWriter::Pending
+{
+    std::mutex              mutex;
+    std::condition_variable cond;
+    bool                    ready = false;
+    std::unique_ptr<Output> output;
+    std::error_code         error;
+
+    std::unique_ptr<Output> take(std::error_code &ec)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [this] { return ready; });
+        ec = error;
+        return std::move(output);
+    }
+};
+
+SegmentWriter::SegmentWriter(size_t jobs)
+    : m_jobs(std::max<size_t>(jobs, 1))
+{
+}
+
+SegmentWriter::~SegmentWriter()
+{
+    std::error_code ec;
+    close(ec);
+}
+
+void SegmentWriter::setSegmentDuration(const Timestamp &duration) noexcept
+{
+    m_segmentDuration = duration;
+}
+
+Timestamp SegmentWriter::segmentDuration() const noexcept
+{
+    return m_segmentDuration;
+}
+
+void SegmentWriter::setPlaylistPath(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_playlistPath = path;
+}
+
+std::string SegmentWriter::playlistPath() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_playlistPath;
+}
+
+void SegmentWriter::setSync(bool sync) noexcept
+{
+    m_sync = sync;
+}
+
+bool SegmentWriter::isSync() const noexcept
+{
+    return m_sync;
+}
+
+void SegmentWriter::open(const std::string &pathPattern,
+                         const OutputFormat &format,
+                         StreamsSetup setup,
+                         OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    if (m_current) {
+        throws_if(ec, Errors::FormatAlreadyOpened);
+        return;
+    }
+
+    m_pattern = pathPattern;
+    m_setup   = std::move(setup);
+    m_format  = format.isNull() ? guessOutputFormat(std::string(), segmentPath(0)) : format;
+    if (m_format.isNull()) {
+        throws_if(ec, Errors::FormatNullOutputFormat);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_segments.clear();
+        m_error.clear();
+        m_stopWorkers = false;
+    }
+
+    for (size_t i = 0; i < m_jobs; ++i)
+        m_workers.emplace_back([this] { workerLoop(); });
+
+    std::error_code err;
+    m_current = createOutput(0, err);
+    if (err) {
+        std::error_code ignore;
+        close(ignore);
+        throws_if(ec, err.value(), err.category());
+        return;
+    }
+
+    // Segments are cut at the key packets of the first video stream
+    m_referenceStream = 0;
+    for (size_t i = 0; i < m_current->format.streamsCount(); ++i) {
+        if (m_current->format.stream(i).isVideo()) {
+            m_referenceStream = static_cast<int>(i);
+            break;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Segment segment;
+        segment.index = 0;
+        segment.path  = m_current->path;
+        m_segments.push_back(segment);
+    }
+
+    m_lastEnd = Timestamp();
+    m_next    = prepare(1);
+}
+
+void SegmentWriter::writePacket(const Packet &packet, OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    if (!m_current) {
+        throws_if(ec, Errors::FormatNotOpened);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_error) {
+            const auto error = m_error;
+            m_error.clear();
+            throws_if(ec, error.value(), error.category());
+            return;
+        }
+    }
+
+    const Timestamp ts = packet.pts().isValid() ? packet.pts() : packet.dts();
+    if (ts.isValid()) {
+        Timestamp start;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto &segment = m_segments.back();
+            if (!segment.start.isValid())
+                segment.start = ts;
+            start = segment.start;
+        }
+
+        if (packet.streamIndex() == m_referenceStream && packet.isKeyPacket() &&
+            ts - start >= m_segmentDuration) {
+            switchSegment(ts, ec);
+            if (is_error(ec))
+                return;
+        }
+
+        const Timestamp end = ts + Timestamp(packet.raw()->duration, packet.timeBase());
+        if (!m_lastEnd.isValid() || end > m_lastEnd)
+            m_lastEnd = end;
+    }
+
+    m_current->format.writePacket(packet, ec);
+}
+
+void SegmentWriter::close(OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    if (m_current) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_segments.back().end = m_lastEnd;
+        }
+        finalize(std::move(m_current));
+    }
+
+    // Prepared output is not needed: remove it
+    if (m_next) {
+        std::error_code err;
+        auto output = m_next->take(err);
+        m_next.reset();
+        if (output) {
+            const auto path = output->path;
+            output->format.close();
+            output.reset();
+            std::remove(path.c_str());
+        }
+    }
+
+    waitIdle();
+    updatePlaylist(true);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopWorkers = true;
+    }
+    m_cond.notify_all();
+
+    for (auto &worker : m_workers)
+        worker.join();
+    m_workers.clear();
+
+    std::error_code error;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::swap(error, m_error);
+    }
+
+    if (error)
+        throws_if(ec, error.value(), error.category());
+}
+
+bool SegmentWriter::isOpened() const noexcept
+{
+    return !!m_current;
+}
+
+std::vector<SegmentWriter::Segment> SegmentWriter::segments() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_segments;
+}
+
+std::string SegmentWriter::segmentPath(size_t index) const
+{
+    const int size = std::snprintf(nullptr, 0, m_pattern.c_str(), static_cast<int>(index));
+    if (size < 0)
+        return m_pattern;
+
+    std::string path(static_cast<size_t>(size) + 1, '\0');
+    std::snprintf(&path[0], path.size(), m_pattern.c_str(), static_cast<int>(index));
+    path.resize(static_cast<size_t>(size));
+    return path;
+}
+
+std::shared_ptr<SegmentWriter::Pending> SegmentWriter::prepare(size_t index)
+{
+    auto pending = std::make_shared<Pending>();
+    post([this, pending, index] {
+        std::error_code ec;
+        auto output = createOutput(index, ec);
+        {
+            std::lock_guard<std::mutex> lock(pending->mutex);
+            pending->output = std::move(output);
+            pending->error  = ec;
+            pending->ready  = true;
+        }
+        pending->cond.notify_all();
+    });
+    return pending;
+}
+
+std::unique_ptr<SegmentWriter::Output> SegmentWriter::createOutput(size_t index, std::error_code &ec)
+{
+    ec.clear();
+
+    auto output = std::make_unique<Output>();
+    output->index = index;
+    output->path  = segmentPath(index);
+    output->format.setFormat(m_format);
+
+    // Setup callback uses exceptions by default
+    try {
+        m_setup(output->format);
+    } catch (const std::system_error &e) {
+        ec = e.code();
+        return nullptr;
+    } catch (const std::exception &e) {
+        null_log(AV_LOG_ERROR, "Segment streams setup failed: %s\n", e.what());
+        ec = make_avcpp_error(Errors::Generic);
+        return nullptr;
+    }
+
+    output->format.openOutput(output->path, ec);
+    if (ec)
+        return nullptr;
+
+    output->format.writeHeader(ec);
+    if (ec) {
+        output->format.close();
+        std::remove(output->path.c_str());
+        return nullptr;
+    }
+
+    return output;
+}
+
+void SegmentWriter::switchSegment(const Timestamp &start, OptionalErrorCode ec)
+{
+    std::error_code err;
+    auto next = m_next ? m_next->take(err) : nullptr;
+    m_next.reset();
+
+    // Prepared output failed: one more try in place
+    if (!next) {
+        const size_t index = m_current->index + 1;
+        null_log(AV_LOG_WARNING, "Segment %zu was not prepared: %s\n", index, err.message().c_str());
+        next = createOutput(index, err);
+        if (!next) {
+            throws_if(ec, err.value(), err.category());
+            return;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_segments.back().end = start;
+
+        Segment segment;
+        segment.index = next->index;
+        segment.path  = next->path;
+        segment.start = start;
+        m_segments.push_back(segment);
+    }
+
+    auto finished = std::move(m_current);
+    m_current = std::move(next);
+    finalize(std::move(finished));
+
+    m_next = prepare(m_current->index + 1);
+}
+
+void SegmentWriter::finalize(std::unique_ptr<Output> output)
+{
+    std::shared_ptr<Output> shared(std::move(output));
+    post([this, shared] { finalizeOutput(*shared); });
+}
+
+void SegmentWriter::finalizeOutput(Output &output)
+{
+    std::error_code ec;
+    output.format.writeTrailer(ec);
+    output.format.close();
+
+    if (!ec && m_sync && !sync_file(output.path))
+        ec = std::error_code(errno, std::system_category());
+
+    if (ec) {
+        null_log(AV_LOG_ERROR, "Can't finalize segment %s: %s\n", output.path.c_str(), ec.message().c_str());
+        setError(ec);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (output.index < m_segments.size())
+            m_segments[output.index].finalized = true;
+    }
+    updatePlaylist(false);
+}
+
+void SegmentWriter::updatePlaylist(bool complete)
+{
+    std::string path;
+    std::string text;
+    uint64_t    version;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_playlistPath.empty() || m_segments.empty())
+            return;
+        path    = m_playlistPath;
+        text    = playlistText(complete);
+        version = ++m_playlistVersion;
+    }
+
+    // Finalizations run in parallel: playlist built later is never replaced by the earlier one
+    std::lock_guard<std::mutex> lock(m_playlistMutex);
+    if (version < m_playlistWritten)
+        return;
+    m_playlistWritten = version;
+
+    const auto tmpPath = path + ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::trunc);
+        if (!out) {
+            null_log(AV_LOG_WARNING, "Can't write playlist %s\n", tmpPath.c_str());
+            return;
+        }
+
+        if (!out.write(text.data(), static_cast<std::streamsize>(text.size())) || !out.flush()) {
+            out.close();
+            std::remove(tmpPath.c_str());
+            return;
+        }
+    }
+
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        null_log(AV_LOG_WARNING, "Can't write playlist %s\n", path.c_str());
+        std::remove(tmpPath.c_str());
+    }
+}
+
+std::string SegmentWriter::playlistText(bool complete) const
+{
+    // Finalized segments are listed in order: one being finalized hides the next ones
+    size_t count = 0;
+    double targetDuration = 0;
+    while (count < m_segments.size() && m_segments[count].finalized) {
+        const auto &segment = m_segments[count];
+        if (segment.start.isValid() && segment.end.isValid())
+            targetDuration = std::max(targetDuration, (segment.end - segment.start).seconds());
+        ++count;
+    }
+
+    const auto playlistDir = directory_of(m_playlistPath);
+
+    std::ostringstream out;
+    out << "#EXTM3U\n"
+           "#EXT-X-VERSION:3\n"
+           "#EXT-X-TARGETDURATION:" << static_cast<int64_t>(std::ceil(targetDuration)) << "\n"
+           "#EXT-X-MEDIA-SEQUENCE:0\n";
+
+    char duration[32];
+    for (size_t i = 0; i < count; ++i) {
+        const auto &segment = m_segments[i];
+        const double seconds = segment.start.isValid() && segment.end.isValid()
+                ? (segment.end - segment.start).seconds()
+                : 0.0;
+        std::snprintf(duration, sizeof(duration), "%.6f", seconds);
+
+        // Segments next to the playlist are referenced by the relative path
+        auto uri = segment.path;
+        if (!playlistDir.empty() && uri.compare(0, playlistDir.size(), playlistDir) == 0)
+            uri.erase(0, playlistDir.size());
+
+        out << "#EXTINF:" << duration << ",\n" << uri << "\n";
+    }
+
+    if (complete && count == m_segments.size())
+        out << "#EXT-X-ENDLIST\n";
+
+    return out.str();
+}
+
+void SegmentWriter::setError(const std::error_code &ec)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_error)
+        m_error = ec;
+}
+
+void SegmentWriter::post(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks.push_back(std::move(task));
+    }
+    m_cond.notify_all();
+}
+
+void SegmentWriter::workerLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_cond.wait(lock, [this] { return m_stopWorkers || !m_tasks.empty(); });
+        if (m_tasks.empty())
+            return;
+
+        auto task = std::move(m_tasks.front());
+        m_tasks.pop_front();
+        ++m_activeTasks;
+
+        lock.unlock();
+        task();
+        lock.lock();
+
+        --m_activeTasks;
+        m_cond.notify_all();
+    }
+}
+
+void SegmentWriter::waitIdle()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cond.wait(lock, [this] { return m_tasks.empty() && !m_activeTasks; });
+}
+
+} // namespace av
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <functional>
+#include <system_error>
+#include <condition_variable>
+
+#include "ffmpeg.h"
+#include "averror.h"
+#include "avutils.h"
+#include "format.h"
+#include "packet.h"
+#include "timestamp.h"
+#include "formatcontext.h"
+
+namespace av {
+
+/**
+ * @brief The SegmentWriter class - writes packets to the sequence of the fixed-duration outputs
+ *
+ * Segment is cut at the first key packet (Packet::isKeyPacket()) of the reference stream - first
+ * video stream or the first stream - that is not earlier than segment start + segment duration.
+ * Packets keep their timestamps, so the segments timeline is continuous.
+ *
+ * Segment boundary does not stall the writer:
+ *  - next segment output is created, opened and its header is written ahead of time on the worker
+ *    pool, right after the current segment is started;
+ *  - finished segment trailer writing, closing and fsync() are done on the worker pool.
+ *
+ * HLS-like playlist (M3U8) of the finalized segments is rewritten atomically after every
+ * finalization, segments are listed by the file name, in order.
+ *
+ * Worker errors are reported by the next writePacket() or close() call.
+ */
+class SegmentWriter : public noncopyable
+{
+public:
+    static constexpr size_t DefaultJobs = 2;
+
+    struct Segment
+    {
+        size_t      index = 0;
+        std::string path;
+        Timestamp   start;      ///< first key packet time
+        Timestamp   end;        ///< next segment start or last packet end
+        bool        finalized = false;
+    };
+
+    /**
+     * Adds streams to the new segment output: called for every segment, from the worker threads.
+     * Output format is set already, output is not opened yet.
+     */
+    using StreamsSetup = std::function<void(FormatContext &segment)>;
+
+    explicit SegmentWriter(size_t jobs = DefaultJobs);
+    ~SegmentWriter();
+
+    void      setSegmentDuration(const Timestamp &duration) noexcept;
+    Timestamp segmentDuration() const noexcept;
+
+    /// Playlist file, empty - no playlist. Set before open().
+    void        setPlaylistPath(const std::string &path);
+    std::string playlistPath() const;
+
+    /// fsync() finished segments, true by default
+    void setSync(bool sync) noexcept;
+    bool isSync() const noexcept;
+
+    /**
+     * @brief open - start the first segment
+     *
+     * @param pathPattern  segment path, printf-like pattern with single integer conversion for
+     *                     the segment index, e.g. "segment-%05d.ts"
+     * @param format       output format, null - guessed from the segment path
+     * @param setup        streams setup
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     */
+    void open(const std::string &pathPattern,
+              const OutputFormat &format,
+              StreamsSetup        setup,
+              OptionalErrorCode   ec = throws());
+
+    /**
+     * @brief writePacket - write packet, start new segment at the key packet if it is time
+     *
+     * Packet stream index and time base are the same as for the single output.
+     */
+    void writePacket(const Packet &packet, OptionalErrorCode ec = throws());
+
+    /**
+     * @brief close - finalize the last segment, wait all finalizations and complete playlist
+     */
+    void close(OptionalErrorCode ec = throws());
+
+    bool isOpened() const noexcept;
+
+    /// Started segments, finalized ones are marked
+    std::vector<Segment> segments() const;
+
+private:
+    struct Output;
+    struct Pending;
+
+    std::string               segmentPath(size_t index) const;
+    std::shared_ptr<Pending>  prepare(size_t index);
+    std::unique_ptr<Output>   createOutput(size_t index, std::error_code &ec);
+    void                      switchSegment(const Timestamp &start, OptionalErrorCode ec);
+    void                      finalize(std::unique_ptr<Output> output);
+    void                      finalizeOutput(Output &output);
+    void                      updatePlaylist(bool complete);
+    std::string               playlistText(bool complete) const;
+    void                      setError(const std::error_code &ec);
+
+    void                      post(std::function<void()> task);
+    void                      workerLoop();
+    void                      waitIdle();
+
+private:
+    size_t                                 m_jobs;
+    Timestamp                              m_segmentDuration{10, Rational(1, 1)};
+    std::string                            m_playlistPath;
+    bool                                   m_sync = true;
+
+    std::string                            m_pattern;
+    OutputFormat                           m_format;
+    StreamsSetup                           m_setup;
+    int                                    m_referenceStream = 0;
+
+    std::unique_ptr<Output>                m_current;
+    std::shared_ptr<Pending>               m_next;
+    Timestamp                              m_lastEnd;
+
+    mutable std::mutex                     m_mutex;
+    std::condition_variable                m_cond;
+    std::vector<Segment>                   m_segments;
+    std::error_code                        m_error;
+    uint64_t                               m_playlistVersion = 0;
+
+    // Playlist file is written without m_mutex: packets writing is not blocked by the disk
+    std::mutex                             m_playlistMutex;
+    uint64_t                               m_playlistWritten = 0;
+
+    std::deque<std::function<void()>>      m_tasks;
+    size_t                                 m_activeTasks = 0;
+    bool                                   m_stopWorkers = false;
+    std::vector<std::thread>               m_workers;
+};
+
+} // namespace av
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <condition_variable>
+
+#include "avutils.h"
+
+namespace av {
+
+/**
+ * @brief The SpscQueue class - bounded single producer / single consumer queue
+ *
+ * tryPush() and tryPop() are lock-free. Blocking push() and pop() sleep on the condition variable
+ * only when queue is full or empty: this provides backpressure between pipeline stages.
+ *
+ * close() wakes up both sides: push() fails after it, pop() returns remaining items and fails when
+ * queue becomes empty.
+ *
+ * Items are moved in and out, moved-from slot keeps the object until it is overwritten, so T
+ * must release its resources on move (Packet and Frame do).
+ */
+template<typename T>
+class SpscQueue : public noncopyable
+{
+public:
+    explicit SpscQueue(size_t capacity)
+        : m_slots(std::max<size_t>(capacity, 1) + 1)
+    {
+    }
+
+    size_t capacity() const noexcept
+    {
+        return m_slots.size() - 1;
+    }
+
+    size_t size() const noexcept
+    {
+        const size_t head = m_head.load(std::memory_order_acquire);
+        const size_t tail = m_tail.load(std::memory_order_acquire);
+        return tail >= head ? tail - head : tail + m_slots.size() - head;
+    }
+
+    bool empty() const noexcept
+    {
+        return size() == 0;
+    }
+
+    bool isClosed() const noexcept
+    {
+        return m_closed.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Producer side. Value moved out only on success.
+     * @return false if queue full or closed
+     */
+    bool tryPush(T &value)
+    {
+        if (isClosed())
+            return false;
+
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        const size_t next = advance(tail);
+        if (next == m_head.load(std::memory_order_acquire))
+            return false;
+
+        m_slots[tail] = std::move(value);
+        m_tail.store(next, std::memory_order_release);
+        wakeup();
+        return true;
+    }
+
+    bool tryPush(T &&value)
+    {
+        return tryPush(value);
+    }
+
+    /**
+     * Producer side. Wait while queue is full.
+     * @return false if queue closed
+     */
+    bool push(T &value)
+    {
+        while (!tryPush(value)) {
+            if (isClosed())
+                return false;
+            wait([this] { return size() < capacity(); });
+        }
+        return true;
+    }
+
+    bool push(T &&value)
+    {
+        return push(value);
+    }
+
+    /**
+     * Consumer side.
+     * @return false if queue empty
+     */
+    bool tryPop(T &value)
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+            return false;
+
+        value = std::move(m_slots[head]);
+        m_head.store(advance(head), std::memory_order_release);
+        wakeup();
+        return true;
+    }
+
+    /**
+     * Consumer side. Wait while queue is empty.
+     * @return false if queue closed and all items are taken
+     */
+    bool pop(T &value)
+    {
+        while (!tryPop(value)) {
+            if (isClosed() && empty())
+                return false;
+            wait([this] { return !empty(); });
+        }
+        return true;
+    }
+
+    /**
+     * Consumer side. Like pop() but wait no longer than timeout.
+     * @return false on timeout or if queue closed and all items are taken
+     */
+    template<typename Rep, typename Period>
+    bool popFor(T &value, const std::chrono::duration<Rep, Period> &timeout)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (!tryPop(value)) {
+            if (isClosed() && empty())
+                return false;
+            if (!wait([this] { return !empty(); }, deadline))
+                return tryPop(value);
+        }
+        return true;
+    }
+
+    /**
+     * Drop all items. Consumer side only.
+     */
+    void clear()
+    {
+        T value;
+        while (tryPop(value))
+        {}
+    }
+
+    /**
+     * Wake up waiters and reject new items.
+     */
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_closed.store(true, std::memory_order_release);
+        }
+        m_cond.notify_all();
+    }
+
+    /**
+     * Allow pushing after close(). Must not be called while other side is active.
+     */
+    void reopen()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed.store(false, std::memory_order_release);
+    }
+
+private:
+    size_t advance(size_t index) const noexcept
+    {
+        return ++index == m_slots.size() ? 0 : index;
+    }
+
+    template<typename Predicate>
+    void wait(Predicate &&ready)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        ++m_waiters;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        m_cond.wait(lock, [&] { return isClosed() || ready(); });
+        --m_waiters;
+    }
+
+    template<typename Predicate, typename TimePoint>
+    bool wait(Predicate &&ready, const TimePoint &deadline)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        ++m_waiters;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const bool result = m_cond.wait_until(lock, deadline, [&] { return isClosed() || ready(); });
+        --m_waiters;
+        return result;
+    }
+
+    void wakeup()
+    {
+        // Index update and waiters check are sequentially consistent with the waiter side: it
+        // either sees new index or is seen here
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_waiters.load() == 0)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+        }
+        m_cond.notify_all();
+    }
+
+private:
+    std::vector<T>          m_slots;
+    std::atomic<size_t>     m_head{0}; // consumer position
+    std::atomic<size_t>     m_tail{0}; // producer position
+    std::atomic<bool>       m_closed{false};
+
+    std::atomic<int>        m_waiters{0};
+    std::mutex              m_mutex;
+    std::condition_variable m_cond;
+};
+
+} // namespace av
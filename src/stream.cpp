@@ -121,6 +121,16 @@ void Stream::setAverageFrameRate(const Rational &frameRate)
     RAW_SET2(isValid(), avg_frame_rate, frameRate.getValue());
 }
 
+void Stream::setDiscard(AVDiscard discard)
+{
+    RAW_SET2(isValid(), discard, discard);
+}
+
+AVDiscard Stream::discard() const
+{
+    return RAW_GET2(isValid(), discard, AVDISCARD_DEFAULT);
+}
+
 int Stream::eventFlags() const noexcept
 {
     if (!isValid() || m_direction != Direction::Decoding)
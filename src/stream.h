@@ -55,6 +55,14 @@ public:
     void setSampleAspectRatio(const Rational &aspectRatio);
     void setAverageFrameRate(const Rational &frameRate);
 
+    /**
+     * Demuxer-side packets selection. AVDISCARD_ALL skips stream at all: its packets are not
+     * returned by FormatContext::readPacket(), and demuxers that support it do not read them.
+     * @see FormatContext::selectStreams()
+     */
+    void      setDiscard(AVDiscard discard);
+    AVDiscard discard() const;
+
     /**
      * Flags to the user to detect events happening on the stream.
      * A combination of AVSTREAM_EVENT_FLAG_*. Must be cleared by the user.
@@ -0,0 +1,210 @@
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <cerrno>
+
+#include "writebehindio.h"
+
+extern "C" {
+#include <libavutil/mem.h>
+}
+
+namespace av {
+
+WriteBehindIO::WriteBehindIO(CustomIO &sink, size_t chunkSize, size_t chunks)
+    : m_sink(sink),
+      m_chunkSize((std::max<size_t>(chunkSize, 1) + ChunkAlignment - 1) / ChunkAlignment * ChunkAlignment)
+{
+    m_chunks.resize(std::max<size_t>(chunks, 2));
+    for (auto &chunk : m_chunks) {
+        chunk.data = static_cast<uint8_t*>(av_malloc(m_chunkSize));
+        if (chunk.data)
+            m_free.push_back(&chunk);
+    }
+}
+
+WriteBehindIO::~WriteBehindIO()
+{
+    std::error_code ec;
+    close(ec);
+
+    for (auto &chunk : m_chunks)
+        av_freep(&chunk.data);
+}
+
+int WriteBehindIO::flush()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return sync(lock);
+}
+
+void WriteBehindIO::close(OptionalErrorCode ec)
+{
+    clear_if(ec);
+
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        sync(lock);
+        m_stop = true;
+    }
+    m_cond.notify_all();
+
+    if (m_thread.joinable())
+        m_thread.join();
+
+    int error;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop  = false;
+        error   = m_error;
+        m_error = 0;
+    }
+
+    if (error < 0)
+        throws_if(ec, error, ffmpeg_category());
+}
+
+WriteBehindIO::Stats WriteBehindIO::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+int WriteBehindIO::write(const uint8_t *data, size_t size)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_error < 0)
+        return m_error;
+
+    start();
+
+    size = std::min(size, static_cast<size_t>(INT_MAX));
+    size_t written = 0;
+    while (written < size) {
+        if (!m_current && !takeFreeChunk(lock))
+            return m_error < 0 ? m_error : AVERROR(ENOMEM);
+
+        const size_t count = std::min(size - written, m_chunkSize - m_current->size);
+        std::memcpy(m_current->data + m_current->size, data + written, count);
+        m_current->size += count;
+        written         += count;
+
+        if (m_current->size == m_chunkSize)
+            queueCurrent();
+    }
+
+    return static_cast<int>(written);
+}
+
+int WriteBehindIO::read(uint8_t *data, size_t size)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    const int sts = sync(lock);
+    if (sts < 0)
+        return sts;
+    return m_sink.read(data, size);
+}
+
+int64_t WriteBehindIO::seek(int64_t offset, int whence)
+{
+    // Sink position and size must include queued data. Writer is idle after sync() and the lock
+    // keeps it so.
+    std::unique_lock<std::mutex> lock(m_mutex);
+    const int sts = sync(lock);
+    if (sts < 0)
+        return sts;
+    return m_sink.seek(offset, whence);
+}
+
+int WriteBehindIO::seekable() const
+{
+    return m_sink.seekable();
+}
+
+const char *WriteBehindIO::name() const
+{
+    return m_sink.name();
+}
+
+void WriteBehindIO::start()
+{
+    if (!m_thread.joinable())
+        m_thread = std::thread([this] { writeLoop(); });
+}
+
+void WriteBehindIO::writeLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_cond.wait(lock, [this] { return m_stop || !m_queued.empty(); });
+        if (m_queued.empty())
+            break;
+
+        Chunk *chunk = m_queued.front();
+        m_queued.pop_front();
+
+        // Data after the error are dropped: output is broken anyway
+        int sts = 0;
+        if (m_error == 0) {
+            m_busy = true;
+            lock.unlock();
+            sts = m_sink.write(chunk->data, chunk->size);
+            lock.lock();
+            m_busy = false;
+        }
+
+        if (sts < 0) {
+            m_error = sts;
+        } else if (m_error == 0) {
+            m_stats.bytesWritten += chunk->size;
+            ++m_stats.chunksWritten;
+        }
+
+        chunk->size = 0;
+        m_free.push_back(chunk);
+        m_cond.notify_all();
+    }
+}
+
+bool WriteBehindIO::takeFreeChunk(std::unique_lock<std::mutex> &lock)
+{
+    if (m_free.empty()) {
+        // Nothing in flight: chunks were not allocated
+        if (m_error < 0 || (m_queued.empty() && !m_busy))
+            return false;
+
+        ++m_stats.writerWaits;
+        m_cond.wait(lock, [this] { return !m_free.empty() || m_error < 0; });
+        if (m_error < 0)
+            return false;
+    }
+
+    m_current = m_free.front();
+    m_free.pop_front();
+    m_current->size = 0;
+    return true;
+}
+
+void WriteBehindIO::queueCurrent()
+{
+    if (!m_current || !m_current->size)
+        return;
+
+    m_queued.push_back(m_current);
+    m_current = nullptr;
+    m_cond.notify_all();
+}
+
+int WriteBehindIO::sync(std::unique_lock<std::mutex> &lock)
+{
+    queueCurrent();
+
+    if (!m_queued.empty() || m_busy) {
+        ++m_stats.syncs;
+        m_cond.wait(lock, [this] { return m_queued.empty() && !m_busy; });
+    }
+
+    return m_error;
+}
+
+} // namespace av
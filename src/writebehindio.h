@@ -0,0 +1,110 @@
+#pragma once
+
+#include <mutex>
+#include <deque>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include "ffmpeg.h"
+#include "averror.h"
+#include "avutils.h"
+#include "formatcontext.h"
+
+namespace av {
+
+/**
+ * @brief The WriteBehindIO class - asynchronous write buffering decorator for the output CustomIO
+ *
+ * write() copies data into the current chunk and returns immediately. Full chunks are passed to
+ * the background thread that writes them to the sink, so the muxer (and encoder behind it) waits
+ * for the sink only when all chunks are in flight. Two chunks (double buffering) are enough for
+ * the steady sink, more chunks smooth out sink latency spikes.
+ *
+ * Chunks are allocated with av_malloc() and their size is rounded up to ChunkAlignment, so sink
+ * gets large aligned writes.
+ *
+ * Queued data are written before the sink is accessed otherwise: seek() (e.g. MP4 moov
+ * patching), read(), flush() and close(). Sink error is reported by the next write(), seek() or
+ * flush() call, data written after it are dropped.
+ *
+ * Call close() after FormatContext::writeTrailer() to get the final status: destructor closes
+ * silently.
+ */
+class WriteBehindIO : public CustomIO, public noncopyable
+{
+public:
+    static constexpr size_t DefaultChunkSize = 1024 * 1024;
+    static constexpr size_t DefaultChunks    = 2;
+    static constexpr size_t ChunkAlignment   = 4096;
+
+    struct Stats
+    {
+        uint64_t bytesWritten  = 0; ///< bytes passed to the sink
+        size_t   chunksWritten = 0;
+        size_t   writerWaits   = 0; ///< times write() waited for the free chunk
+        size_t   syncs         = 0; ///< waits for the queued data: seek(), read(), flush()
+    };
+
+    /**
+     * @param sink       decorated output, must outlive this object
+     * @param chunkSize  size of the single chunk
+     * @param chunks     chunks count, at least 2
+     */
+    explicit WriteBehindIO(CustomIO &sink, size_t chunkSize = DefaultChunkSize, size_t chunks = DefaultChunks);
+    ~WriteBehindIO();
+
+    /**
+     * @brief flush - pass buffered data to the sink and wait until it is written
+     * @return 0 or sink error
+     */
+    int flush();
+
+    /**
+     * @brief close - flush and stop background thread, write() starts it again
+     *
+     * @param[in,out] ec     this represents the error status on exit, if this is pre-initialized to
+     *                       av#throws the function will throw on error instead
+     */
+    void close(OptionalErrorCode ec = throws());
+
+    Stats stats() const;
+
+    // CustomIO
+    int         write(const uint8_t *data, size_t size) override;
+    int         read(uint8_t *data, size_t size) override;
+    int64_t     seek(int64_t offset, int whence) override;
+    int         seekable() const override;
+    const char* name() const override;
+
+private:
+    struct Chunk
+    {
+        uint8_t *data = nullptr;
+        size_t   size = 0;
+    };
+
+    void start();
+    void writeLoop();
+    bool takeFreeChunk(std::unique_lock<std::mutex> &lock);
+    void queueCurrent();
+    int  sync(std::unique_lock<std::mutex> &lock);
+
+private:
+    CustomIO               &m_sink;
+    const size_t            m_chunkSize;
+    std::vector<Chunk>      m_chunks;
+
+    mutable std::mutex      m_mutex;
+    std::condition_variable m_cond;
+    std::deque<Chunk*>      m_free;
+    std::deque<Chunk*>      m_queued;
+    Chunk                  *m_current = nullptr;
+    bool                    m_busy    = false; // writer thread writes the chunk
+    bool                    m_stop    = false;
+    int                     m_error   = 0;
+    std::thread             m_thread;
+    Stats                   m_stats;
+};
+
+} // namespace av
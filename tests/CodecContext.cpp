@@ -0,0 +1,127 @@
+#include <catch2/catch.hpp>
+
+#include <vector>
+#include <system_error>
+
+#include "codec.h"
+#include "codeccontext.h"
+
+#ifdef _MSC_VER
+# pragma warning (disable : 4702) // Disable warning: unreachable code
+#endif
+
+#ifdef AV_CODEC_CAP_OTHER_THREADS
+
+namespace {
+
+// Decoders that run own thread pool, availability depends on FFmpeg build
+const char * const own_threads_decoders[] = {
+    "libdav1d",
+    "libaom-av1",
+    "libvpx-vp9",
+};
+
+}
+
+TEST_CASE("Codec threads budget", "[CodecContext][Threads]")
+{
+    SECTION("Codec with own threads keeps reservation") {
+        av::Codec codec;
+        for (auto name : own_threads_decoders) {
+            auto candidate = av::findDecodingCodec(name);
+            if (!candidate.isNull() && (candidate.raw()->capabilities & AV_CODEC_CAP_OTHER_THREADS)) {
+                codec = candidate;
+                break;
+            }
+        }
+
+        if (codec.isNull()) {
+            WARN("No decoder with own threads available, skipped");
+            return;
+        }
+
+        av::CodecContext2::setThreadBudget(8);
+        {
+            av::VideoDecoderContext ctx{codec};
+            ctx.setThreadCount(4);
+
+            std::error_code ec;
+            ctx.open(ec);
+            REQUIRE(!ec);
+
+            CHECK(ctx.threadingInfo().reservedThreads == 4);
+            CHECK(av::CodecContext2::threadBudgetUsed() == 4);
+        }
+        CHECK(av::CodecContext2::threadBudgetUsed() == 0);
+        av::CodecContext2::setThreadBudget(0);
+    }
+}
+#endif
+
+TEST_CASE("Audio encoder frame size chunking", "[CodecContext][AudioEncoder]")
+{
+    // Fixed frame size encoder without small last frame support: 1152 samples per frame
+    auto codec = av::findEncodingCodec("mp2");
+    if (codec.isNull()) {
+        WARN("mp2 encoder is not available, skipped");
+        return;
+    }
+
+    constexpr int sampleRate = 44100;
+    const av::Rational timeBase{1, sampleRate};
+
+    av::AudioEncoderContext encoder{codec};
+    encoder.setSampleRate(sampleRate);
+    encoder.setSampleFormat(AV_SAMPLE_FMT_S16);
+    encoder.setChannelLayout(AV_CH_LAYOUT_STEREO);
+    encoder.setChannels(2);
+    encoder.setTimeBase(timeBase);
+    encoder.setBitRate(128000);
+
+    std::error_code ec;
+    encoder.open(ec);
+    REQUIRE(!ec);
+
+    const int frameSize = encoder.frameSize();
+    REQUIRE(frameSize == 1152);
+
+    std::vector<int64_t> pts;
+    auto collect = [&pts, &timeBase](av::Packet &packet) {
+        pts.push_back(packet.pts().timestamp(timeBase));
+    };
+
+    auto make_samples = [&](int count, int64_t start) {
+        av::AudioSamples samples{AV_SAMPLE_FMT_S16, count, AV_CH_LAYOUT_STEREO, sampleRate};
+        samples.setPts(av::Timestamp(start, timeBase));
+        return samples;
+    };
+
+    SECTION("Partial chunks and short last chunk") {
+        int64_t next = 0;
+        for (int i = 0; i < 5; ++i) {
+            encoder.encodeChunked(make_samples(1000, next), collect, ec);
+            REQUIRE(!ec);
+            next += 1000;
+
+            // Only full chunks are encoded, the rest waits in the FIFO
+            CHECK(pts.size() == static_cast<size_t>(next / frameSize));
+            CHECK(encoder.bufferedSamples() == next % frameSize);
+        }
+
+        // Tail 5000 - 4 * 1152 = 392 samples is padded to the full frame
+        encoder.encodeChunked(av::AudioSamples(nullptr), collect, ec);
+        REQUIRE(!ec);
+        CHECK(encoder.bufferedSamples() == 0);
+
+        REQUIRE(pts.size() == 5);
+        for (size_t i = 0; i < pts.size(); ++i)
+            CHECK(pts[i] == static_cast<int64_t>(i) * frameSize);
+    }
+
+    SECTION("Exact frame size bypasses FIFO") {
+        encoder.encodeChunked(make_samples(frameSize, 0), collect, ec);
+        REQUIRE(!ec);
+        CHECK(encoder.bufferedSamples() == 0);
+        CHECK(pts.size() == 1);
+    }
+}
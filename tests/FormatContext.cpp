@@ -0,0 +1,186 @@
+#include <catch2/catch.hpp>
+
+#include <cinttypes>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "format.h"
+#include "formatcontext.h"
+#include "packet.h"
+
+#ifdef _MSC_VER
+# pragma warning (disable : 4702) // Disable warning: unreachable code
+#endif
+
+namespace {
+
+const av::Rational TimeBase{1, 1000};
+
+struct MemoryOutput : public av::CustomIO
+{
+    int write(const uint8_t *data, size_t size) override
+    {
+        buffer.append(reinterpret_cast<const char*>(data), size);
+        return static_cast<int>(size);
+    }
+
+    std::string buffer;
+};
+
+// framecrc muxer writes line per packet: stream index, DTS, PTS, duration, size, CRC
+bool open_output(av::FormatContext &octx, MemoryOutput &io, size_t streams)
+{
+    auto format = av::guessOutputFormat("framecrc");
+    if (format.isNull())
+        return false;
+
+    octx.setFormat(format);
+    for (size_t i = 0; i < streams; ++i) {
+        auto st = octx.addStream(av::Codec());
+        st.raw()->codecpar->codec_type = AVMEDIA_TYPE_DATA;
+        st.raw()->codecpar->codec_id   = AV_CODEC_ID_BIN_DATA;
+        st.setTimeBase(TimeBase);
+    }
+
+    octx.openOutput(&io);
+    octx.writeHeader();
+    return true;
+}
+
+av::Packet make_packet(int streamIndex, int64_t dts, size_t size = 16)
+{
+    std::vector<uint8_t> data(size, static_cast<uint8_t>(dts));
+    av::Packet packet{data};
+    packet.setStreamIndex(streamIndex);
+    packet.setDts(av::Timestamp(dts, TimeBase));
+    packet.setPts(av::Timestamp(dts, TimeBase));
+    return packet;
+}
+
+// (stream index, DTS) of the written packets
+std::vector<std::pair<int, int64_t>> written_packets(const std::string &output)
+{
+    std::vector<std::pair<int, int64_t>> result;
+    std::istringstream in(output);
+    std::string line;
+    while (std::getline(in, line)) {
+        int index;
+        int64_t dts;
+        if (line.empty() || line[0] == '#' || std::sscanf(line.c_str(), "%d, %" SCNd64, &index, &dts) != 2)
+            continue;
+        result.emplace_back(index, dts);
+    }
+    return result;
+}
+
+}
+
+TEST_CASE("FormatContext interleaver", "[FormatContext][Interleaver]")
+{
+    av::FormatContext octx;
+    MemoryOutput io;
+    if (!open_output(octx, io, 2)) {
+        WARN("framecrc muxer is not available, skipped");
+        return;
+    }
+
+    SECTION("Packets are written in DTS order") {
+        octx.enableInterleaver();
+        CHECK(octx.isInterleaverEnabled());
+
+        octx.writePacket(make_packet(0, 0));
+        octx.writePacket(make_packet(0, 40));
+        // Other stream is empty: nothing written
+        CHECK(octx.interleaveStats().bufferedPackets == 2);
+
+        octx.writePacket(make_packet(1, 20));
+        // Every stream got a packet: written up to the end of the stream 1 queue
+        CHECK(octx.interleaveStats().bufferedPackets == 1);
+
+        octx.writePacket(make_packet(1, 60));
+        octx.writePacket(make_packet(0, 80));
+
+        // Flush writes everything buffered
+        octx.writePacket();
+        CHECK(octx.interleaveStats().bufferedPackets == 0);
+        CHECK(octx.interleaveStats().bufferedBytes == 0);
+        CHECK(octx.interleaveStats().skewWrites == 0);
+
+        octx.writeTrailer();
+
+        const std::vector<std::pair<int, int64_t>> expected = {
+            {0, 0}, {1, 20}, {0, 40}, {1, 60}, {0, 80},
+        };
+        CHECK(written_packets(io.buffer) == expected);
+    }
+
+    SECTION("DTS skew forces write of the lagging packets") {
+        // 1 second
+        octx.enableInterleaver(AV_TIME_BASE, 0);
+
+        // Stream 1 is silent
+        octx.writePacket(make_packet(0, 0));
+        octx.writePacket(make_packet(0, 500));
+        octx.writePacket(make_packet(0, 1000));
+        CHECK(octx.interleaveStats().bufferedPackets == 3);
+
+        // 0 and 500 are more than 1 second behind
+        octx.writePacket(make_packet(0, 1600));
+        CHECK(octx.interleaveStats().skewWrites == 2);
+        CHECK(octx.interleaveStats().bufferedPackets == 2);
+
+        octx.writeTrailer();
+        CHECK(written_packets(io.buffer).size() == 4);
+    }
+
+    SECTION("Byte budget, earliest packets") {
+        octx.enableInterleaver(0, 250, av::FormatContext::InterleaveFlush::Earliest);
+
+        octx.writePacket(make_packet(0, 0, 100));
+        octx.writePacket(make_packet(0, 10, 100));
+        CHECK(octx.interleaveStats().forcedFlushes == 0);
+        CHECK(octx.interleaveStats().bufferedBytes == 200);
+
+        octx.writePacket(make_packet(0, 20, 100));
+        auto stats = octx.interleaveStats();
+        CHECK(stats.forcedFlushes == 1);
+        CHECK(stats.peakBufferedBytes == 300);
+        CHECK(stats.bufferedBytes == 200);
+        CHECK(stats.bufferedPackets == 2);
+
+        octx.writeTrailer();
+        const std::vector<std::pair<int, int64_t>> expected = {
+            {0, 0}, {0, 10}, {0, 20},
+        };
+        CHECK(written_packets(io.buffer) == expected);
+    }
+
+    SECTION("Byte budget, all packets") {
+        octx.enableInterleaver(0, 250, av::FormatContext::InterleaveFlush::All);
+
+        octx.writePacket(make_packet(1, 0, 100));
+        octx.writePacket(make_packet(1, 10, 100));
+        octx.writePacket(make_packet(1, 20, 100));
+
+        const auto stats = octx.interleaveStats();
+        CHECK(stats.forcedFlushes == 1);
+        CHECK(stats.bufferedBytes == 0);
+        CHECK(stats.bufferedPackets == 0);
+    }
+
+    SECTION("Disable writes buffered packets") {
+        octx.enableInterleaver();
+        octx.writePacket(make_packet(0, 0));
+        octx.writePacket(make_packet(0, 10));
+
+        octx.disableInterleaver();
+        CHECK_FALSE(octx.isInterleaverEnabled());
+        CHECK(octx.interleaveStats().bufferedPackets == 0);
+
+        octx.writeTrailer();
+        CHECK(written_packets(io.buffer).size() == 2);
+    }
+}
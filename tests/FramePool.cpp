@@ -0,0 +1,178 @@
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "codec.h"
+#include "codeccontext.h"
+#include "framepool.h"
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+}
+
+#ifdef _MSC_VER
+# pragma warning (disable : 4702) // Disable warning: unreachable code
+#endif
+
+namespace {
+
+constexpr int Width  = 176;
+constexpr int Height = 100;
+constexpr int Frames = 4;
+
+struct Stream
+{
+    std::string             name;
+    av::Codec               decoder;
+    std::vector<av::Packet> packets;
+};
+
+// Encoders with different decoder alignment requirements for the same frame size, availability
+// depends on FFmpeg build
+const struct
+{
+    const char    *encoder;
+    AVPixelFormat  format;
+} candidates[] = {
+    {"libx264",    AV_PIX_FMT_YUV420P},
+    {"mpeg4",      AV_PIX_FMT_YUV420P},
+    {"mpeg2video", AV_PIX_FMT_YUV420P},
+    {"mjpeg",      AV_PIX_FMT_YUVJ420P},
+};
+
+bool encode(const char *name, AVPixelFormat format, Stream &stream)
+{
+    auto codec = av::findEncodingCodec(name);
+    if (codec.isNull())
+        return false;
+
+    const av::Rational timeBase{1, 25};
+
+    av::VideoEncoderContext encoder{codec};
+    encoder.setWidth(Width);
+    encoder.setHeight(Height);
+    encoder.setPixelFormat(format);
+    encoder.setTimeBase(timeBase);
+
+    std::error_code ec;
+    encoder.open(ec);
+    if (ec)
+        return false;
+
+    auto collect = [&stream](av::Packet &packet) {
+        stream.packets.push_back(packet);
+    };
+
+    for (int i = 0; i < Frames; ++i) {
+        av::VideoFrame frame{format, Width, Height, 32};
+        for (int plane = 0; plane < 3; ++plane) {
+            const int rows = plane ? Height / 2 : Height;
+            std::memset(frame.raw()->data[plane], 16 * (i + plane), size_t(frame.raw()->linesize[plane]) * rows);
+        }
+        frame.setTimeBase(timeBase);
+        frame.setPts(av::Timestamp(i, timeBase));
+        encoder.encodeAll(frame, collect, ec);
+        REQUIRE(!ec);
+    }
+    encoder.encodeAll(av::VideoFrame::null(), collect, ec);
+    REQUIRE(!ec);
+
+    stream.name    = name;
+    stream.decoder = av::findDecodingCodec(codec.id());
+    return !stream.decoder.isNull() && !stream.packets.empty();
+}
+
+// Decoder writes up to the aligned dimensions: every plane must fit pooled buffer
+void check_buffer(const av::VideoDecoderContext &decoder, const av::VideoFrame &frame)
+{
+    const AVFrame *raw = frame.raw();
+
+    int w = raw->width;
+    int h = raw->height;
+    int linesizeAlign[AV_NUM_DATA_POINTERS];
+    avcodec_align_dimensions2(const_cast<AVCodecContext*>(decoder.raw()), &w, &h, linesizeAlign);
+
+    const auto desc = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(raw->format));
+    REQUIRE(desc);
+
+    for (int plane = 0; plane < 3 && raw->data[plane]; ++plane) {
+        const AVBufferRef *buf = av_frame_get_plane_buffer(const_cast<AVFrame*>(raw), plane);
+        REQUIRE(buf);
+
+        const int rows = plane ? AV_CEIL_RSHIFT(h, desc->log2_chroma_h) : h;
+        CHECK(raw->linesize[plane] % linesizeAlign[plane] == 0);
+        CHECK(raw->data[plane] + size_t(raw->linesize[plane]) * rows <= buf->data + buf->size);
+    }
+}
+
+}
+
+TEST_CASE("FramePool", "[FramePool]")
+{
+    SECTION("Same frame size decoded by different codecs") {
+        std::vector<Stream> streams;
+        for (const auto &candidate : candidates) {
+            Stream stream;
+            if (encode(candidate.encoder, candidate.format, stream))
+                streams.push_back(std::move(stream));
+        }
+
+        if (streams.size() < 2) {
+            WARN("Less than two suitable codecs available, skipped");
+            return;
+        }
+
+        auto pool = std::make_shared<av::FramePool>();
+
+        std::vector<av::VideoDecoderContext> decoders;
+        for (auto &stream : streams) {
+            av::VideoDecoderContext decoder{stream.decoder};
+            decoder.setThreadCount(1);
+            decoder.setFramePool(pool);
+
+            std::error_code ec;
+            decoder.open(ec);
+            REQUIRE(!ec);
+            decoders.push_back(std::move(decoder));
+        }
+
+        size_t packets = 0;
+        for (const auto &stream : streams)
+            packets = std::max(packets, stream.packets.size());
+
+        // Decoders take buffers from the same pool in turn, empty packet flushes decoder
+        std::vector<size_t> decoded(streams.size());
+        for (size_t i = 0; i <= packets; ++i) {
+            for (size_t s = 0; s < streams.size(); ++s) {
+                if (i > streams[s].packets.size())
+                    continue;
+
+                INFO(streams[s].name);
+                auto &decoder = decoders[s];
+                auto check = [&](av::VideoFrame &frame) {
+                    CHECK(frame.width() == Width);
+                    CHECK(frame.height() == Height);
+                    check_buffer(decoder, frame);
+                    ++decoded[s];
+                };
+
+                const bool flush = i == streams[s].packets.size();
+                decoder.decodeAll(flush ? av::Packet() : streams[s].packets[i], check);
+            }
+        }
+
+        for (size_t s = 0; s < streams.size(); ++s) {
+            INFO(streams[s].name);
+            CHECK(decoded[s] == Frames);
+        }
+
+        decoders.clear();
+        const auto stats = pool->stats();
+        CHECK(stats.live == 0);
+        CHECK(stats.recycled > 0);
+    }
+}
@@ -0,0 +1,153 @@
+#include <catch2/catch.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include "dictionary.h"
+#include "format.h"
+#include "formatcontext.h"
+#include "multidemuxer.h"
+
+#ifdef _MSC_VER
+# pragma warning (disable : 4702) // Disable warning: unreachable code
+#endif
+
+namespace {
+
+// Raw unsigned 8-bit PCM: same size, other duration
+const struct
+{
+    const char *path;
+    const char *sampleRate;
+} inputs[] = {
+    {"multidemuxer-test.0.u8", "8000"},
+    {"multidemuxer-test.1.u8", "4000"},
+};
+
+constexpr size_t InputSize = 16000;
+
+void write_input(const char *path)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << std::string(InputSize, '\x80');
+}
+
+std::unique_ptr<av::FormatContext> open_input(size_t index, bool findStreamInfo = true)
+{
+    auto format = std::make_unique<av::FormatContext>();
+    format->openInput(inputs[index].path, av::Dictionary{{"sample_rate", inputs[index].sampleRate}},
+                      av::InputFormat("u8"));
+    if (findStreamInfo)
+        format->findStreamInfo();
+    return format;
+}
+
+size_t packets_count(size_t index)
+{
+    auto format = open_input(index);
+    size_t count = 0;
+    while (format->readPacket())
+        ++count;
+    return count;
+}
+
+}
+
+TEST_CASE("MultiDemuxer", "[MultiDemuxer]")
+{
+    if (av::InputFormat("u8").isNull()) {
+        WARN("u8 demuxer is not available, skipped");
+        return;
+    }
+
+    for (const auto &input : inputs)
+        write_input(input.path);
+
+    SECTION("Packets of two inputs are merged in the time order") {
+        const size_t expected[] = {packets_count(0), packets_count(1)};
+        REQUIRE(expected[0] > 1);
+        REQUIRE(expected[1] > 1);
+
+        av::MultiDemuxer demuxer{4};
+        CHECK(demuxer.addInput(open_input(0)) == 0);
+        CHECK(demuxer.addInput(open_input(1)) == 1);
+        REQUIRE(demuxer.streamsCount() == 2);
+
+        size_t count[2] = {};
+        av::Timestamp last;
+        while (auto packet = demuxer.readPacket()) {
+            REQUIRE(packet.streamIndex() >= 0);
+            REQUIRE(packet.streamIndex() < 2);
+            ++count[packet.streamIndex()];
+
+            const auto ts = packet.ts();
+            REQUIRE_FALSE(ts.isNoPts());
+            if (!last.isNoPts())
+                CHECK_FALSE(ts < last);
+            last = ts;
+        }
+
+        CHECK(count[0] == expected[0]);
+        CHECK(count[1] == expected[1]);
+    }
+
+    SECTION("Streams are numbered globally") {
+        av::MultiDemuxer demuxer;
+        demuxer.addInput(open_input(0));
+        demuxer.addInput(open_input(1));
+
+        REQUIRE(demuxer.streamsCount() == 2);
+        CHECK(demuxer.globalStreamIndex(0, 0) == 0);
+        CHECK(demuxer.globalStreamIndex(1, 0) == 1);
+        CHECK(demuxer.globalStreamIndex(1, 1) == -1);
+        CHECK(demuxer.globalStreamIndex(2, 0) == -1);
+
+        const auto mapping = demuxer.streamMapping(1);
+        CHECK(mapping.input == 1);
+        CHECK(mapping.stream == 0);
+        CHECK(demuxer.stream(1).timeBase() == demuxer.input(1).stream(0).timeBase());
+
+        std::error_code ec;
+        demuxer.streamMapping(2, ec);
+        CHECK(ec);
+        demuxer.stream(2, ec);
+        CHECK(ec);
+    }
+
+    SECTION("Read error of every input is reported") {
+        // Streams info is not found: input fails on the first read
+        av::MultiDemuxer demuxer;
+        demuxer.addInput(open_input(0, false));
+        demuxer.addInput(open_input(1, false));
+        demuxer.addInput(open_input(0));
+
+        size_t errors  = 0;
+        size_t packets = 0;
+        for (;;) {
+            std::error_code ec;
+            auto packet = demuxer.readPacket(ec);
+            if (ec) {
+                CHECK(ec == av::Errors::FormatNoStreams);
+                ++errors;
+                continue;
+            }
+            if (!packet)
+                break;
+            CHECK(packet.streamIndex() == 2);
+            ++packets;
+        }
+
+        CHECK(errors == 2);
+        CHECK(packets == packets_count(0));
+
+        // Reported once
+        std::error_code ec;
+        CHECK_FALSE(demuxer.readPacket(ec));
+        CHECK(!ec);
+    }
+
+    for (const auto &input : inputs)
+        std::remove(input.path);
+}
@@ -0,0 +1,214 @@
+#include <catch2/catch.hpp>
+
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "format.h"
+#include "formatcontext.h"
+#include "muxerqueue.h"
+#include "packet.h"
+
+#ifdef _MSC_VER
+# pragma warning (disable : 4702) // Disable warning: unreachable code
+#endif
+
+namespace {
+
+const av::Rational TimeBase{1, 1000};
+
+struct MemoryOutput : public av::CustomIO
+{
+    int write(const uint8_t *data, size_t size) override
+    {
+        buffer.append(reinterpret_cast<const char*>(data), size);
+        return static_cast<int>(size);
+    }
+
+    std::string buffer;
+};
+
+// framecrc muxer writes line per packet: stream index, DTS, PTS, duration, size, CRC
+bool open_output(av::FormatContext &octx, MemoryOutput &io, size_t streams)
+{
+    auto format = av::guessOutputFormat("framecrc");
+    if (format.isNull())
+        return false;
+
+    octx.setFormat(format);
+    for (size_t i = 0; i < streams; ++i) {
+        auto st = octx.addStream(av::Codec());
+        st.raw()->codecpar->codec_type = AVMEDIA_TYPE_DATA;
+        st.raw()->codecpar->codec_id   = AV_CODEC_ID_BIN_DATA;
+        st.setTimeBase(TimeBase);
+    }
+
+    octx.openOutput(&io);
+    octx.writeHeader();
+    return true;
+}
+
+av::Packet make_packet(int streamIndex, int64_t dts, size_t size = 16)
+{
+    std::vector<uint8_t> data(size, static_cast<uint8_t>(dts));
+    av::Packet packet{data};
+    packet.setStreamIndex(streamIndex);
+    packet.setDts(av::Timestamp(dts, TimeBase));
+    packet.setPts(av::Timestamp(dts, TimeBase));
+    return packet;
+}
+
+// (stream index, DTS) of the written packets
+std::vector<std::pair<int, int64_t>> written_packets(const std::string &output)
+{
+    std::vector<std::pair<int, int64_t>> result;
+    std::istringstream in(output);
+    std::string line;
+    while (std::getline(in, line)) {
+        int index;
+        int64_t dts;
+        if (line.empty() || line[0] == '#' || std::sscanf(line.c_str(), "%d, %" SCNd64, &index, &dts) != 2)
+            continue;
+        result.emplace_back(index, dts);
+    }
+    return result;
+}
+
+// Writer works asynchronously: wait for the expected progress
+bool wait_written(const av::MuxerQueue &queue, size_t packets)
+{
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (queue.stats().packetsWritten < packets) {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+}
+
+TEST_CASE("MuxerQueue", "[MuxerQueue]")
+{
+    av::FormatContext octx;
+    MemoryOutput io;
+    if (!open_output(octx, io, 3)) {
+        WARN("framecrc muxer is not available, skipped");
+        return;
+    }
+
+    SECTION("Packets of several producers are written in DTS order") {
+        constexpr int Streams = 3;
+        constexpr int Packets = 50;
+
+        // Queues hold all packets: slow producer does not force writes
+        av::MuxerQueue queue{octx};
+        queue.start();
+
+        // Stream s: DTS s * 10, s * 10 + 30, ... unique across streams
+        std::vector<std::thread> producers;
+        for (int s = 0; s < Streams; ++s) {
+            producers.emplace_back([&queue, s] {
+                for (int i = 0; i < Packets; ++i)
+                    queue.push(make_packet(s, i * 30 + s * 10));
+                queue.finishStream(static_cast<size_t>(s));
+            });
+        }
+        for (auto &producer : producers)
+            producer.join();
+
+        queue.finish();
+        octx.writeTrailer();
+
+        std::vector<std::pair<int, int64_t>> expected;
+        for (int i = 0; i < Packets; ++i) {
+            for (int s = 0; s < Streams; ++s)
+                expected.emplace_back(s, i * 30 + s * 10);
+        }
+        CHECK(written_packets(io.buffer) == expected);
+
+        const auto stats = queue.stats();
+        CHECK(stats.packetsWritten == size_t(Streams * Packets));
+        CHECK(stats.bytesWritten == uint64_t(Streams * Packets * 16));
+        CHECK(stats.forcedWrites == 0);
+    }
+
+    SECTION("Finished stream is not waited") {
+        av::MuxerQueue queue{octx};
+        // Streams without packets are waited always
+        queue.setMaxInterleaveDelta(0);
+        queue.start();
+
+        queue.push(make_packet(0, 0));
+        queue.push(make_packet(0, 10));
+        queue.push(make_packet(1, 5));
+        queue.finishStream(1);
+        queue.finishStream(2);
+
+        // Only stream 0 is active: written without finish()
+        CHECK(wait_written(queue, 3));
+
+        std::error_code ec;
+        queue.push(make_packet(1, 20), ec);
+        CHECK(ec == std::error_code(EPIPE, std::system_category()));
+
+        queue.finish();
+        octx.writeTrailer();
+
+        const std::vector<std::pair<int, int64_t>> expected = {
+            {0, 0}, {1, 5}, {0, 10},
+        };
+        CHECK(written_packets(io.buffer) == expected);
+        CHECK(queue.stats().forcedWrites == 0);
+    }
+
+    SECTION("Full queue forces write") {
+        av::MuxerQueue queue{octx, 2};
+        queue.setMaxInterleaveDelta(0);
+        queue.start();
+
+        // Streams 1 and 2 are silent: stream 0 head and full queue of two packets stay unwritten
+        for (int i = 0; i < 5; ++i)
+            queue.push(make_packet(0, i * 10));
+
+        CHECK(wait_written(queue, 3));
+
+        queue.finish();
+        octx.writeTrailer();
+
+        CHECK(written_packets(io.buffer).size() == 5);
+        CHECK(queue.stats().forcedWrites == 3);
+    }
+
+    SECTION("Writer error is reported by push") {
+        av::MuxerQueue queue{octx};
+        queue.start();
+        queue.finishStream(1);
+        queue.finishStream(2);
+
+        // Muxer rejects non monotonic DTS
+        queue.push(make_packet(0, 100));
+        queue.push(make_packet(0, 50));
+
+        std::error_code ec;
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        for (int64_t dts = 200; !ec && std::chrono::steady_clock::now() < deadline; dts += 10) {
+            queue.push(make_packet(0, dts), ec);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        REQUIRE(ec);
+        CHECK(ec != std::error_code(EPIPE, std::system_category()));
+        CHECK(queue.stats().packetsWritten == 1);
+
+        std::error_code finishEc;
+        queue.finish(finishEc);
+        CHECK(finishEc == ec);
+    }
+}
@@ -79,6 +79,22 @@ TEST_CASE("Packet define", "[Packet][Construct]")
         CHECK(memcmp(pkt.data(), pkt_data, pkt.size()) == 0);
     }
 
+    SECTION("Reset packet") {
+        av::Packet pkt{pkt_data, sizeof(pkt_data)};
+        pkt.setPts({1000, {1, 1000}});
+        pkt.setStreamIndex(1);
+        pkt.setComplete(true);
+        const auto raw = pkt.raw();
+
+        pkt.reset();
+        CHECK(pkt.raw() == raw);
+        CHECK(pkt.isNull() == true);
+        CHECK(pkt.refCount() == 0);
+        CHECK(pkt.streamIndex() == -1);
+        CHECK(pkt.isComplete() == false);
+        CHECK(pkt.timeBase() == av::Rational());
+    }
+
     SECTION("Wrap data") {
         auto data = av::memdup<uint8_t>(pkt_data, sizeof(pkt_data));
         av::Packet pkt{data.get(), sizeof(pkt_data), av::Packet::wrap_data{}};
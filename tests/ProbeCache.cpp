@@ -0,0 +1,179 @@
+#include <catch2/catch.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include "dictionary.h"
+#include "format.h"
+#include "formatcontext.h"
+#include "probecache.h"
+
+#ifdef _MSC_VER
+# pragma warning (disable : 4702) // Disable warning: unreachable code
+#endif
+
+namespace {
+
+// Valid FFMETADATA file: no streams for the ffmetadata demuxer, single PCM stream for the raw
+// PCM demuxers
+const char MediaPath[] = "probecache-test.txt";
+
+void write_media()
+{
+    std::ofstream out(MediaPath, std::ios::binary | std::ios::trunc);
+    out << ";FFMETADATA1\n";
+    out << "title=probe cache test\n";
+    for (int i = 0; i < 256; ++i)
+        out << "; raw PCM payload for the probe cache test\n";
+}
+
+struct StreamInfo
+{
+    AVMediaType  type       = AVMEDIA_TYPE_UNKNOWN;
+    AVCodecID    codecId    = AV_CODEC_ID_NONE;
+    int          sampleRate = 0;
+    av::Rational timeBase;
+    int64_t      startTime  = 0;
+    int64_t      duration   = 0;
+};
+
+StreamInfo stream_info(av::FormatContext &format)
+{
+    const AVStream *st = format.raw()->streams[0];
+    StreamInfo info;
+    info.type       = st->codecpar->codec_type;
+    info.codecId    = st->codecpar->codec_id;
+    info.sampleRate = st->codecpar->sample_rate;
+    info.timeBase   = st->time_base;
+    info.startTime  = st->start_time;
+    info.duration   = st->duration;
+    return info;
+}
+
+// @return true if streams info restored from the cache
+bool open(av::ProbeCache &cache, av::FormatContext &format, const char *formatName,
+          av::Dictionary options = av::Dictionary())
+{
+    format.openInput(MediaPath, options, av::InputFormat(formatName));
+    return cache.findStreamInfo(format);
+}
+
+bool formats_available(std::initializer_list<const char*> names)
+{
+    for (auto name : names) {
+        if (av::InputFormat(name).isNull()) {
+            WARN(std::string(name) + " demuxer is not available, skipped");
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+TEST_CASE("ProbeCache", "[ProbeCache]")
+{
+    write_media();
+
+    SECTION("Serialize and restore round trip") {
+        if (!formats_available({"s16le"}))
+            return;
+
+        av::ProbeCache cache;
+
+        StreamInfo probed;
+        {
+            av::FormatContext format;
+            CHECK_FALSE(open(cache, format, "s16le"));
+            REQUIRE(format.streamsCount() == 1);
+            probed = stream_info(format);
+        }
+        CHECK(cache.size() == 1);
+
+        av::FormatContext format;
+        CHECK(open(cache, format, "s16le"));
+        REQUIRE(format.streamsCount() == 1);
+
+        const auto restored = stream_info(format);
+        CHECK(restored.type == probed.type);
+        CHECK(restored.codecId == AV_CODEC_ID_PCM_S16LE);
+        CHECK(restored.sampleRate == probed.sampleRate);
+        CHECK(restored.timeBase == probed.timeBase);
+        CHECK(restored.startTime == probed.startTime);
+        CHECK(restored.duration == probed.duration);
+
+        // Restored input is readable
+        auto packet = format.readPacket();
+        CHECK(packet.size() > 0);
+
+        CHECK(cache.stats().hits == 1);
+        CHECK(cache.stats().misses == 1);
+    }
+
+    SECTION("Other demuxer has own entry") {
+        if (!formats_available({"ffmetadata", "u8"}))
+            return;
+
+        av::ProbeCache cache;
+        {
+            av::FormatContext format;
+            CHECK_FALSE(open(cache, format, "ffmetadata"));
+            CHECK(format.streamsCount() == 0);
+        }
+        {
+            // Same file: entry without streams is not tried
+            av::FormatContext format;
+            CHECK_FALSE(open(cache, format, "u8"));
+            CHECK(format.streamsCount() == 1);
+        }
+        {
+            av::FormatContext format;
+            CHECK(open(cache, format, "u8"));
+            CHECK(stream_info(format).codecId == AV_CODEC_ID_PCM_U8);
+        }
+        {
+            av::FormatContext format;
+            CHECK(open(cache, format, "ffmetadata"));
+            CHECK(format.streamsCount() == 0);
+        }
+
+        CHECK(cache.size() == 2);
+        CHECK(cache.stats().hits == 2);
+        CHECK(cache.stats().misses == 2);
+    }
+
+    SECTION("Demuxer options are part of the key") {
+        if (!formats_available({"s16le"}))
+            return;
+
+        av::ProbeCache cache;
+        {
+            av::FormatContext format;
+            CHECK_FALSE(open(cache, format, "s16le"));
+            CHECK(stream_info(format).sampleRate == 44100);
+        }
+        {
+            av::FormatContext format;
+            CHECK_FALSE(open(cache, format, "s16le", {{"sample_rate", "8000"}}));
+            CHECK(stream_info(format).sampleRate == 8000);
+        }
+        {
+            av::FormatContext format;
+            CHECK(open(cache, format, "s16le", {{"sample_rate", "8000"}}));
+            CHECK(stream_info(format).sampleRate == 8000);
+        }
+        {
+            // Default value is the same as no option
+            av::FormatContext format;
+            CHECK(open(cache, format, "s16le", {{"sample_rate", "44100"}}));
+            CHECK(stream_info(format).sampleRate == 44100);
+        }
+
+        CHECK(cache.size() == 2);
+        CHECK(cache.stats().hits == 2);
+        CHECK(cache.stats().misses == 2);
+    }
+
+    std::remove(MediaPath);
+}
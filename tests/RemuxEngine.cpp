@@ -0,0 +1,95 @@
+#include <catch2/catch.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <future>
+#include <string>
+#include <thread>
+
+#include "remuxengine.h"
+
+#ifdef _MSC_VER
+# pragma warning (disable : 4702) // Disable warning: unreachable code
+#endif
+
+namespace {
+
+const char AbsentInput[] = "remuxengine-test.absent.ts";
+const char Output0[]     = "remuxengine-test.0.ts";
+const char Output1[]     = "remuxengine-test.1.ts";
+
+void write_file(const char *path)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << "not a job output";
+}
+
+bool file_exists(const char *path)
+{
+    return std::ifstream(path).good();
+}
+
+}
+
+TEST_CASE("RemuxEngine", "[RemuxEngine]")
+{
+    write_file(Output0);
+    write_file(Output1);
+
+    // Single worker is held by the first job callback: second job stays queued
+    std::promise<void> release;
+    auto released = release.get_future().share();
+
+    SECTION("Canceled queued job keeps existing output") {
+        av::RemuxEngine engine{1};
+        engine.setJobFinishedCallback([released](size_t job, const av::RemuxEngine::JobStats &) {
+            if (job == 0)
+                released.wait();
+        });
+
+        const auto failed   = engine.addJob(AbsentInput, Output0);
+        const auto canceled = engine.addJob(AbsentInput, Output1);
+        CHECK(engine.stats(canceled).state == av::RemuxEngine::State::Queued);
+
+        engine.cancel(canceled);
+        release.set_value();
+        engine.wait();
+
+        // Input is not opened: output is not touched
+        CHECK(engine.stats(failed).state == av::RemuxEngine::State::Failed);
+        CHECK(engine.stats(failed).error);
+        CHECK(file_exists(Output0));
+
+        CHECK(engine.stats(canceled).state == av::RemuxEngine::State::Canceled);
+        CHECK_FALSE(engine.stats(canceled).error);
+        CHECK(file_exists(Output1));
+    }
+
+    SECTION("Destructor cancels queued jobs and keeps existing output") {
+        std::thread releaser;
+        {
+            av::RemuxEngine engine{1};
+            engine.setJobFinishedCallback([released](size_t job, const av::RemuxEngine::JobStats &) {
+                if (job == 0)
+                    released.wait();
+            });
+
+            engine.addJob(AbsentInput, Output0);
+            engine.addJob(AbsentInput, Output1);
+
+            // Release worker while destructor waits for it
+            releaser = std::thread([&release] {
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                release.set_value();
+            });
+        }
+        releaser.join();
+
+        CHECK(file_exists(Output0));
+        CHECK(file_exists(Output1));
+    }
+
+    std::remove(Output0);
+    std::remove(Output1);
+}
@@ -0,0 +1,201 @@
+#include <catch2/catch.hpp>
+
+#include <thread>
+#include <chrono>
+#include <vector>
+
+#include "ringbufferio.h"
+
+#ifdef _MSC_VER
+# pragma warning (disable : 4702) // Disable warning: unreachable code
+#endif
+
+namespace {
+
+constexpr size_t TsPacketSize = 188;
+
+// Packets of the fixed size, every byte of the packet is its index
+std::vector<uint8_t> make_packets(size_t first, size_t count)
+{
+    std::vector<uint8_t> data(count * TsPacketSize);
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i] = static_cast<uint8_t>(first + i / TsPacketSize);
+    return data;
+}
+
+std::vector<uint8_t> read_all(av::RingBufferIO &io, int &status)
+{
+    std::vector<uint8_t> result;
+    uint8_t buffer[333];
+    while ((status = io.read(buffer, sizeof(buffer))) > 0)
+        result.insert(result.end(), buffer, buffer + status);
+    return result;
+}
+
+}
+
+TEST_CASE("RingBufferIO", "[RingBufferIO]")
+{
+    SECTION("Block policy keeps all the data") {
+        av::RingBufferIO io{1000};
+        CHECK(io.policy() == av::RingBufferIO::Policy::Block);
+
+        constexpr size_t count = 100000;
+        std::thread producer([&] {
+            std::vector<uint8_t> data(100);
+            for (size_t offset = 0; offset < count; offset += data.size()) {
+                for (size_t i = 0; i < data.size(); ++i)
+                    data[i] = static_cast<uint8_t>(offset + i);
+                io.push(data.data(), data.size());
+            }
+            io.finish();
+        });
+
+        int status = 0;
+        const auto received = read_all(io, status);
+        producer.join();
+
+        CHECK(status == AVERROR_EOF);
+        REQUIRE(received.size() == count);
+        for (size_t i = 0; i < count; ++i) {
+            if (received[i] != static_cast<uint8_t>(i))
+                FAIL("data mismatch at " << i);
+        }
+
+        const auto stats = io.stats();
+        CHECK(stats.bytesPushed == count);
+        CHECK(stats.bytesRead == count);
+        CHECK(stats.bytesDropped == 0);
+        CHECK(stats.peakSize <= io.capacity());
+    }
+
+    SECTION("Block policy waits for the reader") {
+        av::RingBufferIO io{1000};
+        const std::vector<uint8_t> data(1000, 1);
+        CHECK(io.push(data.data(), data.size()) == data.size());
+
+        size_t pushed = 0;
+        std::thread producer([&] { pushed = io.push(data.data(), 100); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        CHECK(io.stats().size == 1000);
+
+        uint8_t buffer[100];
+        CHECK(io.read(buffer, sizeof(buffer)) == 100);
+        producer.join();
+
+        CHECK(pushed == 100);
+        CHECK(io.stats().producerWaits >= 1);
+        CHECK(io.stats().bytesDropped == 0);
+    }
+
+    SECTION("DropOldest drops whole packets") {
+        av::RingBufferIO io{1000, av::RingBufferIO::Policy::DropOldest};
+        io.setDropAlignment(TsPacketSize);
+        CHECK(io.dropAlignment() == TsPacketSize);
+
+        size_t pushed = 0;
+        for (size_t i = 0; i < 5; ++i) {
+            const auto packets = make_packets(i * 3, 3);
+            CHECK(io.push(packets.data(), packets.size()) == packets.size());
+            pushed += packets.size();
+        }
+
+        const auto stats = io.stats();
+        CHECK(stats.producerWaits == 0);
+        CHECK(stats.bytesDropped > 0);
+        CHECK(stats.bytesDropped % TsPacketSize == 0);
+        CHECK(stats.size + stats.bytesDropped == pushed);
+
+        io.finish();
+        int status = 0;
+        const auto received = read_all(io, status);
+        CHECK(status == AVERROR_EOF);
+
+        // Remaining data starts at the packet boundary and ends with the last packet
+        REQUIRE(received.size() % TsPacketSize == 0);
+        REQUIRE(!received.empty());
+        const size_t first = stats.bytesDropped / TsPacketSize;
+        for (size_t i = 0; i < received.size(); ++i) {
+            if (received[i] != static_cast<uint8_t>(first + i / TsPacketSize))
+                FAIL("packet mismatch at " << i);
+        }
+        CHECK(received.back() == 14);
+    }
+
+    SECTION("finish() - EOF after buffered data") {
+        av::RingBufferIO io{64};
+        const uint8_t data[10] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+        CHECK(io.push(data, sizeof(data)) == sizeof(data));
+        io.finish();
+
+        // Finished buffer rejects data
+        CHECK(io.push(data, sizeof(data)) == 0);
+
+        uint8_t buffer[64];
+        CHECK(io.read(buffer, 4) == 4);
+        CHECK(io.read(buffer, sizeof(buffer)) == 6);
+        CHECK(buffer[5] == 9);
+        CHECK(io.read(buffer, sizeof(buffer)) == AVERROR_EOF);
+        CHECK(io.read(buffer, sizeof(buffer)) == AVERROR_EOF);
+    }
+
+    SECTION("finish() wakes up waiting reader") {
+        av::RingBufferIO io{64};
+
+        int status = 0;
+        std::thread reader([&] {
+            uint8_t buffer[16];
+            status = io.read(buffer, sizeof(buffer));
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        io.finish();
+        reader.join();
+
+        CHECK(status == AVERROR_EOF);
+    }
+
+    SECTION("interrupt() - AVERROR_EXIT") {
+        av::RingBufferIO io{64};
+        auto callback = io.interruptCallback();
+        CHECK(callback() == 0);
+
+        int status = 0;
+        std::thread reader([&] {
+            uint8_t buffer[16];
+            status = io.read(buffer, sizeof(buffer));
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        io.interrupt();
+        reader.join();
+
+        CHECK(status == AVERROR_EXIT);
+        CHECK(io.isInterrupted());
+        CHECK(callback() == 1);
+
+        // Buffered data is not returned after interrupt, new data is rejected
+        const uint8_t data[4] = {};
+        CHECK(io.push(data, sizeof(data)) == 0);
+        uint8_t buffer[4];
+        CHECK(io.read(buffer, sizeof(buffer)) == AVERROR_EXIT);
+
+        io.reset();
+        CHECK_FALSE(io.isInterrupted());
+        CHECK(io.push(data, sizeof(data)) == sizeof(data));
+        CHECK(io.read(buffer, sizeof(buffer)) == 4);
+    }
+
+    SECTION("Interrupt callback aborts waiting producer") {
+        av::RingBufferIO io{16};
+        std::atomic<bool> stop{false};
+        io.setInterruptCallback([&stop] { return stop ? 1 : 0; });
+
+        const std::vector<uint8_t> data(32, 1);
+        size_t pushed = 0;
+        std::thread producer([&] { pushed = io.push(data.data(), data.size()); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        stop = true;
+        producer.join();
+
+        CHECK(pushed == 16);
+    }
+}
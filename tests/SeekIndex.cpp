@@ -0,0 +1,160 @@
+#include <catch2/catch.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "seekindex.h"
+
+#ifdef _MSC_VER
+# pragma warning (disable : 4702) // Disable warning: unreachable code
+#endif
+
+namespace {
+
+const char MediaPath[]   = "seekindex-test.media";
+const char SidecarPath[] = "seekindex-test.media.avidx";
+const char CopyPath[]    = "seekindex-test.copy.avidx";
+
+template<typename T>
+void append(std::string &out, const T &value)
+{
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void write_file(const std::string &path, const std::string &data)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(data.data(), static_cast<std::streamsize>(data.size()));
+}
+
+std::string read_file(const std::string &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+// Sidecar layout: magic, media size, media mtime, streams count, then per stream: index,
+// time base num/den, entries count and entries
+constexpr size_t HeaderSize      = 8 + 8 + 8;
+constexpr size_t EntriesCountPos = HeaderSize + 4 + 3 * 4;
+
+std::string make_sidecar(const std::string &header)
+{
+    std::string sidecar = header;
+    append(sidecar, uint32_t(2));
+
+    append(sidecar, int32_t(0));
+    append(sidecar, int32_t(1));
+    append(sidecar, int32_t(90000));
+    append(sidecar, uint64_t(3));
+    for (int64_t i = 0; i < 3; ++i)
+        append(sidecar, av::SeekIndex::Entry{i * 180000, i * 4096});
+
+    append(sidecar, int32_t(2));
+    append(sidecar, int32_t(1));
+    append(sidecar, int32_t(48000));
+    append(sidecar, uint64_t(1));
+    append(sidecar, av::SeekIndex::Entry{0, 188});
+
+    return sidecar;
+}
+
+// Index saved for the media file: reference sidecar with the valid key
+std::string saved_sidecar(const av::SeekIndex &index)
+{
+    index.save(CopyPath, MediaPath);
+    return read_file(CopyPath);
+}
+
+}
+
+TEST_CASE("SeekIndex sidecar", "[SeekIndex]")
+{
+    write_file(MediaPath, std::string(10000, 'x'));
+
+    // Take magic and valid media key from the saved empty index
+    av::SeekIndex empty;
+    const auto header = saved_sidecar(empty).substr(0, HeaderSize);
+    REQUIRE(header.size() == HeaderSize);
+
+    const auto sidecar = make_sidecar(header);
+    write_file(SidecarPath, sidecar);
+
+    SECTION("Save and load round trip") {
+        av::SeekIndex index;
+        REQUIRE(index.load(SidecarPath, MediaPath));
+        CHECK_FALSE(index.isEmpty());
+        CHECK(index.streams() == std::vector<int>{0, 2});
+
+        const auto &video = index.entries(0);
+        REQUIRE(video.size() == 3);
+        CHECK(video[2].pts == 360000);
+        CHECK(video[2].pos == 8192);
+        CHECK(index.entries(2).size() == 1);
+        CHECK(index.entries(1).empty());
+
+        const auto entry = index.find(av::Timestamp(3, av::Rational(1, 1)), 0);
+        REQUIRE(entry);
+        CHECK(entry->pts == 180000);
+
+        // Saved index is the same sidecar
+        CHECK(saved_sidecar(index) == sidecar);
+
+        av::SeekIndex loaded;
+        REQUIRE(loaded.load(CopyPath, MediaPath));
+        CHECK(loaded.streams() == index.streams());
+        CHECK(loaded.entries(0).size() == 3);
+    }
+
+    SECTION("Stale key is rejected") {
+        // Media file size changed after the index was saved
+        write_file(MediaPath, std::string(10001, 'x'));
+
+        av::SeekIndex index;
+        std::error_code ec;
+        CHECK_FALSE(index.load(SidecarPath, MediaPath, ec));
+        CHECK(!ec);
+        CHECK(index.isEmpty());
+    }
+
+    SECTION("Truncated file is rejected") {
+        av::SeekIndex index;
+        for (size_t size : {size_t(4), size_t(30), sidecar.size() - 1}) {
+            write_file(SidecarPath, sidecar.substr(0, size));
+
+            std::error_code ec;
+            CHECK_FALSE(index.load(SidecarPath, MediaPath, ec));
+            CHECK(!ec);
+            CHECK(index.isEmpty());
+        }
+    }
+
+    SECTION("Entries count beyond the file end is rejected") {
+        // Must not allocate memory for the entries that are not in the file
+        auto damaged = sidecar;
+        const uint64_t count = uint64_t(1) << 31;
+        damaged.replace(EntriesCountPos, sizeof(count), reinterpret_cast<const char*>(&count), sizeof(count));
+        write_file(SidecarPath, damaged);
+
+        av::SeekIndex index;
+        std::error_code ec;
+        CHECK_FALSE(index.load(SidecarPath, MediaPath, ec));
+        CHECK(!ec);
+        CHECK(index.isEmpty());
+    }
+
+    SECTION("Absent sidecar is not an error") {
+        av::SeekIndex index;
+        std::error_code ec;
+        CHECK_FALSE(index.load("seekindex-test.absent.avidx", MediaPath, ec));
+        CHECK(!ec);
+    }
+
+    std::remove(MediaPath);
+    std::remove(SidecarPath);
+    std::remove(CopyPath);
+}
@@ -0,0 +1,143 @@
+#include <catch2/catch.hpp>
+
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "format.h"
+#include "formatcontext.h"
+#include "packet.h"
+#include "segmentwriter.h"
+
+#ifdef _MSC_VER
+# pragma warning (disable : 4702) // Disable warning: unreachable code
+#endif
+
+namespace {
+
+const av::Rational TimeBase{1, 1000};
+
+constexpr int Packets     = 50;
+constexpr int PacketTime  = 100; // ms
+constexpr int KeyInterval = 5;
+constexpr int Segments    = 5;
+
+const char SegmentPattern[] = "segmentwriter-test-%d.crc";
+const char PlaylistPath[]   = "segmentwriter-test.m3u8";
+
+std::string read_file(const std::string &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+bool file_exists(const std::string &path)
+{
+    return std::ifstream(path).good();
+}
+
+std::string segment_path(int index)
+{
+    char path[64];
+    std::snprintf(path, sizeof(path), SegmentPattern, index);
+    return path;
+}
+
+// framecrc muxer writes line per packet: stream index, DTS, PTS, duration, size, CRC
+std::vector<int64_t> written_dts(const std::string &output)
+{
+    std::vector<int64_t> result;
+    std::istringstream in(output);
+    std::string line;
+    while (std::getline(in, line)) {
+        int index;
+        int64_t dts;
+        if (line.empty() || line[0] == '#' || std::sscanf(line.c_str(), "%d, %" SCNd64, &index, &dts) != 2)
+            continue;
+        result.push_back(dts);
+    }
+    return result;
+}
+
+av::Packet make_packet(int64_t dts, bool key)
+{
+    std::vector<uint8_t> data(16, static_cast<uint8_t>(dts));
+    av::Packet packet{data};
+    packet.setStreamIndex(0);
+    packet.setDts(av::Timestamp(dts, TimeBase));
+    packet.setPts(av::Timestamp(dts, TimeBase));
+    packet.setDuration(PacketTime, TimeBase);
+    packet.setKeyPacket(key);
+    return packet;
+}
+
+}
+
+TEST_CASE("SegmentWriter", "[SegmentWriter]")
+{
+    auto format = av::guessOutputFormat("framecrc");
+    if (format.isNull()) {
+        WARN("framecrc muxer is not available, skipped");
+        return;
+    }
+
+    SECTION("Segments are cut at the key packets and listed in the playlist") {
+        av::SegmentWriter writer;
+        writer.setSegmentDuration(av::Timestamp(1, av::Rational(1, 1)));
+        writer.setPlaylistPath(PlaylistPath);
+        writer.setSync(false);
+
+        writer.open(SegmentPattern, format, [](av::FormatContext &segment) {
+            auto st = segment.addStream(av::Codec());
+            st.raw()->codecpar->codec_type = AVMEDIA_TYPE_DATA;
+            st.raw()->codecpar->codec_id   = AV_CODEC_ID_BIN_DATA;
+            st.setTimeBase(TimeBase);
+        });
+        REQUIRE(writer.isOpened());
+
+        // Key packet every 500 ms, segment is cut at the first key packet after 1 second
+        for (int i = 0; i < Packets; ++i)
+            writer.writePacket(make_packet(i * PacketTime, i % KeyInterval == 0));
+        writer.close();
+
+        const auto segments = writer.segments();
+        REQUIRE(segments.size() == size_t(Segments));
+        for (int i = 0; i < Segments; ++i) {
+            INFO("segment " << i);
+            const auto &segment = segments[size_t(i)];
+            CHECK(segment.index == size_t(i));
+            CHECK(segment.path == segment_path(i));
+            CHECK(segment.finalized);
+            CHECK(segment.start == av::Timestamp(i * 1000, TimeBase));
+            CHECK(segment.end == av::Timestamp((i + 1) * 1000, TimeBase));
+
+            // Packets keep their timestamps
+            std::vector<int64_t> expected;
+            for (int p = 0; p < Packets / Segments; ++p)
+                expected.push_back(i * 1000 + p * PacketTime);
+            CHECK(written_dts(read_file(segment.path)) == expected);
+        }
+
+        // Prepared ahead of time and not used
+        CHECK_FALSE(file_exists(segment_path(Segments)));
+
+        std::string expected =
+            "#EXTM3U\n"
+            "#EXT-X-VERSION:3\n"
+            "#EXT-X-TARGETDURATION:1\n"
+            "#EXT-X-MEDIA-SEQUENCE:0\n";
+        for (int i = 0; i < Segments; ++i)
+            expected += "#EXTINF:1.000000,\n" + segment_path(i) + "\n";
+        expected += "#EXT-X-ENDLIST\n";
+        CHECK(read_file(PlaylistPath) == expected);
+        CHECK_FALSE(file_exists(std::string(PlaylistPath) + ".tmp"));
+    }
+
+    for (int i = 0; i <= Segments; ++i)
+        std::remove(segment_path(i).c_str());
+    std::remove(PlaylistPath);
+}
@@ -0,0 +1,143 @@
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "codec.h"
+#include "codeccontext.h"
+#include "format.h"
+#include "formatcontext.h"
+#include "packet.h"
+#include "segmentedtranscoder.h"
+
+#ifdef _MSC_VER
+# pragma warning (disable : 4702) // Disable warning: unreachable code
+#endif
+
+namespace {
+
+constexpr int Width   = 128;
+constexpr int Height  = 96;
+constexpr int Frames  = 50;
+constexpr int GopSize = 10;
+
+// Matroska and MP4 muxers replace stream time base in writeHeader()
+const char InputPath[]  = "segmentedtranscoder-test.in.mkv";
+const char OutputPath[] = "segmentedtranscoder-test.out.mp4";
+
+bool write_input(const av::Codec &codec)
+{
+    av::OutputFormat ofmt;
+    ofmt.setFormat(std::string(), InputPath);
+
+    av::FormatContext octx;
+    octx.setFormat(ofmt);
+
+    const av::Rational timeBase{1, 25};
+
+    auto ost = octx.addStream(codec);
+    av::VideoEncoderContext encoder{ost, codec};
+    encoder.setWidth(Width);
+    encoder.setHeight(Height);
+    encoder.setPixelFormat(AV_PIX_FMT_YUV420P);
+    encoder.setTimeBase(timeBase);
+    encoder.setGopSize(GopSize);
+    if (octx.outputFormat().isFlags(AVFMT_GLOBALHEADER))
+        encoder.addFlags(AV_CODEC_FLAG_GLOBAL_HEADER);
+    ost.setFrameRate({25, 1});
+    ost.setTimeBase(timeBase);
+
+    std::error_code ec;
+    encoder.open(ec);
+    if (ec)
+        return false;
+
+    octx.openOutput(InputPath);
+    octx.writeHeader();
+
+    auto write = [&octx](av::Packet &packet) {
+        packet.setStreamIndex(0);
+        octx.writePacket(packet);
+    };
+
+    for (int i = 0; i < Frames; ++i) {
+        av::VideoFrame frame{AV_PIX_FMT_YUV420P, Width, Height, 32};
+        for (int plane = 0; plane < 3; ++plane) {
+            const int rows = plane ? Height / 2 : Height;
+            std::memset(frame.raw()->data[plane], 8 * i + 40 * plane, size_t(frame.raw()->linesize[plane]) * rows);
+        }
+        frame.setTimeBase(timeBase);
+        frame.setPts(av::Timestamp(i, timeBase));
+        encoder.encodeAll(frame, write);
+    }
+    encoder.encodeAll(av::VideoFrame::null(), write);
+
+    octx.writePacket();
+    octx.writeTrailer();
+    return true;
+}
+
+}
+
+TEST_CASE("SegmentedTranscoder", "[SegmentedTranscoder]")
+{
+    auto codec = av::findEncodingCodec("mpeg4");
+    if (codec.isNull() || av::guessOutputFormat("matroska").isNull() || av::guessOutputFormat("mp4").isNull()) {
+        WARN("mpeg4 encoder, matroska or mp4 muxer is not available, skipped");
+        return;
+    }
+
+    REQUIRE(write_input(codec));
+
+    SECTION("Chunks with encoder delay are stitched in the output time base") {
+        av::SegmentedTranscoder transcoder;
+        transcoder.setJobs(2);
+        transcoder.setChunksCount(4);
+        transcoder.setEncoderSetup([](av::VideoEncoderContext &encoder, const av::VideoDecoderContext &decoder) {
+            encoder.setWidth(decoder.width());
+            encoder.setHeight(decoder.height());
+            encoder.setPixelFormat(decoder.pixelFormat());
+            encoder.setTimeBase(decoder.stream().timeBase());
+            encoder.setGopSize(GopSize);
+            // B-frames: chunk starts with DTS before its first PTS and overlaps previous chunk
+            encoder.raw()->max_b_frames = 2;
+        });
+
+        std::error_code ec;
+        transcoder.transcode(InputPath, OutputPath, codec, ec);
+        REQUIRE(!ec);
+        CHECK(transcoder.stats().chunks > 1);
+        CHECK(transcoder.stats().framesEncoded == Frames);
+
+        av::FormatContext ictx;
+        ictx.openInput(OutputPath);
+        ictx.findStreamInfo();
+        REQUIRE(ictx.streamsCount() == 1);
+
+        const auto timeBase = ictx.stream(0).timeBase();
+        std::vector<int64_t> dts;
+        std::vector<int64_t> pts;
+        while (auto packet = ictx.readPacket()) {
+            dts.push_back(packet.dts().timestamp(timeBase));
+            pts.push_back(packet.pts().timestamp(timeBase));
+            CHECK(pts.back() >= dts.back());
+        }
+
+        REQUIRE(dts.size() == size_t(Frames));
+        for (size_t i = 1; i < dts.size(); ++i)
+            CHECK(dts[i] > dts[i - 1]);
+
+        // Presentation timeline is kept: no jump by the mixed time base offset
+        std::sort(pts.begin(), pts.end());
+        const int64_t span = pts.back() - pts.front();
+        const int64_t expected = av::Timestamp(Frames - 1, av::Rational(1, 25)).timestamp(timeBase);
+        CHECK(span >= expected);
+        CHECK(span < expected + av::Timestamp(GopSize, av::Rational(1, 25)).timestamp(timeBase));
+    }
+
+    std::remove(InputPath);
+    std::remove(OutputPath);
+}
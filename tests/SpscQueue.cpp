@@ -0,0 +1,212 @@
+#include <catch2/catch.hpp>
+
+#include <thread>
+#include <chrono>
+#include <vector>
+
+#include "spscqueue.h"
+#include "asyncdecoder.h"
+
+#ifdef _MSC_VER
+# pragma warning (disable : 4702) // Disable warning: unreachable code
+#endif
+
+namespace {
+
+// Produces one frame per packet: packet pts value
+struct FakeDecoder
+{
+    template<typename Callback>
+    size_t decodeAll(const av::Packet &packet, Callback &&callback, std::error_code &/*ec*/)
+    {
+        if (!packet)
+            return 0;
+        int frame = static_cast<int>(packet.raw()->pts);
+        callback(frame);
+        return 1;
+    }
+
+    void flushBuffers(std::error_code &/*ec*/)
+    {
+        ++flushes;
+    }
+
+    int flushes = 0;
+};
+
+av::Packet make_packet(int64_t pts)
+{
+    static const uint8_t data[] = {1, 2, 3, 4};
+    av::Packet packet{data, sizeof(data)};
+    packet.raw()->pts = pts;
+    return packet;
+}
+
+}
+
+namespace av {
+template<>
+struct DecoderFrameType<FakeDecoder>
+{
+    using type = int;
+};
+}
+
+TEST_CASE("SpscQueue", "[SpscQueue]")
+{
+    SECTION("Push and pop in order") {
+        av::SpscQueue<int> queue{4};
+        CHECK(queue.capacity() == 4);
+        CHECK(queue.empty());
+
+        for (int i = 0; i < 4; ++i)
+            CHECK(queue.tryPush(i));
+        CHECK(queue.size() == 4);
+
+        int value = -1;
+        for (int i = 0; i < 4; ++i) {
+            CHECK(queue.tryPop(value));
+            CHECK(value == i);
+        }
+        CHECK_FALSE(queue.tryPop(value));
+    }
+
+    SECTION("tryPush at capacity") {
+        av::SpscQueue<int> queue{2};
+        CHECK(queue.tryPush(1));
+        CHECK(queue.tryPush(2));
+
+        int value = 3;
+        CHECK_FALSE(queue.tryPush(value));
+        CHECK(value == 3); // not moved out
+
+        int out;
+        CHECK(queue.tryPop(out));
+        CHECK(queue.tryPush(value));
+        CHECK(queue.size() == 2);
+    }
+
+    SECTION("close") {
+        av::SpscQueue<int> queue{2};
+        CHECK(queue.push(1));
+        queue.close();
+
+        CHECK(queue.isClosed());
+        CHECK_FALSE(queue.push(2));
+
+        // Queued items are returned after close
+        int value = 0;
+        CHECK(queue.pop(value));
+        CHECK(value == 1);
+        CHECK_FALSE(queue.pop(value));
+
+        queue.reopen();
+        CHECK(queue.tryPush(3));
+    }
+
+    SECTION("close wakes up blocked push") {
+        av::SpscQueue<int> queue{1};
+        CHECK(queue.push(1));
+
+        bool pushed = true;
+        std::thread producer([&] { pushed = queue.push(2); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        queue.close();
+        producer.join();
+
+        CHECK_FALSE(pushed);
+    }
+
+    SECTION("popFor timeout") {
+        av::SpscQueue<int> queue{1};
+        int value = 0;
+        CHECK_FALSE(queue.popFor(value, std::chrono::milliseconds(10)));
+    }
+
+    SECTION("Blocking producer and consumer") {
+        constexpr int count = 10000;
+        av::SpscQueue<int> queue{8};
+
+        std::thread producer([&] {
+            for (int i = 0; i < count; ++i)
+                queue.push(i);
+            queue.close();
+        });
+
+        std::vector<int> received;
+        int value;
+        while (queue.pop(value))
+            received.push_back(value);
+        producer.join();
+
+        REQUIRE(received.size() == count);
+        for (int i = 0; i < count; ++i)
+            CHECK(received[i] == i);
+    }
+}
+
+TEST_CASE("AsyncDecoder", "[AsyncDecoder]")
+{
+    SECTION("Single thread non-blocking use") {
+        av::AsyncDecoder<FakeDecoder> decoder{FakeDecoder(), 2, 2};
+
+        std::vector<int> frames;
+        int frame;
+        for (int i = 0; i < 16; ++i) {
+            auto packet = make_packet(i);
+            while (!decoder.trySendPacket(packet)) {
+                while (decoder.tryReceiveFrame(frame))
+                    frames.push_back(frame);
+                std::this_thread::yield();
+            }
+        }
+
+        while (!decoder.trySendEof()) {
+            while (decoder.tryReceiveFrame(frame))
+                frames.push_back(frame);
+            std::this_thread::yield();
+        }
+
+        while (decoder.receiveFrame(frame))
+            frames.push_back(frame);
+
+        CHECK(decoder.isEof());
+        REQUIRE(frames.size() == 16);
+        for (int i = 0; i < 16; ++i)
+            CHECK(frames[i] == i);
+    }
+
+    SECTION("Flush concurrently with sending") {
+        av::AsyncDecoder<FakeDecoder> decoder{FakeDecoder(), 4, 4};
+        std::atomic<bool> flushed{false};
+
+        std::thread sender([&] {
+            for (int i = 0; i < 1000; ++i)
+                decoder.sendPacket(make_packet(i));
+            while (!flushed)
+                std::this_thread::yield();
+            decoder.sendPacket(make_packet(1000));
+            decoder.sendEof();
+        });
+
+        int frame;
+        for (int i = 0; i < 10; ++i) {
+            decoder.tryReceiveFrame(frame);
+            decoder.flush();
+        }
+        flushed = true;
+
+        // Frames after flush keep packet order
+        int last = -1;
+        while (decoder.receiveFrame(frame)) {
+            CHECK(frame > last);
+            last = frame;
+        }
+        CHECK(last == 1000);
+        CHECK(decoder.isEof());
+
+        sender.join();
+        decoder.stop();
+        CHECK(decoder.decoder().flushes == 10);
+    }
+}